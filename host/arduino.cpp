@@ -0,0 +1,184 @@
+#include <Arduino.h>
+#include <TeensyTimerTool.h>
+#include <time.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+HostSerial Serial;
+
+size_t Print::write(const uint8_t *buf, const size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    write(buf[i]);
+  }
+  return n;
+}
+
+int Print::printf(const char *fmt, ...) {
+  char buf[512];
+  va_list ap;
+  va_start(ap, fmt);
+  const int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  if (n > 0) {
+    write((const uint8_t *) buf, min((size_t) n, sizeof(buf) - 1));
+  }
+  return n;
+}
+
+size_t Print::print(const long v, const int base) {
+  if (base == DEC) {
+    return printf("%ld", v);
+  }
+  return print((unsigned long) v, base);
+}
+
+size_t Print::print(const unsigned long v, const int base) {
+  return printf(base == OCT ? "%lo" : base == HEX ? "%lX" : "%lu", v);
+}
+
+String Stream::readStringUntil(const char end) {
+  std::string s;
+  while (available()) {
+    const int c = read();
+    if (c < 0 || c == end) {
+      break;
+    }
+    s += (char) c;
+  }
+  return String(s);
+}
+
+static struct termios saved;
+
+static void restore_tty() {
+  tcsetattr(0, TCSANOW, &saved);
+}
+
+// raw, so the guest gets every key including ^C, ^P is the monitor
+void HostSerial::begin(unsigned long) {
+  if (isatty(0) && tcgetattr(0, &saved) == 0) {
+    struct termios t = saved;
+    cfmakeraw(&t);
+    tcsetattr(0, TCSANOW, &t);
+    atexit(restore_tty);
+  }
+  setvbuf(stdout, nullptr, _IOFBF, 4096);
+}
+
+// polled at 1 kHz, output without a newline goes out from here
+int HostSerial::available() {
+  fflush(stdout);
+  if (next >= 0) {
+    return 1;
+  }
+  struct pollfd p = { 0, POLLIN, 0 };
+  uint8_t c;
+  if (closed || poll(&p, 1, 0) != 1 || !(p.revents & (POLLIN | POLLHUP))) {
+    return 0;
+  }
+  const ssize_t n = ::read(0, &c, 1);
+  if (n == 1) {
+    next = c;
+    return 1;
+  }
+  closed = n == 0;
+  return 0;
+}
+
+int HostSerial::read() {
+  if (!available()) {
+    return -1;
+  }
+  const int c = next;
+  next = -1;
+  return c;
+}
+
+int HostSerial::peek() {
+  return available() ? next : -1;
+}
+
+size_t HostSerial::write(const uint8_t c) {
+  putchar(c);
+  if (c == '\n') {
+    fflush(stdout);
+  }
+  return 1;
+}
+
+size_t HostSerial::write(const uint8_t *buf, const size_t n) {
+  fwrite(buf, 1, n, stdout);
+  if (memchr(buf, '\n', n)) {
+    fflush(stdout);
+  }
+  return n;
+}
+
+void HostSerial::flush() {
+  fflush(stdout);
+}
+
+static uint64_t now_ns() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+uint32_t micros() {
+  return now_ns() / 1000;
+}
+
+uint32_t millis() {
+  return now_ns() / 1000000;
+}
+
+void delay(const uint32_t ms) {
+  fflush(stdout);
+  usleep(ms * 1000);
+}
+
+void yield() {
+  TeensyTimerTool::PeriodicTimer::poll();
+}
+
+namespace TeensyTimerTool {
+
+static thread_local PeriodicTimer *timers;
+
+PeriodicTimer::~PeriodicTimer() {
+  stop();
+}
+
+void PeriodicTimer::begin(void (*f)(), const uint32_t us) {
+  stop();
+  fn = f;
+  period = (uint64_t) us * 1000;
+  due = now_ns() + period;
+  next = timers;
+  timers = this;
+}
+
+void PeriodicTimer::stop() {
+  for (PeriodicTimer **p = &timers; *p; p = &(*p)->next) {
+    if (*p == this) {
+      *p = next;
+      break;
+    }
+  }
+}
+
+void PeriodicTimer::poll() {
+  const uint64_t t = now_ns();
+  for (PeriodicTimer *p = timers; p; p = p->next) {
+    if (t >= p->due) {
+      p->due += p->period;
+      if (p->due <= t) {
+        p->due = t + p->period - (t - p->due) % p->period;
+      }
+      p->fn();
+    }
+  }
+}
+
+};
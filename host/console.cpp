@@ -0,0 +1,160 @@
+#include <Arduino.h>
+#include <unistd.h>
+#include <pdp11.h>
+#include "cpu.h"
+#include "sched.h"
+#include "dl11.h"
+#include "kw11.h"
+#include "snap.h"
+#include "tbuf.h"
+#include "bcache.h"
+#include "jit.h"
+#include "machine.h"
+#include "console.h"
+#include "panel.h"
+
+// the monitor of the host build. ^P stops the machine and reads a few
+// commands from the terminal, the full console with the sd card, wifi
+// and the front panel is the teensy's.
+namespace console {
+
+bool active = false;
+
+void reset_machine() {
+  machine::stop();
+  exit(0);
+}
+
+void setup(bool brk) {
+  active = true;
+  if (brk) {
+    print_state();
+  }
+}
+
+// a line from the terminal, which is in raw mode
+static void readline(char *buf, const uint32_t n) {
+  uint32_t i = 0;
+  for (;;) {
+    const int c = Serial.read();
+    if (c < 0 && Serial.eof()) {
+      Serial.println();
+      Serial.println("end of input");
+      machine::stop();
+      exit(1);
+    }
+    if (c < 0) {
+      usleep(10000);
+      continue;
+    }
+    if (c == '\r' || c == '\n') {
+      break;
+    }
+    if ((c == 0x7f || c == 0x08) && i > 0) {
+      i--;
+      Serial.print("\b \b");
+    } else if (c >= ' ' && c < 0x7f && i < n - 1) {
+      buf[i++] = c;
+      Serial.write((uint8_t) c);
+    }
+  }
+  buf[i] = 0;
+  Serial.println();
+}
+
+// the block cache and its x86-64 code, native and handlers switch
+// between the compiled blocks and their handler ops
+static void blocks(const char *arg) {
+  if (arg) {
+    if (!strcmp(arg, "on") || !strcmp(arg, "verify")) {
+      bcache::flush();
+      bcache::enabled = true;
+      bcache::verify = !strcmp(arg, "verify");
+    } else if (!strcmp(arg, "off")) {
+      bcache::enabled = false;
+      bcache::verify = false;
+      bcache::logging = false;
+#if BC_JIT
+    } else if (!strcmp(arg, "native") || !strcmp(arg, "handlers")) {
+      jit::reset();
+      jit::enabled = arg[0] == 'n';
+#endif
+    } else {
+      Serial.println("blocks [on|off|verify|native|handlers]");
+    }
+    return;
+  }
+  Serial.printf("blocks: %s%s, %u hits, %u misses, %u dropped, %u mismatches\r\n",
+    bcache::enabled ? "on" : "off", bcache::verify ? " (verify)" : "",
+    bcache::hits, bcache::misses, bcache::drops, bcache::mismatches);
+  if (bcache::verify) {
+    Serial.printf("%u run in lockstep, %u not\r\n", bcache::verified, bcache::skipped);
+  }
+#if BC_JIT
+  Serial.printf("x86-64 code: %s, %u blocks compiled, %u not, %u resets\r\n",
+    jit::enabled ? "on" : "off", jit::compiled, jit::failed, jit::resets);
+  Serial.printf("%u ops native, %u calls, %llu runs, %llu side exits\r\n", jit::native,
+    jit::called, (unsigned long long) jit::runs, (unsigned long long) jit::exits);
+#endif
+}
+
+void loop(bool brk) {
+  setup(brk);
+  while (active) {
+    char line[128];
+    char *argv[4] = {};
+    uint32_t argc = 0;
+    Serial.print("pdp11> ");
+    Serial.flush();
+    readline(line, sizeof(line));
+    for (char *p = strtok(line, " "); p && argc < 4; p = strtok(nullptr, " ")) {
+      argv[argc++] = p;
+    }
+    if (argc == 0) {
+      continue;
+    }
+    if (!strcmp(argv[0], "cont") || !strcmp(argv[0], "c")) {
+      active = false;
+    } else if (!strcmp(argv[0], "quit") || !strcmp(argv[0], "q")) {
+      reset_machine();
+    } else if (!strcmp(argv[0], "state")) {
+      print_state();
+    } else if (!strcmp(argv[0], "save") && argc == 2) {
+      snap::save(argv[1]);
+    } else if (!strcmp(argv[0], "restore") && argc == 2) {
+      snap::restore(argv[1]);
+    } else if (!strcmp(argv[0], "ckpt") && argc == 2) {
+      snap::checkpoint(argv[1]);
+    } else if (!strcmp(argv[0], "tb") && argc == 2) {
+      tbuf::save(argv[1]);
+    } else if (!strcmp(argv[0], "blocks")) {
+      blocks(argc == 2 ? argv[1] : nullptr);
+    } else {
+      Serial.println("cont, quit, state, save name, restore name, ckpt name, tb file,");
+      Serial.println("blocks [on|off|verify|native|handlers]");
+    }
+  }
+  Serial.println();
+}
+
+};
+
+// no front panel on the host
+namespace panel {
+
+uint32_t hz = 0;
+uint16_t tcounter;
+
+void begin() {
+}
+
+void poll() {
+}
+
+void refresh(bool) {
+}
+
+void display(uint32_t) {
+}
+
+};
@@ -0,0 +1,104 @@
+#pragma once
+
+// the part of the arduino core the emulator uses, implemented over posix
+// for the host build. the teensy build uses the real core.
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <string>
+#include <type_traits>
+
+typedef uint8_t byte;
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+
+#define F(s) (s)
+#define FLASHMEM
+#define FASTRUN
+#define DMAMEM
+#define EXTMEM
+
+// the teensy core has min and max for mixed types
+template <typename A, typename B> static inline typename std::common_type<A, B>::type min(const A a, const B b) {
+  return a < b ? a : b;
+}
+
+template <typename A, typename B> static inline typename std::common_type<A, B>::type max(const A a, const B b) {
+  return a < b ? b : a;
+}
+
+class String {
+  public:
+    String(const char *s = "") : s(s) {}
+    String(const std::string &s) : s(s) {}
+    const char *c_str() const { return s.c_str(); }
+    uint32_t length() const { return s.length(); }
+    String &operator+=(const char c) { s += c; return *this; }
+    bool operator==(const char *o) const { return s == o; }
+  private:
+    std::string s;
+};
+
+class Print {
+  public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buf, size_t n);
+    virtual void flush() {}
+    size_t write(const char *s) { return write((const uint8_t *) s, strlen(s)); }
+    int printf(const char *fmt, ...);
+    size_t print(const char *s) { return write(s); }
+    size_t print(const String &s) { return write(s.c_str()); }
+    size_t print(char c) { return write((uint8_t) c); }
+    size_t print(long v, int base = DEC);
+    size_t print(unsigned long v, int base = DEC);
+    size_t print(int v, int base = DEC) { return print((long) v, base); }
+    size_t print(unsigned v, int base = DEC) { return print((unsigned long) v, base); }
+    size_t println() { return write("\r\n"); }
+    template <typename T> size_t println(const T &v) { return print(v) + println(); }
+    template <typename T> size_t println(const T &v, int base) { return print(v, base) + println(); }
+};
+
+class Stream : public Print {
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    void setTimeout(unsigned long) {}
+    String readStringUntil(char end);
+};
+
+// the usb serial port of the teensy is stdin and stdout, a terminal on
+// stdin is put into raw mode by begin()
+class HostSerial : public Stream {
+  public:
+    void begin(unsigned long baud);
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buf, size_t n) override;
+    using Print::write;
+    void flush() override;
+    operator bool() { return true; }
+    bool eof() { return closed; } // stdin is at its end
+  private:
+    int next = -1; // read ahead by available()
+    bool closed = false;
+};
+
+extern HostSerial Serial;
+
+uint32_t micros();
+uint32_t millis();
+void delay(uint32_t ms);
+// runs the timers which are due, see TeensyTimerTool.h
+void yield();
+
+// the machine runs on one thread, the timers run from its yield()
+static inline void __disable_irq() {}
+static inline void __enable_irq() {}
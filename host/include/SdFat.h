@@ -0,0 +1,44 @@
+#pragma once
+
+// SdFat files over stdio for the host build, paths are host paths
+#include <Arduino.h>
+#include <fcntl.h>
+
+#define O_READ  O_RDONLY
+#define O_WRITE O_WRONLY
+
+class FsFile : public Stream {
+  public:
+    bool open(const char *path, int flags = O_READ);
+    bool close();
+    bool isOpen() const { return f != nullptr; }
+    operator bool() const { return isOpen(); }
+    int read(void *buf, size_t n);
+    int read() override;
+    int peek() override;
+    int available() override;
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buf, size_t n) override;
+    size_t write(const void *buf, size_t n) { return write((const uint8_t *) buf, n); }
+    using Print::write;
+    bool seekSet(uint64_t pos);
+    uint64_t curPosition();
+    uint64_t fileSize();
+    bool sync();
+    bool truncate(uint64_t n);
+    bool preAllocate(uint64_t n) { return true; }
+    bool getName(char *name, size_t n);
+  private:
+    FILE *f = nullptr;
+    int last = 0; // stdio needs a seek between reads and writes
+    std::string path;
+    void turn(int op);
+};
+
+class SdFs {
+  public:
+    bool begin() { return true; }
+    bool exists(const char *path);
+    bool remove(const char *path);
+    bool rename(const char *from, const char *to);
+};
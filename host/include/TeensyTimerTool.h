@@ -0,0 +1,24 @@
+#pragma once
+
+// periodic timers of the host build. they run on the thread that began
+// them, from its yield(), on a monotonic clock. a late timer runs once
+// and keeps its phase.
+#include <Arduino.h>
+
+namespace TeensyTimerTool {
+
+    class PeriodicTimer {
+      public:
+        ~PeriodicTimer();
+        void begin(void (*fn)(), uint32_t us);
+        void stop();
+        // run the timers of this thread which are due
+        static void poll();
+      private:
+        void (*fn)() = nullptr;
+        uint64_t period = 0; // ns
+        uint64_t due = 0;
+        PeriodicTimer *next = nullptr;
+    };
+
+};
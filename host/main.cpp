@@ -0,0 +1,414 @@
+#include <Arduino.h>
+#include <SdFat.h>
+#include <RTClib.h>
+#include <TeensyTimerTool.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <termios.h>
+#include <pthread.h>
+#include <pdp11.h>
+#include "cpu.h"
+#include "sched.h"
+#include "kw11.h"
+#include "kd11.h"
+#include "dl11.h"
+#include "bcache.h"
+#include "jit.h"
+#include "tbuf.h"
+#include "prof.h"
+#include "rr.h"
+#include "snap.h"
+#include "console.h"
+#include "machine.h"
+#include "bench.h"
+#include "ubench.h"
+
+// headless PDP-11/40 for linux. one machine runs on the main thread with
+// its console on stdin and stdout or on a pty, or -j machines run on
+// threads as a benchmark of the host.
+using namespace TeensyTimerTool;
+
+RTC_DS3231 rtc;
+SdFs sd;
+extern "C" uint8_t external_psram_size;
+uint8_t external_psram_size = 0;
+
+// ^T starts and stops the binary trace, see the tb command
+void toggle_trace() {
+  if (tbuf::on) {
+    tbuf::stop();
+  } else {
+    tbuf::start();
+  }
+}
+
+// the number of the machine on a -j thread, those have no monitor
+static thread_local int worker = -1;
+
+// a machine of -j fails its job, the others go on, they all share stdin
+void panic() {
+  if (worker >= 0) {
+    fprintf(stderr, "machine %d: panic at %06o\n", worker, cpu::PC);
+    pthread_exit(nullptr);
+  }
+  print_state();
+  console::loop(true);
+}
+
+// the console of a machine: the characters of -i first, then the
+// terminal or the pty. output goes to out, or nowhere.
+class Console : public Stream {
+  public:
+    Console(const char *script, Stream *in, Stream *out) : script(script), in(in), out(out) {}
+    int available() override {
+      return (script && *script) || (in && in->available());
+    }
+    int read() override {
+      if (script && *script) {
+        return (uint8_t) *script++;
+      }
+      return in ? in->read() : -1;
+    }
+    int peek() override {
+      if (script && *script) {
+        return (uint8_t) *script;
+      }
+      return in ? in->peek() : -1;
+    }
+    size_t write(const uint8_t c) override {
+      return out ? out->write(c) : 1;
+    }
+    using Print::write;
+  private:
+    const char *script;
+    Stream *in;
+    Stream *out;
+};
+
+// the master side of a pty, nonblocking
+class Pty : public Stream {
+  public:
+    bool open() {
+      fd = posix_openpt(O_RDWR | O_NOCTTY);
+      if (fd < 0 || grantpt(fd) || unlockpt(fd)) {
+        return false;
+      }
+      struct termios t;
+      tcgetattr(fd, &t);
+      cfmakeraw(&t);
+      tcsetattr(fd, TCSANOW, &t);
+      fcntl(fd, F_SETFL, O_NONBLOCK);
+      return true;
+    }
+    const char *name() {
+      return ptsname(fd);
+    }
+    int available() override {
+      uint8_t c;
+      if (next < 0 && ::read(fd, &c, 1) == 1) {
+        next = c;
+      }
+      return next >= 0;
+    }
+    int read() override {
+      const int c = available() ? next : -1;
+      next = -1;
+      return c;
+    }
+    int peek() override {
+      return available() ? next : -1;
+    }
+    size_t write(const uint8_t c) override {
+      return ::write(fd, &c, 1) == 1; // dropped while nobody has the slave open
+    }
+    using Print::write;
+  private:
+    int fd = -1;
+    int next = -1;
+};
+
+struct options {
+  machine::config c;
+  uint64_t n = 0;         // instructions, 0 runs until quit
+  const char *script = nullptr;
+  const char *save = nullptr;
+  const char *bench = nullptr;  // script, with the results and the baseline
+  const char *results = nullptr;
+  const char *baseline = nullptr;
+  const char *ubench = nullptr; // group, or all
+  bool vclock = false;
+  bool blocks = false;
+  bool native = true;     // the blocks as x86-64 code, else their handlers
+  bool verify = false;    // the blocks in lockstep with the interpreter
+  bool pty = false;
+  uint32_t jobs = 0;      // benchmark machines, 0 runs one interactive
+  uint32_t batch = SCHED_MAXBATCH;
+};
+
+struct result {
+  uint64_t instr, idle;
+  double secs;
+  bool ok;
+};
+
+static void lks_tick() {
+  if (!console::active && !kw11::vclock) {
+    if (rr::mode) {
+      rr::tick();
+    } else {
+      kw11::tick();
+    }
+  }
+}
+
+// the console poll of the teensy's usb serial, at 1 kHz
+static void host_tick() {
+  if (dl11::port->available()) {
+    sched::post(sched::WORK_INPUT);
+  }
+  if (!console::active) {
+    prof::tick(true);
+  }
+}
+
+static double now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// power on, run and time one machine on the calling thread
+static result run(const options &o, Stream *con) {
+  result r = {};
+  machine::config c = o.c;
+  c.console = con;
+  if (!machine::start(c)) {
+    return r;
+  }
+  if (o.vclock) {
+    kw11::setmode(true, 0);
+  }
+  if (o.bench && !bench::begin(o.bench, o.results, o.baseline)) {
+    return r;
+  }
+  bcache::enabled = o.blocks;
+  bcache::verify = o.verify;
+  jit::enabled = o.native;
+  sched::batch = o.batch;
+  PeriodicTimer lks, hostpoll;
+  lks.begin(lks_tick, 16667);
+  hostpoll.begin(host_tick, 1000);
+  const uint64_t i0 = sched::icount, s0 = sched::idle_icount;
+  const double t0 = now();
+  const uint64_t end = o.n ? sched::icount + o.n : UINT64_MAX;
+  while (sched::icount < end && !bench::done) {
+    machine::run(min(end, sched::icount + 100000)); // looks at the script between the runs
+  }
+  r.secs = now() - t0;
+  r.instr = sched::icount - i0;
+  r.idle = sched::idle_icount - s0;
+  r.ok = !bench::failed;
+  return r;
+}
+
+static const options *opts;
+static result *results;
+
+static void *job(void *arg) {
+  const uintptr_t i = (uintptr_t) arg;
+  Console con(opts->script, nullptr, nullptr);
+  worker = i;
+  results[i] = {}; // not ok if panic() ends the thread
+  results[i] = run(*opts, &con);
+  return nullptr;
+}
+
+// every machine boots from its own copy of the images in ram, none is
+// written back
+static int parallel(const options &o) {
+  opts = &o;
+  results = new result[o.jobs];
+  pthread_t *t = new pthread_t[o.jobs];
+  const double t0 = now();
+  for (uintptr_t i = 0; i < o.jobs; i++) {
+    pthread_create(&t[i], nullptr, job, (void *) i);
+  }
+  uint64_t instr = 0;
+  for (uint32_t i = 0; i < o.jobs; i++) {
+    pthread_join(t[i], nullptr);
+    if (!results[i].ok) {
+      fprintf(stderr, "machine %u failed\n", i);
+      return 1;
+    }
+    instr += results[i].instr - results[i].idle;
+  }
+  const double secs = now() - t0;
+  fprintf(stderr, "%u machines, %.2f s, %.1f M instructions, %.1f MIPS total, %.1f MIPS each\n",
+    o.jobs, secs, instr / 1e6, instr / secs / 1e6, instr / secs / 1e6 / o.jobs);
+  return 0;
+}
+
+// \n, \r and \\ in the -i text
+static char *unescape(char *s) {
+  char *d = s;
+  for (const char *p = s; *p; p++) {
+    if (*p == '\\' && p[1]) {
+      p++;
+      *d++ = *p == 'n' ? '\n' : *p == 'r' ? '\r' : *p;
+    } else {
+      *d++ = *p;
+    }
+  }
+  *d = 0;
+  return s;
+}
+
+static void usage() {
+  fprintf(stderr,
+    "usage: pdp11 [-r rk-image]... [-t tape]... [-R] [-s snapshot] [-w snapshot]\n"
+    "             [-n M-instructions] [-i input] [-v] [-b] [-x] [-V] [-B batch] [-p]\n"
+    "             [-j machines] [-S script [-o results.csv] [-c baseline.csv]] [-u group]\n"
+    "  -r  attach the next rk drive, -R holds the packs in ram\n"
+    "  -s  start from a snapshot, -w writes one when -n is reached\n"
+    "  -i  type the text into the console, \\n is return\n"
+    "  -v  virtual line clock, -b basic block cache, -p console on a pty\n"
+    "  -x  blocks through their handlers, without the x86-64 code\n"
+    "  -V  blocks in lockstep with the interpreter, see blocks verify\n"
+    "  -B  instructions between device services, 1 polls after every one\n"
+    "  -j  run n machines on threads with ram packs and report the MIPS\n"
+    "  -u  time the inner paths of the cpu: aget, alu, branch, step, mmu,\n"
+    "      unibus, irq, trap, fp or all\n"
+    "  -S  run a bench script with ram packs, append the numbers to -o and\n"
+    "      compare them with the row of the same script in -c\n"
+    "  ^P  stops the machine: cont, quit, save, restore, ckpt\n");
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  options o;
+  o.c = {};
+  uint32_t nrk = 0, ntm = 0;
+  int ch;
+  while ((ch = getopt(argc, argv, "r:t:Rs:w:n:i:vbxVB:pj:S:o:c:u:")) != -1) {
+    switch (ch) {
+      case 'r':
+        if (nrk == RK_NUM_DRV) {
+          usage();
+        }
+        o.c.rk[nrk++] = optarg;
+        break;
+      case 't':
+        if (ntm == TM_NUM_DRV) {
+          usage();
+        }
+        o.c.tm[ntm++] = optarg;
+        break;
+      case 'R':
+        o.c.ram = true;
+        break;
+      case 's':
+        o.c.snapshot = optarg;
+        break;
+      case 'w':
+        o.save = optarg;
+        break;
+      case 'n':
+        o.n = strtoull(optarg, nullptr, 0) * 1000000;
+        break;
+      case 'i':
+        o.script = unescape(optarg);
+        break;
+      case 'v':
+        o.vclock = true;
+        break;
+      case 'b':
+        o.blocks = true;
+        break;
+      case 'x':
+        o.blocks = true;
+        o.native = false;
+        break;
+      case 'V':
+        o.blocks = true;
+        o.verify = true;
+        break;
+      case 'B':
+        o.batch = atoi(optarg);
+        if (o.batch < 1 || o.batch > SCHED_MAXBATCH) {
+          usage();
+        }
+        break;
+      case 'p':
+        o.pty = true;
+        break;
+      case 'j':
+        o.jobs = atoi(optarg);
+        break;
+      case 'S':
+        o.bench = optarg;
+        o.c.ram = true; // the image stays as it was for the next run
+        break;
+      case 'o':
+        o.results = optarg;
+        break;
+      case 'c':
+        o.baseline = optarg;
+        break;
+      case 'u':
+        o.ubench = optarg;
+        break;
+      default:
+        usage();
+    }
+  }
+  if (optind != argc || (o.save && !o.n) || (o.jobs && o.bench)) {
+    usage();
+  }
+  if (o.ubench) {
+    if (!machine::start(o.c)) {
+      return 1;
+    }
+    ubench::run(&Serial, strcmp(o.ubench, "all") ? o.ubench : nullptr);
+    return 0;
+  }
+  if (o.jobs) {
+    if (!o.n) {
+      fprintf(stderr, "-j needs -n\n");
+      return 2;
+    }
+    o.c.ram = true;
+    return parallel(o);
+  }
+
+  Serial.begin(115200);
+  Pty pty;
+  if (o.pty) {
+    if (!pty.open()) {
+      perror("pty");
+      return 1;
+    }
+    Serial.printf("console on %s\r\n", pty.name());
+  }
+  Stream *port = o.pty ? (Stream *) &pty : &Serial;
+  Console con(o.script, port, port);
+  const result r = run(o, &con);
+  if (!r.ok) {
+    return 1;
+  }
+  if (o.save && !snap::save(o.save)) {
+    return 1;
+  }
+  if (!o.bench) { // a bench leaves its ram packs unwritten for the next run
+    machine::stop();
+  }
+  Serial.flush();
+  fprintf(stderr, "%.1f M instructions, %.1f M idle, %.2f s, %.1f MIPS\n",
+    r.instr / 1e6, r.idle / 1e6, r.secs, (r.instr - r.idle) / r.secs / 1e6);
+  if (o.verify) {
+    fprintf(stderr, "%u blocks run in lockstep, %u not, %u mismatches\n",
+      bcache::verified, bcache::skipped, bcache::mismatches);
+  }
+  return 0;
+}
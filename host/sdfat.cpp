@@ -0,0 +1,136 @@
+#include <SdFat.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+enum { OP_NONE, OP_READ, OP_WRITE };
+
+bool FsFile::open(const char *name, const int flags) {
+  close();
+  const int fd = ::open(name, flags & ~O_APPEND, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  const int acc = flags & O_ACCMODE;
+  f = fdopen(fd, acc == O_RDONLY ? "rb" : acc == O_WRONLY ? "wb" : "r+b");
+  if (!f) {
+    ::close(fd);
+    return false;
+  }
+  if (flags & O_APPEND) {
+    fseeko(f, 0, SEEK_END);
+  }
+  path = name;
+  last = OP_NONE;
+  return true;
+}
+
+bool FsFile::close() {
+  if (!f) {
+    return false;
+  }
+  const bool ok = fclose(f) == 0;
+  f = nullptr;
+  return ok;
+}
+
+void FsFile::turn(const int op) {
+  if (last != op && last != OP_NONE) {
+    fseeko(f, 0, SEEK_CUR);
+  }
+  last = op;
+}
+
+int FsFile::read(void *buf, const size_t n) {
+  if (!f) {
+    return -1;
+  }
+  turn(OP_READ);
+  return fread(buf, 1, n, f);
+}
+
+int FsFile::read() {
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+int FsFile::peek() {
+  if (!f) {
+    return -1;
+  }
+  turn(OP_READ);
+  const int c = getc(f);
+  if (c >= 0) {
+    ungetc(c, f);
+  }
+  return c;
+}
+
+int FsFile::available() {
+  if (!f) {
+    return 0;
+  }
+  const uint64_t n = fileSize() - curPosition();
+  return n > INT32_MAX ? INT32_MAX : (int) n;
+}
+
+size_t FsFile::write(const uint8_t c) {
+  return write(&c, 1);
+}
+
+size_t FsFile::write(const uint8_t *buf, const size_t n) {
+  if (!f) {
+    return 0;
+  }
+  turn(OP_WRITE);
+  return fwrite(buf, 1, n, f);
+}
+
+bool FsFile::seekSet(const uint64_t pos) {
+  last = OP_NONE;
+  return f && fseeko(f, pos, SEEK_SET) == 0;
+}
+
+uint64_t FsFile::curPosition() {
+  return f ? ftello(f) : 0;
+}
+
+uint64_t FsFile::fileSize() {
+  struct stat st;
+  if (!f) {
+    return 0;
+  }
+  if (last == OP_WRITE) {
+    fflush(f);
+  }
+  return fstat(fileno(f), &st) == 0 ? st.st_size : 0;
+}
+
+bool FsFile::sync() {
+  return f && fflush(f) == 0;
+}
+
+bool FsFile::truncate(const uint64_t n) {
+  return f && fflush(f) == 0 && ftruncate(fileno(f), n) == 0 && seekSet(n);
+}
+
+// the path as opened, so a snapshot can open the image again from
+// another directory
+bool FsFile::getName(char *name, const size_t n) {
+  if (!f || n == 0) {
+    return false;
+  }
+  snprintf(name, n, "%s", path.c_str());
+  return true;
+}
+
+bool SdFs::exists(const char *path) {
+  return access(path, F_OK) == 0;
+}
+
+bool SdFs::remove(const char *path) {
+  return unlink(path) == 0;
+}
+
+bool SdFs::rename(const char *from, const char *to) {
+  return ::rename(from, to) == 0;
+}
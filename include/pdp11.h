@@ -1,9 +1,20 @@
+#pragma once
+
 #include <Arduino.h>
 
 // PDP11/40
 // KD11-A CPU
 // KD11-D MMU
 // KW11-L CLOCK
+// FP11 FLOATING POINT
+
+// machine state. on the teensy there is one machine, a host build runs
+// one machine per thread, so everything the guest can see is thread local
+#if defined(TEENSYDUINO)
+#define MACHINE_STATE
+#else
+#define MACHINE_STATE thread_local
+#endif
 
 // interrupts
 enum {
@@ -16,20 +27,27 @@ enum {
   INTCLOCK  = 0100,
   INTRK     = 0220,
   INTTM     = 0224,
+  INTFP     = 0244,
   INTFAULT  = 0250,
+  INTDZRX   = 0300,
+  INTDZTX   = 0304,
 };
 
 enum {
   PRINTSTATE = false,
-  INSTR_TIMING = false,
+  INSTR_TIMING = true,
   DEBUG_INTER = false,
   DEBUG_RK05 = false,
   DEBUG_MMU = false,
   ENABLE_LKS = true,
+  ENABLE_ISTAT = false, // instruction statistics, see istat.h
 };
 
 void print_state();
 void toggle_trace();
 void panic();
 uint32_t disasm(uint32_t ia);
-void trap(uint16_t num);
\ No newline at end of file
+const char *mnemonic(uint16_t instr);
+void trap(uint16_t num);
+// every module with machine state describes it with a snapshot(), see snap.h
+namespace snap { struct io; };
@@ -0,0 +1,207 @@
+#include <Arduino.h>
+#include <SdFat.h>
+#include "aout.h"
+#include "rk05.h"
+
+namespace aout {
+
+MACHINE_STATE namelist kernel;
+MACHINE_STATE namelist user;
+
+// reads n bytes at off of the a.out file
+typedef bool (*reader)(uint32_t off, void *buf, uint32_t n, void *ctx);
+
+// header: magic, text, data, bss, symbol table size, entry, unused,
+// relocation suppressed. the symbols follow text, data and relocation.
+static bool parse(reader rd, void *ctx, namelist &nl) {
+  uint16_t hdr[8];
+  uint8_t ent[12];
+  if (!rd(0, hdr, sizeof(hdr), ctx) ||
+      (hdr[0] != 0407 && hdr[0] != 0410 && hdr[0] != 0411)) {
+    return false;
+  }
+  uint32_t off = 16 + hdr[1] + hdr[2];
+  if (hdr[7] == 0) {
+    off += hdr[1] + hdr[2];
+  }
+  nl.n = 0;
+  for (uint32_t n = hdr[4] / 12; n > 0 && nl.n < AOUT_SYMS; n--, off += sizeof(ent)) {
+    if (!rd(off, ent, sizeof(ent), ctx)) {
+      break;
+    }
+    sym s;
+    memcpy(s.name, ent, 8);
+    s.name[8] = 0;
+    s.type = ent[8] | ent[9] << 8;
+    s.value = ent[10] | ent[11] << 8;
+    // insertion sort, the table is loaded once
+    uint32_t i = nl.n++;
+    while (i > 0 && nl.syms[i - 1].value > s.value) {
+      nl.syms[i] = nl.syms[i - 1];
+      i--;
+    }
+    nl.syms[i] = s;
+  }
+  return nl.n > 0;
+}
+
+static bool sdread(const uint32_t off, void *buf, const uint32_t n, void *ctx) {
+  FsFile &f = *(FsFile *) ctx;
+  return f.seekSet(off) && f.read(buf, n) == (int) n;
+}
+
+bool load(const char *path, namelist &nl) {
+  FsFile f;
+  if (!f.open(path, O_READ)) {
+    return false;
+  }
+  const bool ok = parse(sdread, &f, nl);
+  f.close();
+  return ok;
+}
+
+// a file in the V6 file system of an rk pack. inodes are 32 bytes from
+// block 2 on, mode, nlink, uid, gid, size0, size1, addr[8]. a large file
+// has indirect blocks in addr, the double indirect addr[7] is not needed
+// for a namelist.
+struct v6file {
+  uint32_t drive;
+  uint16_t mode;
+  uint32_t size;
+  uint16_t addr[8];
+  uint32_t cached;    // block in buf, 0 if none, block 0 is the boot block
+  uint8_t buf[512];
+};
+
+static bool block(v6file &f, const uint32_t blk) {
+  if (blk == f.cached) {
+    return true;
+  }
+  if (blk == 0 || !rk11::block(f.drive, blk, f.buf)) {
+    return false;
+  }
+  f.cached = blk;
+  return true;
+}
+
+static bool inode(v6file &f, const uint32_t ino) {
+  if (ino == 0 || !block(f, 2 + (ino - 1) / 16)) {
+    return false;
+  }
+  const uint8_t *p = &f.buf[((ino - 1) % 16) * 32];
+  f.mode = p[0] | p[1] << 8;
+  f.size = (p[5] << 16) | p[6] | p[7] << 8;
+  for (uint32_t i = 0; i < 8; i++) {
+    f.addr[i] = p[8 + i * 2] | p[9 + i * 2] << 8;
+  }
+  return f.mode & 0100000; // allocated
+}
+
+// file system block of the file block bn
+static uint32_t bmap(v6file &f, const uint32_t bn) {
+  if (!(f.mode & 010000)) {
+    return bn < 8 ? f.addr[bn] : 0;
+  }
+  if ((bn >> 8) >= 7 || !block(f, f.addr[bn >> 8])) {
+    return 0;
+  }
+  return f.buf[(bn & 0377) * 2] | f.buf[(bn & 0377) * 2 + 1] << 8;
+}
+
+static bool v6read(const uint32_t off, void *buf, const uint32_t n, void *ctx) {
+  v6file &f = *(v6file *) ctx;
+  uint8_t *d = (uint8_t *) buf;
+  if (off + n > f.size) {
+    return false;
+  }
+  for (uint32_t i = 0; i < n; i++) {
+    const uint32_t a = off + i;
+    if (!block(f, bmap(f, a >> 9))) {
+      return false;
+    }
+    d[i] = f.buf[a & 0777];
+  }
+  return true;
+}
+
+// path from the root directory, inode 1
+static bool namei(v6file &f, const char *path) {
+  if (!inode(f, 1)) {
+    return false;
+  }
+  while (*path) {
+    while (*path == '/') {
+      path++;
+    }
+    const char *e = path;
+    while (*e && *e != '/') {
+      e++;
+    }
+    if (e == path) {
+      break;
+    }
+    if ((f.mode & 060000) != 040000) { // not a directory
+      return false;
+    }
+    uint32_t ino = 0;
+    uint8_t ent[16];
+    for (uint32_t off = 0; off + sizeof(ent) <= f.size && !ino; off += sizeof(ent)) {
+      if (!v6read(off, ent, sizeof(ent), &f)) {
+        return false;
+      }
+      const uint32_t len = e - path;
+      if ((ent[0] | ent[1]) && len <= 14 && !strncmp((char *) &ent[2], path, len) &&
+          (len == 14 || ent[2 + len] == 0)) {
+        ino = ent[0] | ent[1] << 8;
+      }
+    }
+    if (!inode(f, ino)) {
+      return false;
+    }
+    path = e;
+  }
+  return true;
+}
+
+bool loadrk(const uint32_t drive, const char *path, namelist &nl) {
+  if (drive >= RK_NUM_DRV || !rk11::rkdata[drive].attached) {
+    return false;
+  }
+  v6file *f = new v6file;
+  f->drive = drive;
+  f->cached = 0;
+  const bool ok = namei(*f, path) && parse(v6read, f, nl);
+  delete f;
+  return ok;
+}
+
+const sym *find(const char *name, const namelist &nl) {
+  for (uint32_t i = 0; i < nl.n; i++) {
+    if (!strcmp(nl.syms[i].name, name)) {
+      return &nl.syms[i];
+    }
+  }
+  return nullptr;
+}
+
+// the text symbol at or below addr
+const sym *lookup(const uint16_t addr, const namelist &nl) {
+  uint32_t lo = 0, hi = nl.n;
+  while (lo < hi) {
+    const uint32_t mid = (lo + hi) / 2;
+    if (nl.syms[mid].value <= addr) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  while (lo > 0) {
+    const sym *s = &nl.syms[--lo];
+    if ((s->type & 037) == SYM_TEXT) {
+      return s;
+    }
+  }
+  return nullptr;
+}
+
+};
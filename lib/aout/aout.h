@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+#include <pdp11.h>
+
+// V6 a.out namelist, e.g. /unix copied to the sd card, or read straight
+// from the file system of an rk pack
+#define AOUT_SYMS 1024
+
+namespace aout {
+
+    enum {
+      SYM_UNDEF = 0,
+      SYM_ABS   = 1,
+      SYM_TEXT  = 2,
+      SYM_DATA  = 3,
+      SYM_BSS   = 4,
+      SYM_EXT   = 040,
+    };
+
+    struct sym {
+      char name[9];
+      uint16_t type;
+      uint16_t value;
+    };
+
+    struct namelist {
+      sym syms[AOUT_SYMS]; // sorted by value
+      uint32_t n;
+    };
+
+    // the kernel namelist, and one user program for the profiler
+    extern MACHINE_STATE namelist kernel;
+    extern MACHINE_STATE namelist user;
+
+    bool load(const char *path, namelist &nl = kernel);
+    bool loadrk(uint32_t drive, const char *path, namelist &nl = kernel);
+    const sym *find(const char *name, const namelist &nl = kernel);
+    const sym *lookup(uint16_t addr, const namelist &nl = kernel);
+
+};
@@ -0,0 +1,350 @@
+#include <Arduino.h>
+#include <SdFat.h>
+#include <pdp11.h>
+#include "cpu.h"
+#include "sched.h"
+#include "kw11.h"
+#include "dl11.h"
+#include "rk05.h"
+#include "tm11.h"
+#include "bench.h"
+
+namespace bench {
+
+enum {
+  STEP_EXPECT,
+  STEP_SEND,
+};
+
+struct step {
+  uint32_t type;
+  uint32_t len;
+  uint32_t limit; // instructions, expect only
+  const char *text;
+};
+
+MACHINE_STATE bool running = false;
+MACHINE_STATE bool done = false;
+MACHINE_STATE bool failed = false;
+
+static MACHINE_STATE char text[BENCH_SCRIPT];
+static MACHINE_STATE step steps[BENCH_STEPS];
+// the current step and the characters of it sent or matched so far
+static MACHINE_STATE uint32_t nsteps, cur, pos;
+static MACHINE_STATE uint64_t deadline; // guest time the expected text is due by
+static MACHINE_STATE char name[64], csv[64], base[64];
+static MACHINE_STATE Stream *host;      // the console port before the run
+static MACHINE_STATE result start;
+
+static const char *columns = "name,ms,instructions,idle,ips,rk,tm,interrupts,traps";
+
+// the console while a script runs. sends are typed ahead of the host's
+// input, the output goes on to the host and is matched against the
+// current expect.
+class Port : public Stream {
+  public:
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t write(uint8_t c) override;
+    using Print::write;
+};
+
+static MACHINE_STATE Port port;
+
+static bool sending() {
+  return running && steps[cur].type == STEP_SEND;
+}
+
+// the counters since power on
+static void take(result &r) {
+  r.ms = millis();
+  r.instr = sched::icount;
+  r.idle = sched::idle_icount;
+  r.rk = rk11::ops;
+  r.tm = tm11::ops;
+  r.interrupts = cpu::interrupts;
+  r.traps = cpu::traps;
+}
+
+// a uint64_t in decimal, the teensy's printf has no %llu
+static const char *u64(char *buf, uint64_t v) {
+  char *p = buf + 20;
+  *p = 0;
+  do {
+    *--p = '0' + v % 10;
+    v /= 10;
+  } while (v);
+  return p;
+}
+
+static void row(char *line, const uint32_t n, const char *id, const result &r) {
+  char b1[21], b2[21];
+  snprintf(line, n, "%s,%u,%s,%s,%u,%u,%u,%u,%u\n", id, r.ms, u64(b1, r.instr), u64(b2, r.idle),
+    r.ips, r.rk, r.tm, r.interrupts, r.traps);
+}
+
+static bool save(const result &r) {
+  FsFile f;
+  if (!f.open(csv, O_CREAT|O_WRITE|O_APPEND)) {
+    return false;
+  }
+  char line[160];
+  if (f.fileSize() == 0) {
+    f.printf("%s\n", columns);
+  }
+  row(line, sizeof(line), name, r);
+  const size_t len = strlen(line);
+  const bool ok = f.write(line, len) == len;
+  f.close();
+  return ok;
+}
+
+// the last row of the baseline for this script
+static bool load(result &r) {
+  FsFile f;
+  if (!f.open(base, O_READ)) {
+    return false;
+  }
+  bool found = false;
+  while (f.available()) {
+    String line = f.readStringUntil('\n');
+    char *s = (char *) line.c_str();
+    char *comma = strchr(s, ',');
+    if (!comma || (size_t) (comma - s) != strlen(name) || strncmp(s, name, comma - s)) {
+      continue;
+    }
+    char *p = comma + 1;
+    r.ms = strtoul(p, &p, 10);
+    r.instr = strtoull(p + 1, &p, 10);
+    r.idle = strtoull(p + 1, &p, 10);
+    r.ips = strtoul(p + 1, &p, 10);
+    r.rk = strtoul(p + 1, &p, 10);
+    r.tm = strtoul(p + 1, &p, 10);
+    r.interrupts = strtoul(p + 1, &p, 10);
+    r.traps = strtoul(p + 1, &p, 10);
+    found = true;
+  }
+  f.close();
+  return found;
+}
+
+static void compare(const char *what, const uint64_t now, const uint64_t then) {
+  char b1[21], b2[21];
+  Serial.printf("%-12s %14s %14s", what, u64(b1, now), u64(b2, then));
+  if (then) {
+    const int32_t pm = (int32_t) ((((double) now - then) * 1000) / then);
+    Serial.printf(" %+5d.%u%%", pm / 10, (unsigned) abs(pm) % 10);
+  }
+  Serial.println();
+}
+
+static void report(const result &r) {
+  char b1[21], b2[21];
+  Serial.printf("\r\nbench: %s %u.%03u s, %s instructions, %s idle, %u ips\r\n", name, r.ms / 1000, r.ms % 1000,
+    u64(b1, r.instr), u64(b2, r.idle), r.ips);
+  Serial.printf("bench: %u rk sectors, %u tm commands, %u interrupts, %u traps\r\n",
+    r.rk, r.tm, r.interrupts, r.traps);
+  if (csv[0] && !save(r)) {
+    Serial.printf("bench: could not write %s\r\n", csv);
+  }
+  if (!base[0]) {
+    return;
+  }
+  result b;
+  if (!load(b)) {
+    Serial.printf("bench: no row for %s in %s\r\n", name, base);
+    return;
+  }
+  Serial.printf("%-12s %14s %14s %7s\r\n", "", "this", "baseline", "change");
+  compare("ms", r.ms, b.ms);
+  compare("instructions", r.instr, b.instr);
+  compare("idle", r.idle, b.idle);
+  compare("ips", r.ips, b.ips);
+  compare("rk", r.rk, b.rk);
+  compare("tm", r.tm, b.tm);
+  compare("interrupts", r.interrupts, b.interrupts);
+  compare("traps", r.traps, b.traps);
+}
+
+static void end(const bool ok) {
+  result r;
+  take(r);
+  r.ms -= start.ms;
+  r.instr -= start.instr;
+  r.idle -= start.idle;
+  r.rk -= start.rk;
+  r.tm -= start.tm;
+  r.interrupts -= start.interrupts;
+  r.traps -= start.traps;
+  r.ips = r.ms ? (uint32_t) ((r.instr - r.idle) * 1000 / r.ms) : 0;
+  dl11::port = host;
+  running = false;
+  done = true;
+  failed = !ok;
+  if (ok) {
+    report(r);
+  } else {
+    Serial.printf("\r\nbench: %s timed out in step %u, expecting \"%s\"\r\n", name, cur + 1, steps[cur].text);
+  }
+}
+
+static void next() {
+  cur++;
+  pos = 0;
+  if (cur == nsteps) {
+    end(true);
+  } else if (steps[cur].type == STEP_EXPECT) {
+    deadline = sched::icount + steps[cur].limit;
+  } else {
+    sched::post(sched::WORK_INPUT);
+  }
+}
+
+int Port::available() {
+  if (running && steps[cur].type == STEP_EXPECT && sched::icount > deadline) {
+    end(false);
+  }
+  return sending() || host->available();
+}
+
+int Port::read() {
+  if (!sending()) {
+    return host->read();
+  }
+  const uint8_t c = steps[cur].text[pos++];
+  if (pos == steps[cur].len) {
+    next();
+  }
+  return c;
+}
+
+int Port::peek() {
+  return sending() ? (uint8_t) steps[cur].text[pos] : host->peek();
+}
+
+size_t Port::write(const uint8_t c) {
+  host->write(c);
+  if (running && steps[cur].type == STEP_EXPECT) {
+    const step &s = steps[cur];
+    if (c == (uint8_t) s.text[pos]) {
+      pos++;
+    } else {
+      pos = c == (uint8_t) s.text[0];
+    }
+    if (pos == s.len) {
+      next();
+    }
+  }
+  return 1;
+}
+
+// \n, \r and \\ in place, returns the length
+static uint32_t unescape(char *s) {
+  char *d = s;
+  for (const char *p = s; *p; p++) {
+    if (*p == '\\' && p[1]) {
+      p++;
+      *d++ = *p == 'n' ? '\n' : *p == 'r' ? '\r' : *p;
+    } else {
+      *d++ = *p;
+    }
+  }
+  *d = 0;
+  return d - s;
+}
+
+static bool parse(const char *path) {
+  FsFile f;
+  if (!f.open(path, O_READ)) {
+    Serial.printf("could not open %s\r\n", path);
+    return false;
+  }
+  const int n = f.read(text, sizeof(text) - 1);
+  f.close();
+  if (n < 0 || n == sizeof(text) - 1) {
+    Serial.printf("bench: %s is longer than %d bytes\r\n", path, BENCH_SCRIPT - 2);
+    return false;
+  }
+  text[n] = 0;
+  nsteps = 0;
+  uint32_t limit = BENCH_LIMIT * 1000000;
+  uint32_t ln = 0;
+  for (char *p = text; *p; ) {
+    char *line = p;
+    char *eol = strchr(p, '\n');
+    p = eol ? eol + 1 : p + strlen(p);
+    if (eol) {
+      *eol = 0;
+    }
+    ln++;
+    const size_t len = strlen(line);
+    if (len && line[len - 1] == '\r') {
+      line[len - 1] = 0;
+    }
+    if (line[0] == 0 || line[0] == '#') {
+      continue;
+    }
+    if (!strncmp(line, "limit ", 6) && atoi(line + 6) > 0) {
+      limit = (uint32_t) atoi(line + 6) * 1000000;
+      continue;
+    }
+    const bool expect = !strncmp(line, "expect ", 7);
+    if ((!expect && strncmp(line, "send ", 5)) || nsteps == BENCH_STEPS) {
+      Serial.printf("bench: %s line %u: %s\r\n", path, ln, nsteps == BENCH_STEPS ? "too many steps" : line);
+      return false;
+    }
+    step &s = steps[nsteps];
+    s.type = expect ? STEP_EXPECT : STEP_SEND;
+    s.text = line + (expect ? 7 : 5);
+    s.len = unescape((char *) s.text);
+    s.limit = limit;
+    if (s.len) {
+      nsteps++;
+    }
+  }
+  if (nsteps == 0) {
+    Serial.printf("bench: %s has no steps\r\n", path);
+    return false;
+  }
+  return true;
+}
+
+// arm the script, it starts with the next instruction. the line clock
+// goes virtual, the counters are taken from here.
+bool begin(const char *script, const char *results, const char *baseline) {
+  if (running) {
+    Serial.printf("bench: %s is running\r\n", name);
+    return false;
+  }
+  if (!parse(script)) {
+    return false;
+  }
+  snprintf(name, sizeof(name), "%s", script);
+  snprintf(csv, sizeof(csv), "%s", results ? results : "");
+  snprintf(base, sizeof(base), "%s", baseline ? baseline : "");
+  kw11::setmode(true, 0);
+  host = dl11::port;
+  dl11::port = &port;
+  cur = 0;
+  pos = 0;
+  running = true;
+  done = failed = false;
+  deadline = sched::icount + steps[0].limit;
+  if (steps[0].type == STEP_SEND) {
+    sched::post(sched::WORK_INPUT);
+  }
+  take(start);
+  return true;
+}
+
+void status(Stream *dev) {
+  if (!running) {
+    dev->printf("bench: %s\r\n", done ? (failed ? "failed" : "done") : "off");
+    return;
+  }
+  dev->printf("bench: %s step %u of %u, %s \"%s\"\r\n", name, cur + 1, nsteps,
+    steps[cur].type == STEP_EXPECT ? "expecting" : "sending", steps[cur].text);
+}
+
+};
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+#include <pdp11.h>
+
+// workload benchmark. a script drives the console: "expect text" waits
+// for the text in the output, "send text" types it, "limit n" allows n
+// million instructions for each following expect, # starts a comment.
+// \n, \r and \\ are escapes. the run is timed from begin() to the end
+// of the script on the virtual line clock, so the guest does the same
+// work on every run and only the host time changes.
+#define BENCH_SCRIPT 4096 // bytes of script
+#define BENCH_STEPS 128
+#define BENCH_LIMIT 1000  // default million instructions per expect
+
+namespace bench {
+
+    // the numbers of one run
+    struct result {
+      uint32_t ms;        // host wall time
+      uint64_t instr;     // guest instructions, the skipped idle ones included
+      uint64_t idle;      // of them skipped in WAIT
+      uint32_t ips;       // executed instructions per host second
+      uint32_t rk;        // disk sectors transferred
+      uint32_t tm;        // tape commands
+      uint32_t interrupts;
+      uint32_t traps;
+    };
+
+    extern MACHINE_STATE bool running;
+    extern MACHINE_STATE bool done;   // the script ran through, or failed
+    extern MACHINE_STATE bool failed;
+
+    // results are appended to csv, a row of base with the same script
+    // name is compared against. either can be nullptr.
+    bool begin(const char *script, const char *csv, const char *base);
+    void status(Stream *dev);
+
+};
@@ -7,6 +7,22 @@
 #include "unibus.h"
 #include "rk05.h"
 #include "tm11.h"
+#include "dl11.h"
+#include "dz11.h"
+#include "sched.h"
+#include "kw11.h"
+#include "panel.h"
+#include "kd11.h"
+#include "hle.h"
+#include "bcache.h"
+#include "istat.h"
+#include "prof.h"
+#include "tbuf.h"
+#include "rr.h"
+#include "snap.h"
+#include "bench.h"
+#include "ubench.h"
+#include "aout.h"
 #include "console.h"
 #include "pdp11.h"
 #include "TFTPService.h"
@@ -17,7 +33,10 @@
 extern SdFs sd;
 extern RTC_DS3231 rtc;
 extern uint32_t ips;
-extern int trace;
+extern uint32_t iskip;
+extern uint32_t idlepct;
+extern uint32_t gspeed;
+extern MACHINE_STATE int trace;
 
 #if defined(TEENSYDUINO)
   #define SPIWIFI        SPI  // The SPI port
@@ -48,12 +67,18 @@ void reset_machine(void) {
   SCB_AIRCR = 0x05FA0004;
 }
 
+// the monitor takes 22 bit physical addresses, 760000-777777 is the
+// io page like on an 18 bit machine
+static uint32_t phys(const uint32_t a) {
+  return (a >= 0760000 && a < 01000000) ? (a | IOPAGE) : a;
+}
+
 uint32_t dump_mem(CLIClient *dev, u_int32_t addr) {
   int x,y;
   for (y = 0; y <  8; y++) {
     dev->printf("%06o: ", addr);
     for (x = 0; x < 16; x+=2) {
-      if ((addr + x) < 0760000) {
+      if ((addr + x) < unibus::memsize) {
         dev->printf("%06o ", unibus::read16(addr + x));
       } else {
         dev->println("io addr, use Examine");
@@ -209,6 +234,603 @@ CLI_COMMAND(patchCmd) {
   }
 }
 
+CLI_COMMAND(rxdelayCmd) {
+  unsigned int n;
+  switch (argc) {
+    case 1:
+      dev->printf("rxdelay: %d, paste: %s, pending: %d\r\n", dl11::rxdelay, dl11::paste ? "true" : "false", dl11::rxpending());
+      return 0;
+    case 2:
+      if (argv[1][0] == '-') {
+        dl11::rxflush();
+        return 0;
+      }
+      if (sscanf(argv[1], "%u", &n) == 1) {
+        dl11::rxdelay = n;
+        return 0;
+      }
+  }
+  dev->println("Usage: rxdelay [instructions|-]");
+  return 1;
+}
+
+CLI_COMMAND(batchCmd) {
+  unsigned int n;
+  switch (argc) {
+    case 1:
+      dev->printf("batch: %d\r\n", sched::batch);
+      return 0;
+    case 2:
+      if (sscanf(argv[1], "%u", &n) == 1 && n > 0) {
+        sched::batch = n;
+        return 0;
+      }
+  }
+  dev->println("Usage: batch [instructions]");
+  return 1;
+}
+
+CLI_COMMAND(ipsCmd) {
+  if (argc != 1) {
+    dev->println("Usage: ips");
+    return 1;
+  }
+  dev->printf("%u instr/s executed, %u instr/s skipped in WAIT, idle: %u%%\r\n", ips, iskip, idlepct);
+  dev->printf("11/40 speed: %u%%, slice: %u instructions\r\n", gspeed, sched::batch);
+  dev->printf("%u M instructions since power on, %u M skipped\r\n",
+    (uint32_t)((sched::icount - sched::idle_icount) / 1000000), (uint32_t)(sched::idle_icount / 1000000));
+  return 0;
+}
+
+CLI_COMMAND(memCmd) {
+  unsigned int n;
+  switch (argc) {
+    case 1:
+      dev->printf("mem: %uk of %uk, mmu: %s, %d bit, i/d space: %s, unibus map: %s\r\n",
+        unibus::memsize >> 10, unibus::memmax >> 10, mmu::SR0 & 1 ? "on" : "off",
+        mmu::SR3 & mmu::SR3_22 ? 22 : 18,
+        mmu::SR3 & (mmu::SR3_KD | mmu::SR3_UD) ? "split" : "joint",
+        mmu::SR3 & mmu::SR3_UBM ? "on" : "off");
+      return 0;
+    case 2:
+      if (sscanf(argv[1], "%u", &n) == 1 && unibus::setmem(n << 10)) {
+        return 0;
+      }
+      dev->printf("8k to %uk\r\n", unibus::memmax >> 10);
+      return 2;
+  }
+  dev->println("Usage: mem [kbytes]");
+  return 1;
+}
+
+CLI_COMMAND(clockCmd) {
+  unsigned int n = 0;
+  switch (argc) {
+    case 1:
+      dev->printf("clock: %s", kw11::vclock ? "virtual" : "real");
+      if (kw11::vclock) {
+        dev->printf(", %d instructions per tick", kw11::period);
+      }
+      dev->println();
+      return 0;
+    case 2:
+    case 3:
+      if (argc == 3 && sscanf(argv[2], "%u", &n) != 1) {
+        break;
+      }
+      if (!strcmp(argv[1], "real")) {
+        kw11::setmode(false, n);
+        return 0;
+      }
+      if (!strcmp(argv[1], "virtual")) {
+        kw11::setmode(true, n);
+        return 0;
+      }
+  }
+  dev->println("Usage: clock [real|virtual [instructions]]");
+  return 1;
+}
+
+CLI_COMMAND(fusionCmd) {
+  static const char *names[cpu::FUSE_N] = {
+    "mov (rs)+,(rd)+; sob",
+    "clr (rd)+; sob",
+    "tst; bxx",
+    "tst; bxx .-2 poll",
+    "cmp; bxx",
+  };
+  if (argc == 2) {
+    if (!strcmp(argv[1], "on")) {
+      cpu::fusion = true;
+      return 0;
+    }
+    if (!strcmp(argv[1], "off")) {
+      cpu::fusion = false;
+      return 0;
+    }
+    if (!strcmp(argv[1], "reset")) {
+      for (uint32_t i = 0; i < cpu::FUSE_N; i++) {
+        cpu::fused[i] = 0;
+        cpu::fusedinstr[i] = 0;
+      }
+      return 0;
+    }
+    dev->println("Usage: fusion [on|off|reset]");
+    return 1;
+  }
+  dev->printf("fusion: %s\r\n", cpu::fusion ? "on" : "off");
+  for (uint32_t i = 0; i < cpu::FUSE_N; i++) {
+    dev->printf("%-20s %10u fired %10u instructions\r\n", names[i], cpu::fused[i], cpu::fusedinstr[i]);
+  }
+  return 0;
+}
+
+CLI_COMMAND(blocksCmd) {
+  if (argc == 2) {
+    if (!strcmp(argv[1], "on") || !strcmp(argv[1], "verify")) {
+      bcache::flush();
+      bcache::enabled = true;
+      bcache::verify = !strcmp(argv[1], "verify");
+      return 0;
+    }
+    if (!strcmp(argv[1], "off")) {
+      bcache::enabled = false;
+      bcache::verify = false;
+      bcache::logging = false;
+      return 0;
+    }
+    dev->println("Usage: blocks [on|off|verify]");
+    return 1;
+  }
+  dev->printf("blocks: %s%s, %d entries of %d instructions\r\n", bcache::enabled ? "on" : "off",
+    bcache::verify ? " (verify)" : "", BC_ENTRIES, BC_OPS);
+  dev->printf("%u hits, %u misses, %u dropped, %u mismatches\r\n",
+    bcache::hits, bcache::misses, bcache::drops, bcache::mismatches);
+  if (bcache::verify) {
+    dev->printf("%u run in lockstep, %u not (io page, halt, wait, reset)\r\n",
+      bcache::verified, bcache::skipped);
+  }
+  return 0;
+}
+
+CLI_COMMAND(istatCmd) {
+  unsigned int n = 20;
+  if (!istat::counts) {
+    dev->println("istat: not compiled in, set ENABLE_ISTAT in pdp11.h");
+    return 2;
+  }
+  if (argc == 2 && !strcmp(argv[1], "reset")) {
+    istat::reset();
+    return 0;
+  }
+  if ((argc == 2 || argc == 3) && !strcmp(argv[1], "dump")) {
+    const char *path = argc == 3 ? argv[2] : "istat.bin";
+    if (!istat::dump(path)) {
+      dev->printf("could not write %s\r\n", path);
+      return 3;
+    }
+    return 0;
+  }
+  if (argc > 2 || (argc == 2 && sscanf(argv[1], "%u", &n) != 1)) {
+    dev->println("Usage: istat [n|reset|dump [file]]");
+    return 1;
+  }
+  uint64_t total = 0;
+  for (uint32_t c = 0; c < istat::IS_N; c++) {
+    for (uint32_t m = 0; m < IS_MODES; m++) {
+      total += istat::counts[0][c][m] + istat::counts[1][c][m];
+    }
+  }
+  if (total == 0) {
+    return 0;
+  }
+  dev->println("class modes     kernel       user      %");
+  // the rows by count, ties by class and mode, n passes over the table
+  uint64_t prev = UINT64_MAX;
+  uint32_t prevrow = 0;
+  for (uint32_t i = 0; i < n; i++) {
+    uint64_t best = 0;
+    uint32_t row = 0;
+    for (uint32_t r = 0; r < istat::IS_N * IS_MODES; r++) {
+      const uint32_t c = r / IS_MODES, m = r % IS_MODES;
+      const uint64_t v = (uint64_t) istat::counts[0][c][m] + istat::counts[1][c][m];
+      if (v > best && (v < prev || (v == prev && r > prevrow))) {
+        best = v;
+        row = r;
+      }
+    }
+    if (best == 0) {
+      break;
+    }
+    const uint32_t c = row / IS_MODES, m = row % IS_MODES;
+    char modes[4] = "";
+    switch (istat::operands(c)) {
+      case 077:
+        snprintf(modes, sizeof(modes), "%o,%o", m >> 3, m & 7);
+        break;
+      case 007:
+        snprintf(modes, sizeof(modes), "%o", m);
+        break;
+    }
+    const uint32_t pm = (uint32_t)(best * 1000 / total);
+    dev->printf("%-5s %-5s %10u %10u %3u.%u\r\n", istat::name(c), modes,
+      istat::counts[0][c][m], istat::counts[1][c][m], pm / 10, pm % 10);
+    prev = best;
+    prevrow = row;
+  }
+  return 0;
+}
+
+// a namelist from the sd card, or rkN:path from the V6 file system on a pack
+static bool namelist(const char *arg, aout::namelist &nl) {
+  unsigned int n;
+  int len = 0;
+  if (sscanf(arg, "rk%u:%n", &n, &len) == 1 && len > 0) {
+    return aout::loadrk(n, arg + len, nl);
+  }
+  return aout::load(arg, nl);
+}
+
+CLI_COMMAND(profCmd) {
+  unsigned int n = 20;
+  if (argc == 1 || (argc == 2 && sscanf(argv[1], "%u", &n) == 1)) {
+    dev->printf("prof: %s, ", prof::enabled ? "on" : "off");
+    if (prof::every) {
+      dev->printf("%u Hz\r\n", 1000 / prof::every);
+    } else {
+      dev->println("line clock");
+    }
+    prof::report(dev, n);
+    return 0;
+  }
+  if (!strcmp(argv[1], "on") && argc <= 3) {
+    n = 0;
+    if (argc == 3 && (sscanf(argv[2], "%u", &n) != 1 || n > 1000)) {
+      dev->println("1 to 1000 Hz, 0 on the line clock");
+      return 2;
+    }
+    prof::every = n ? 1000 / n : 0;
+    prof::enabled = true;
+    return 0;
+  }
+  if (!strcmp(argv[1], "off") && argc == 2) {
+    prof::enabled = false;
+    return 0;
+  }
+  if (!strcmp(argv[1], "reset") && argc == 2) {
+    prof::reset();
+    return 0;
+  }
+  if (!strcmp(argv[1], "unix") && argc == 3) {
+    if (!namelist(argv[2], aout::kernel)) {
+      dev->printf("could not read %s\r\n", argv[2]);
+      return 3;
+    }
+    return 0;
+  }
+  if (!strcmp(argv[1], "user") && argc <= 4) {
+    if (argc == 2) {
+      if (prof::ubase == UINT32_MAX) {
+        dev->println("no user namelist");
+      } else {
+        dev->printf("user@%o\r\n", (unsigned int) prof::ubase);
+      }
+      return 0;
+    }
+    // the process the names belong to, by default the one running now
+    unsigned int base;
+    uint32_t pa;
+    if (argc == 4) {
+      if (sscanf(argv[3], "%o", &base) != 1) {
+        dev->println("base is octal");
+        return 2;
+      }
+    } else if (mmu::probe(0, false, true, pa, true)) {
+      base = pa;
+    } else {
+      dev->println("no user process mapped, give the base");
+      return 2;
+    }
+    if (!namelist(argv[2], aout::user)) {
+      dev->printf("could not read %s\r\n", argv[2]);
+      return 3;
+    }
+    prof::ubase = base;
+    return 0;
+  }
+  if (!strcmp(argv[1], "fold") && argc <= 3) {
+    const char *path = argc == 3 ? argv[2] : "prof.folded";
+    if (!prof::fold(path)) {
+      dev->printf("could not write %s\r\n", path);
+      return 3;
+    }
+    return 0;
+  }
+  dev->println("Usage: prof [n|on [hz]|off|reset|fold [file]]");
+  dev->println("       prof unix file|rkN:path");
+  dev->println("       prof user [file|rkN:path [base]]");
+  return 1;
+}
+
+static void tbprint(Stream *dev, const tbuf::entry *e) {
+  const char m = e->flags & tbuf::TB_USER ? 'u' : 'k';
+  if (e->flags & (tbuf::TB_TRAP | tbuf::TB_IRQ)) {
+    dev->printf("%06o %c %s %03o ps %06o\r\n", e->pc, m,
+      e->flags & tbuf::TB_IRQ ? "irq " : "trap", e->instr, e->ps);
+    return;
+  }
+  dev->printf("%06o %c %06o %-5s ps %06o", e->pc, m, e->instr, mnemonic(e->instr), e->ps);
+  for (uint32_t i = 0; i < (e->flags & tbuf::TB_NEA); i++) {
+    dev->printf(" @%06o", e->ea[i]);
+  }
+  for (uint32_t i = 0, k = 0; i < 7; i++) {
+    if (e->changed & (1 << i)) {
+      if (k < 3) {
+        dev->printf(" R%d=%06o", i, e->val[k++]);
+      } else {
+        dev->printf(" R%d", i);
+      }
+    }
+  }
+  dev->println();
+}
+
+CLI_COMMAND(tbCmd) {
+  unsigned int n = 20, a, b;
+  if (argc == 1 || (argc == 2 && sscanf(argv[1], "%u", &n) == 1)) {
+    dev->printf("tb: %s, %u entries, pc %06o-%06o, mode %s, stop ", tbuf::on ? "on" : "off",
+      tbuf::count, tbuf::lo, tbuf::hi, tbuf::mode == 0 ? "any" : tbuf::mode == 1 ? "kernel" : "user");
+    if (tbuf::stopvec == UINT32_MAX) {
+      dev->println("off");
+    } else {
+      dev->printf("%03o +%u\r\n", tbuf::stopvec, tbuf::post);
+    }
+    for (uint32_t i = n; i > 0; i--) {
+      const tbuf::entry *e = tbuf::last(i - 1);
+      if (e) {
+        tbprint(dev, e);
+      }
+    }
+    return 0;
+  }
+  if (argc == 2 && !strcmp(argv[1], "on")) {
+    if (!tbuf::start()) {
+      dev->println("tb: malloc failed");
+      return 2;
+    }
+    return 0;
+  }
+  if (argc == 2 && !strcmp(argv[1], "off")) {
+    tbuf::stop();
+    return 0;
+  }
+  if (argc == 2 && !strcmp(argv[1], "clear")) {
+    tbuf::clear();
+    return 0;
+  }
+  if (!strcmp(argv[1], "pc")) {
+    if (argc == 3 && !strcmp(argv[2], "all")) {
+      tbuf::lo = 0;
+      tbuf::hi = 0177777;
+      return 0;
+    }
+    if (argc == 4 && sscanf(argv[2], "%o", &a) == 1 && sscanf(argv[3], "%o", &b) == 1) {
+      tbuf::lo = a;
+      tbuf::hi = b;
+      return 0;
+    }
+  }
+  if (argc == 3 && !strcmp(argv[1], "mode")) {
+    tbuf::mode = argv[2][0] == 'k' ? 1 : argv[2][0] == 'u' ? 2 : 0;
+    return 0;
+  }
+  if (!strcmp(argv[1], "stop")) {
+    if (argc == 3 && !strcmp(argv[2], "off")) {
+      tbuf::stopvec = UINT32_MAX;
+      return 0;
+    }
+    if ((argc == 3 || argc == 4) && sscanf(argv[2], "%o", &a) == 1) {
+      tbuf::stopvec = a;
+      if (argc == 4 && sscanf(argv[3], "%u", &b) == 1) {
+        tbuf::post = b;
+      }
+      return 0;
+    }
+  }
+  if ((argc == 2 || argc == 3) && !strcmp(argv[1], "save")) {
+    const char *path = argc == 3 ? argv[2] : "tbuf.bin";
+    if (!tbuf::save(path)) {
+      dev->printf("could not write %s\r\n", path);
+      return 3;
+    }
+    return 0;
+  }
+  dev->println("Usage: tb [n|on|off|clear|save [file]]");
+  dev->println("       tb pc lo hi|all, tb mode k|u|any, tb stop vector [n]|off");
+  return 1;
+}
+
+CLI_COMMAND(rrCmd) {
+  static const char *modes[] = { "off", "recording", "replaying" };
+  if (argc == 1) {
+    dev->printf("rr: %s, %u records from instruction %u\r\n", modes[rr::mode], rr::records, (uint32_t) rr::start);
+    return 0;
+  }
+  if (argc == 2 && !strcmp(argv[1], "stop")) {
+    rr::stop();
+    return 0;
+  }
+  if (argc == 3 && (!strcmp(argv[1], "record") || !strcmp(argv[1], "replay"))) {
+    const bool ok = argv[1][2] == 'c' ? rr::record(argv[2]) : rr::replay(argv[2]);
+    if (!ok) {
+      dev->printf("could not %s %s\r\n", argv[1], argv[2]);
+      return 2;
+    }
+    return 0;
+  }
+  dev->println("Usage: rr [record file|replay file|stop]");
+  return 1;
+}
+
+CLI_COMMAND(saveCmd) {
+  if (argc != 2) {
+    dev->println("Usage: save name");
+    return 1;
+  }
+  if (!snap::save(argv[1])) {
+    return 2;
+  }
+  dev->printf("saved at instruction %u\r\n", (uint32_t) sched::icount);
+  return 0;
+}
+
+CLI_COMMAND(restoreCmd) {
+  if (argc != 2) {
+    dev->println("Usage: restore name");
+    return 1;
+  }
+  if (!snap::restore(argv[1])) {
+    return 2;
+  }
+  dev->printf("restored at instruction %u, continue with cont\r\n", (uint32_t) sched::icount);
+  return 0;
+}
+
+CLI_COMMAND(ckptCmd) {
+  if (argc == 1) {
+    snap::status(dev);
+    return 0;
+  }
+  if (argc == 2 && !strcmp(argv[1], "off")) {
+    snap::periodic(nullptr, 0);
+    return 0;
+  }
+  if (argc == 2) {
+    return snap::checkpoint(argv[1]) ? 0 : 2;
+  }
+  if (argc == 4 && !strcmp(argv[2], "every") && atoi(argv[3]) > 0) {
+    snap::periodic(argv[1], (uint32_t) atoi(argv[3]) * 1000000);
+    return 0;
+  }
+  dev->println("Usage: ckpt [name|name every n|off], n in million instructions");
+  return 1;
+}
+
+CLI_COMMAND(benchCmd) {
+  if (argc == 1) {
+    bench::status(dev);
+    return 0;
+  }
+  if (argc <= 4) {
+    if (!bench::begin(argv[1], argc > 2 ? argv[2] : nullptr, argc > 3 ? argv[3] : nullptr)) {
+      return 2;
+    }
+    dev->println("bench: starts with boot or cont");
+    return 0;
+  }
+  dev->println("Usage: bench [script [results.csv [baseline.csv]]]");
+  return 1;
+}
+
+CLI_COMMAND(ubenchCmd) {
+  if (argc > 2) {
+    dev->println("Usage: ubench [aget|alu|branch|step|mmu|unibus|irq|trap|fp]");
+    return 1;
+  }
+  ubench::run(dev, argc == 2 ? argv[1] : nullptr);
+  dev->println("ubench: the cpu was reset");
+  return 0;
+}
+
+CLI_COMMAND(hleCmd) {
+  switch (argc) {
+    case 1:
+      dev->printf("hle: %s\r\n", hle::enabled ? "on" : "off");
+      for (uint32_t i = 0; i < hle::HLE_N; i++) {
+        dev->printf("%-8s %06o %10u native %10u interpreted\r\n",
+          hle::names[i], hle::addr[i], hle::calls[i], hle::missed[i]);
+      }
+      return 0;
+    case 2:
+      if (!strcmp(argv[1], "on")) {
+        hle::enabled = true;
+        return 0;
+      }
+      if (!strcmp(argv[1], "off")) {
+        hle::enabled = false;
+        return 0;
+      }
+      break;
+    case 3:
+      if (!strcmp(argv[1], "load")) {
+        if (!hle::load(argv[2])) {
+          dev->print("could not read "); dev->println(argv[2]);
+          return 2;
+        }
+        return 0;
+      }
+      break;
+  }
+  dev->println("Usage: hle [on|off|load file]");
+  return 1;
+}
+
+CLI_COMMAND(speedCmd) {
+  unsigned int n;
+  switch (argc) {
+    case 1:
+      if (kd11::speed) {
+        dev->printf("speed: %dx\r\n", kd11::speed);
+      } else {
+        dev->println("speed: max");
+      }
+      dev->printf("guest time: %u ms\r\n", (uint32_t)(kd11::cycles / 1000000));
+      return 0;
+    case 2:
+      if (!strcmp(argv[1], "max")) {
+        kd11::speed = 0;
+        return 0;
+      }
+      if (sscanf(argv[1], "%u", &n) == 1 && n > 0) {
+        kd11::speed = n;
+        kd11::sync();
+        return 0;
+      }
+  }
+  dev->println("Usage: speed [n|max]");
+  return 1;
+}
+
+CLI_COMMAND(panelCmd) {
+  unsigned int n;
+  switch (argc) {
+    case 1:
+      if (panel::hz) {
+        dev->printf("panel: %d Hz\r\n", panel::hz);
+      } else {
+        dev->println("panel: off");
+      }
+      return 0;
+    case 2:
+      if (!strcmp(argv[1], "off")) {
+        panel::hz = 0;
+        return 0;
+      }
+      if (sscanf(argv[1], "%u", &n) == 1 && n > 0 && n <= 1000) {
+        panel::hz = n;
+        return 0;
+      }
+  }
+  dev->println("Usage: panel [hz|off]");
+  return 1;
+}
+
+CLI_COMMAND(pasteCmd) {
+  dl11::paste = dl11::paste ? false : true;
+  dev->printf("paste: %s\r\n", dl11::paste ? "true" : "false");
+  return 0;
+}
+
 CLI_COMMAND(tmCmd) {
   char buf[15];
   if (argc == 1) {
@@ -252,8 +874,11 @@ CLI_COMMAND(rkCmd) {
   char buf[15];
   if (argc == 1) {
     for (int i = 0; i < RK_NUM_DRV; i++) {
-      if (rk11::rkdata[i].attached && rk11::rkdata[i].file.getName(&buf[0], sizeof(buf))) {
-        dev->printf("rk%d: %s\r\n", i, buf);
+      const char *ram = rk11::rkdata[i].ram ? " (ram)" : "";
+      if (rk11::rkdata[i].attached && rk11::rkdata[i].file.isOpen() && rk11::rkdata[i].file.getName(&buf[0], sizeof(buf))) {
+        dev->printf("rk%d: %s%s\r\n", i, buf, ram);
+      } else if (rk11::rkdata[i].attached) {
+        dev->printf("rk%d: scratch%s\r\n", i, ram);
       } else {
         dev->printf("rk%d: -\r\n", i);
       }
@@ -261,8 +886,10 @@ CLI_COMMAND(rkCmd) {
     return 0;
   }
       
-  if (argc != 3) {
-    dev->println("Usage: rk devicenumber filename");
+  if (argc != 3 && !(argc == 4 && !strcmp(argv[3], "ram"))) {
+    dev->println("Usage: rk devicenumber filename [ram]");
+    dev->println("       rk devicenumber ram");
+    dev->println("       rk devicenumber -");
     return 1;
   }
   int drive = atoi(argv[1]);
@@ -271,21 +898,54 @@ CLI_COMMAND(rkCmd) {
     return 2;
   }
   if (argv[2][0] == '-') {
-    rk11::rkdata[drive].file.close();
-    rk11::rkdata[drive].attached = false;
+    rk11::detach(drive);
     rk11::reset();
     dev->printf("detached rk%d\r\n", drive);
     return 0;
   }
-  if (!rk11::rkdata[drive].file.open(argv[2], O_RDWR)) {
-    dev->printf("could not open %s\r\n", argv[2]);
+  const bool scratch = argc == 3 && !strcmp(argv[2], "ram");
+  if (!rk11::attach(drive, scratch ? nullptr : argv[2], scratch || argc == 4)) {
     return 3;
+  }
+  rk11::reset();
+  if (scratch) {
+    dev->printf("attached a scratch ram disk on rk%d\r\n", drive);
   } else {
-    rk11::rkdata[drive].attached = true;
-    rk11::reset();
-    dev->printf("attached %s on rk%d\r\n", argv[2], drive);
+    dev->printf("attached %s on rk%d%s\r\n", argv[2], drive, argc == 4 ? " in ram" : "");
+  }
+  return 0;
+}
+
+CLI_COMMAND(dzCmd) {
+  char buf[48];
+  if (argc == 1) {
+    for (int i = 0; i < DZ_LINES; i++) {
+      dz11::describe(i, buf, sizeof(buf));
+      dev->printf("dz%d: %s\r\n", i, buf);
+    }
     return 0;
   }
+  if (argc != 3 && argc != 4) {
+    dev->println("Usage: dz line port [arg]");
+    return 1;
+  }
+  int line = atoi(argv[1]);
+  if (line < 0 || line >= DZ_LINES) {
+    dev->printf("max line number is %d\r\n", DZ_LINES - 1);
+    return 2;
+  }
+  if (argv[2][0] == '-') {
+    dz11::detach(line);
+    dev->printf("detached dz%d\r\n", line);
+    return 0;
+  }
+  if (!dz11::attach(line, argv[2], argc == 4 ? atoi(argv[3]) : 0)) {
+    dev->printf("could not open %s\r\n", argv[2]);
+    return 3;
+  }
+  dz11::describe(line, buf, sizeof(buf));
+  dev->printf("attached %s on dz%d\r\n", buf, line);
+  return 0;
 }
 
 CLI_COMMAND(cpCmd) {
@@ -364,7 +1024,7 @@ CLI_COMMAND(dCmd) {
     case 2:
     res = sscanf(argv[1], "%06o", &val);
     if (res == 1) {
-      dis_addr = val & ~ 1;
+      dis_addr = phys(val & ~ 1);
       for (i = 0; i < 16; i++) {
         dis_addr = disasm(dis_addr & ~1);
       }
@@ -404,7 +1064,7 @@ CLI_COMMAND(eCmd) {
   if (argc == 2) {
     res = sscanf(argv[1], "%06o", &addr);
     if (res == 1) {
-      dev->printf("%06o: %06o\r\n", addr & ~1, unibus::read16(addr & ~1));
+      dev->printf("%06o: %06o\r\n", addr & ~1, unibus::read16(phys(addr & ~1)));
       return 0;
     }   
   }
@@ -437,7 +1097,7 @@ CLI_COMMAND(wCmd) {
           dev->println("data?");
           return 4;
         }
-        unibus::write16(addr, (uint16_t) data);
+        unibus::write16(phys(addr), (uint16_t) data);
         addr+=2;
       }          
   }
@@ -569,9 +1229,11 @@ CLI_COMMAND(helpCmd) {
   dev->println("        usage: mv old new");
   dev->println("rm    - remove file");
   dev->println("rk    - attach filename to rk11 drive number");
-  dev->println("        usage: rk [0-7] filename, '-' detaches");
+  dev->println("        usage: rk [0-7] filename [ram] | ram, '-' detaches");
   dev->println("tm    - attach filename to tm11 drive number");
   dev->println("        usage: tm [0-7] filename, '-' detaches");
+  dev->println("dz    - attach a host port to dz11 line number");
+  dev->println("        usage: dz [0-7] serial[1-8] [baud] | usb[1-2], '-' detaches");
   dev->println("cat   - print file to standard output");
   dev->println("boot  - run machine bootstrap code");
   dev->println("cont  - continue after pause (^P)");
@@ -584,6 +1246,44 @@ CLI_COMMAND(helpCmd) {
   dev->println("reset - reset machine");
   dev->println("patch - patch the rtc time into to superblock on read");
   dev->println("        use with V6 unix only (for now)");
+  dev->println("rxdelay - set the console input delay in instructions");
+  dev->println("        usage: rxdelay [n], '-' flushes the type-ahead buffer");
+  dev->println("paste - toggle bulk paste mode, feed input without delay");
+  dev->println("clock - run the kw11-l line clock in real or guest time");
+  dev->println("        usage: clock [real|virtual [instructions per tick]]");
+  dev->println("batch - max instructions run between two device services");
+  dev->println("        usage: batch [n], 1 polls the devices after every instruction");
+  dev->println("ips   - executed and skipped instructions per second");
+  dev->println("mem   - core size and memory management mode");
+  dev->println("        usage: mem [kbytes], up to 4088k with 22 bit addressing");
+  dev->println("fusion - fused instruction sequences, report how often they fired");
+  dev->println("        usage: fusion [on|off|reset]");
+  dev->println("blocks - run predecoded basic blocks instead of single steps");
+  dev->println("        usage: blocks [on|off|verify], verify runs each block in lockstep with the interpreter");
+  dev->println("istat - top n instruction classes by addressing modes, kernel and user");
+  dev->println("        usage: istat [n|reset|dump [file]], needs ENABLE_ISTAT in pdp11.h");
+  dev->println("prof  - sample the guest pc, report the top n functions or write folded stacks");
+  dev->println("        usage: prof [n|on [hz]|off|reset|fold [file]|unix file|user file], file may be rkN:path");
+  dev->println("tb    - binary instruction trace, print the last n entries (^T starts and stops it)");
+  dev->println("        usage: tb [n|on|off|clear|save [file]|pc lo hi|pc all|mode k|u|any|stop vector [n]|stop off]");
+  dev->println("rr    - record the console and dz11 input, line clock ticks and rtc reads, or replay them");
+  dev->println("        usage: rr [record file|replay file|stop], from power on or the state the log started in");
+  dev->println("save  - write the whole machine, core, registers and attached images, to a snapshot");
+  dev->println("        usage: save name");
+  dev->println("restore - load a snapshot written by save, the images it names are attached again");
+  dev->println("        usage: restore name");
+  dev->println("ckpt  - checkpoint to name.0 or name.1, the core written since the last one only");
+  dev->println("        usage: ckpt [name|name every n|off], n in million instructions, restore name loads the latest");
+  dev->println("bench - run a script of expect and send lines on the console, time it and count the work");
+  dev->println("        usage: bench [script [results.csv [baseline.csv]]], appends to results, compares with baseline");
+  dev->println("ubench - time aget, alu ops, branches, mmu::decode, unibus::read16, interrupts, traps and fp in ns");
+  dev->println("        usage: ubench [aget|alu|branch|step|mmu|unibus|irq|trap|fp], resets the cpu, run it before boot");
+  dev->println("hle - run the V6 copyin/copyout/copyseg/clearseg natively");
+  dev->println("        usage: hle [on|off|load file], file is a namelist (unix) or name/octal address lines");
+  dev->println("speed - hold the machine to n times the speed of an 11/40");
+  dev->println("        usage: speed [n|max]");
+  dev->println("panel - front panel refresh rate");
+  dev->println("        usage: panel [hz|off]");
   return 0;
 }
 
@@ -595,7 +1295,7 @@ void setup(bool brk) {
   if (brk) {
     //Serial.printf("%06o %06o %06o %06o\r\n", cpu::R[0], cpu::R[4], cpu::R[6], cpu::R[7]); 
     Serial.println();   
-    Serial.printf("%d instr/s, mmu: %s\r\n", ips, mmu::SR0 & 1 ? "on" : "off");    
+    Serial.printf("%d instr/s, idle: %d%%, %d skipped/s, 11/40 speed: %d%%, mmu: %s\r\n", ips, idlepct, iskip, gspeed, mmu::SR0 & 1 ? "on" : "off");    
     Serial.printf("R0 %06o ", uint16_t(cpu::R[0]));
     Serial.printf("R1 %06o ", uint16_t(cpu::R[1]));
     Serial.printf("R2 %06o ", uint16_t(cpu::R[2]));
@@ -627,6 +1327,7 @@ void setup(bool brk) {
   CLI.addCommand("rm", rmCmd);
   CLI.addCommand("rk", rkCmd);  
   CLI.addCommand("tm", tmCmd);  
+  CLI.addCommand("dz", dzCmd);
   CLI.addCommand("cat", catCmd);
   CLI.addCommand("boot", bootCmd);
   CLI.addCommand("cont", contCmd);    
@@ -635,6 +1336,26 @@ void setup(bool brk) {
   CLI.addCommand("trace", traceCmd);  
   CLI.addCommand("patch", patchCmd);
   CLI.addCommand("dump", dumpCmd);
+  CLI.addCommand("rxdelay", rxdelayCmd);
+  CLI.addCommand("paste", pasteCmd);
+  CLI.addCommand("batch", batchCmd);
+  CLI.addCommand("ips", ipsCmd);
+  CLI.addCommand("mem", memCmd);
+  CLI.addCommand("clock", clockCmd);
+  CLI.addCommand("panel", panelCmd);
+  CLI.addCommand("speed", speedCmd);
+  CLI.addCommand("fusion", fusionCmd);
+  CLI.addCommand("hle", hleCmd);
+  CLI.addCommand("blocks", blocksCmd);
+  CLI.addCommand("istat", istatCmd);
+  CLI.addCommand("prof", profCmd);
+  CLI.addCommand("tb", tbCmd);
+  CLI.addCommand("rr", rrCmd);
+  CLI.addCommand("save", saveCmd);
+  CLI.addCommand("restore", restoreCmd);
+  CLI.addCommand("ckpt", ckptCmd);
+  CLI.addCommand("bench", benchCmd);
+  CLI.addCommand("ubench", ubenchCmd);
   CLI.addCommand("tftp", tftpCmd);
   CLI.addCommand("?", helpCmd);
   CLI.addCommand("h", helpCmd);
@@ -0,0 +1,89 @@
+#include <Arduino.h>
+#include "unibus.h"
+#include "bcache.h"
+
+namespace bcache {
+
+MACHINE_STATE bool enabled = false;
+MACHINE_STATE bool verify = false;
+MACHINE_STATE uint32_t gen;
+MACHINE_STATE uint8_t code[BC_CHUNKS / 8];
+MACHINE_STATE uint32_t hits, misses, drops, mismatches;
+MACHINE_STATE uint32_t verified, skipped;
+MACHINE_STATE bool logging = false;
+MACHINE_STATE bool replayable;
+MACHINE_STATE uint32_t nlog;
+MACHINE_STATE undo journal[BC_LOG];
+
+#if defined(TEENSYDUINO)
+DMAMEM static block blocks[BC_ENTRIES];
+#else
+static MACHINE_STATE block blocks[BC_ENTRIES];
+#endif
+
+block *slot(const uint32_t pa) {
+  return &blocks[(pa >> 1) & (BC_ENTRIES - 1)];
+}
+
+void mark(const uint32_t pa) {
+  code[pa >> 9] |= 1 << ((pa >> 6) & 7);
+}
+
+// drop every block starting in the chunk of pa
+void invalidate(const uint32_t pa) {
+  const uint32_t chunk = pa & ~077;
+  for (uint32_t a = chunk; a < chunk + 0100; a += 2) {
+    block *b = slot(a);
+    if ((b->pa & ~077) == chunk) {
+      b->pa = UINT32_MAX;
+      drops++;
+    }
+  }
+  code[pa >> 9] &= ~(1 << ((pa >> 6) & 7));
+  gen++;
+}
+
+void flush() {
+  for (uint32_t i = 0; i < BC_ENTRIES; i++) {
+    blocks[i].pa = UINT32_MAX;
+  }
+  memset(code, 0, sizeof(code));
+  gen++;
+  logging = false;
+}
+
+// start the journal of a block in lockstep
+void begin() {
+  nlog = 0;
+  replayable = true;
+  logging = true;
+}
+
+// the value of a word before its first write, a full journal makes the
+// run one that can not be rolled back
+void note(uint32_t pa) {
+  pa &= ~1;
+  for (uint32_t i = 0; i < nlog; i++) {
+    if (journal[i].pa == pa) {
+      return;
+    }
+  }
+  if (nlog == BC_LOG) {
+    replayable = false;
+    return;
+  }
+  journal[nlog].pa = pa;
+  journal[nlog++].old = unibus::core16[pa >> 1];
+}
+
+// core as before the block, the values it left go to now. the blocks
+// of the written chunks stay dropped.
+void rollback() {
+  logging = false;
+  for (uint32_t i = 0; i < nlog; i++) {
+    journal[i].now = unibus::core16[journal[i].pa >> 1];
+    unibus::core16[journal[i].pa >> 1] = journal[i].old;
+  }
+}
+
+};
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stdint.h>
+#include <pdp11.h>
+
+// predecoded basic blocks. a block holds the handlers of up to BC_OPS
+// straight line instructions inside one 64 byte chunk of core, keyed by
+// the physical address of the first. the mmu maps whole 64 byte blocks,
+// so any virtual pc reaching that address sees the same code. writes to
+// a chunk holding blocks drop them, writes to the mmu registers and the
+// PS end the block that runs.
+//
+// with verify each block runs in lockstep with the interpreter: the
+// block runs, the core words it wrote are rolled back, the same
+// instructions run again by single steps and the registers and core of
+// the two runs are compared. the interpreter's result stays. a block
+// that touched the io page or wrote more than BC_LOG words can not run
+// twice and is only compared with core.
+#if defined(TEENSYDUINO)
+#define BC_ENTRIES 256
+#else
+#define BC_ENTRIES 4096
+#endif
+#define BC_OPS 8
+#define BC_CHUNKS (017760000 >> 6) // the 22 bit io page
+#define BC_LOG 64 // core words of a block in lockstep
+// the blocks are compiled to x86-64 code on the host, see jit.h
+#if !defined(TEENSYDUINO) && defined(__x86_64__)
+#define BC_JIT 1
+#else
+#define BC_JIT 0
+#endif
+
+namespace bcache {
+
+    typedef void (*handler)(uint32_t instr);
+
+    struct op {
+      handler fn;
+      uint16_t instr;
+      uint16_t len;  // bytes including the operand words
+      uint32_t ns;   // KD11 time
+    };
+
+    struct block {
+      uint32_t pa;   // UINT32_MAX if empty
+      uint32_t n;
+      op ops[BC_OPS];
+#if BC_JIT
+      void *code;    // compiled for vpc and key, the mode and the mmu setup
+      uint32_t vpc, key;
+#endif
+    };
+
+    // a core word before the block wrote it and after
+    struct undo {
+      uint32_t pa;
+      uint16_t old, now;
+    };
+
+    extern MACHINE_STATE bool enabled;
+    extern MACHINE_STATE bool verify;  // run every block in lockstep with the interpreter
+    extern MACHINE_STATE uint32_t gen; // bumped when blocks are dropped or the mapping changed
+    extern MACHINE_STATE uint8_t code[BC_CHUNKS / 8];
+    extern MACHINE_STATE uint32_t hits, misses, drops, mismatches;
+    extern MACHINE_STATE uint32_t verified, skipped;
+    extern MACHINE_STATE bool logging;    // the core writes go to the journal
+    extern MACHINE_STATE bool replayable; // the logged run can run again
+    extern MACHINE_STATE uint32_t nlog;
+    extern MACHINE_STATE undo journal[BC_LOG];
+
+    block *slot(uint32_t pa);
+    void mark(uint32_t pa);
+    void invalidate(uint32_t pa);
+    void flush();
+    void begin();
+    void note(uint32_t pa);
+    void rollback();
+
+    // the mmu or the mode changed, the next pc may map elsewhere
+    static inline void remap() {
+      gen++;
+    }
+
+    // called before every write to core
+    static inline void before(const uint32_t pa) {
+      if (logging) {
+        note(pa);
+      }
+    }
+
+    // called for every access to the io page, a device is not run twice
+    static inline void io() {
+      replayable = false;
+    }
+
+    // called for every write to core
+    static inline void written(const uint32_t pa) {
+      if (code[pa >> 9] & (1 << ((pa >> 6) & 7))) {
+        invalidate(pa);
+      }
+    }
+
+};
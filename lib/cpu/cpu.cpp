@@ -1,21 +1,30 @@
 #include <SdFat.h>
 #include <pdp11.h>
-#include <mutex.h>
 #include "mmu.h"
 #include "dl11.h"
 #include "unibus.h"
 #include "cpu.h"
+#include "snap.h"
+#include "kd11.h"
+#include "fp11.h"
+#include "sched.h"
+#include "hle.h"
+#include "bcache.h"
+#include "istat.h"
+#include "tbuf.h"
+#include "jit.h"
 
 #include "bootrom.h"
 #include "rk05.h"
 #include "tm11.h"
+#include "dz11.h"
 
 #define GET_SIGN_W(v)   (((v) >> 15) & 1)
 #define GET_SIGN_B(v)   (((v) >> 7) & 1)
 
-pdp11::intr itab[ITABN];
+MACHINE_STATE pdp11::irqs itab;
 
-extern int trace;
+extern MACHINE_STATE int trace;
 
 namespace cpu {
 
@@ -29,7 +38,7 @@ FsFile invlog;
 #define STKL_Y          0400
 
 // registers
-uint32_t R[8];
+MACHINE_STATE uint32_t R[8];
 /*
   15  14  13  12  11  10  09  08  07  06  05  04  03  02  01  00
 +---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+
@@ -37,16 +46,22 @@ uint32_t R[8];
 +---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+
 */
 
-PSW PS; // processor status 777776
-uint32_t PC; // address of current instruction
-uint32_t lastPC;
-uint32_t KSP, USP; // kernel and user stack pointer
-uint32_t LKS;      // clock1
+MACHINE_STATE PSW PS; // processor status 777776
+MACHINE_STATE uint32_t PC; // address of current instruction
+MACHINE_STATE uint32_t lastPC;
+MACHINE_STATE uint32_t KSP, USP; // kernel and user stack pointer
+MACHINE_STATE uint32_t LKS;      // clock1
 //uint16_t TRAP_REQ;
 
-bool curuser, prevuser, g_cmd = false;
+MACHINE_STATE bool curuser, prevuser, g_cmd = false;
+MACHINE_STATE volatile uint32_t irqlevel;
+MACHINE_STATE uint32_t traps, interrupts;
+
+static void build_dispatch();
 
 void reset(void) {
+  sched::clear(sched::WORK_WAIT);
+  build_dispatch();
   if (!g_cmd) {
     LKS = 1 << 7;
     for (uint32_t i = 0; i < 29; i++) {
@@ -64,9 +79,12 @@ void reset(void) {
   unibus::write16(000024, 000026); 
   unibus::write16(000026, 000000); 
   mmu::reset();
+  fp11::reset();
+  bcache::flush();
   dl11::reset();
   rk11::reset();
   tm11::reset();
+  dz11::reset();
 #ifdef INVLOG
   invlog.close();
   invlog.open("/invalid.log", O_CREAT|O_APPEND|O_WRITE);
@@ -89,6 +107,19 @@ static void write16(const uint32_t a, const uint32_t v) {
   unibus::write16(mmu::decode(a, true, curuser), v);
 }
 
+// instruction space reads, the instruction stream and the immediate
+// operands. with split I/D space they go through the I pages.
+static uint16_t readi16(const uint32_t a) {
+  return unibus::read16(mmu::decode(a, false, curuser, true));
+}
+
+static uint16_t readi8(const uint32_t a) {
+  return unibus::read8(mmu::decode(a, false, curuser, true));
+}
+
+// aget tags the address of an immediate operand, (PC)+, with ISPACE
+#define ISPACE 0200000
+
 static inline bool isReg(const uint32_t a) {
   return (a & 0177770) == 0170000;
 }
@@ -97,6 +128,9 @@ static uint16_t memread16(const uint32_t a) {
   if (isReg(a)) {
     return R[a & 7];
   }
+  if (a & ISPACE) {
+    return readi16(a);
+  }
   return read16(a);
 }
 
@@ -115,6 +149,9 @@ static uint16_t memread(const uint32_t a, const uint32_t l) {
       return R[r] & 0xFF;
     }
   }
+  if (a & ISPACE) {
+    return l == 2 ? readi16(a) : readi8(a);
+  }
   if (l == 2) {
     return read16(a);
   }
@@ -131,6 +168,8 @@ static void memwrite16(const uint32_t a, const uint32_t v) {
       }
     }
     */
+  } else if (a & ISPACE) {
+    unibus::write16(mmu::decode(a, true, curuser, true), v);
   } else {
     write16(a, v);
   }
@@ -147,6 +186,15 @@ static void memwrite(const uint32_t a, const uint32_t l, const uint32_t v) {
     }
     return;
   }
+  if (a & ISPACE) {
+    const uint32_t pa = mmu::decode(a, true, curuser, true);
+    if (l == 2) {
+      unibus::write16(pa, v);
+    } else {
+      unibus::write8(pa, v);
+    }
+    return;
+  }
   if (l == 2) {
     write16(a, v);
   } else {
@@ -155,7 +203,7 @@ static void memwrite(const uint32_t a, const uint32_t l, const uint32_t v) {
 }
 
 static uint16_t fetch16() {
-  const uint32_t val = read16(R[7]);
+  const uint32_t val = readi16(R[7]);
   R[7] += 2;
   return val;
 }
@@ -176,7 +224,7 @@ static uint16_t pop() {
 // the range [0170000,0170007). This address range is
 // technically a valid IO page, but unibus doesn't map
 // any addresses here, so we can safely do this.
-static uint16_t aget(uint32_t v, uint32_t l) {
+static uint32_t aget(uint32_t v, uint32_t l) {
   if (debug) {
     Serial.printf("DEBUG: aget: PC: %06o, %06o, %03o\r\n", PC, v, l);
   }
@@ -196,13 +244,13 @@ static uint16_t aget(uint32_t v, uint32_t l) {
         l = 2;
       }
       addr = R[v & 7];
-      R[v & 7] += l;
+      R[v & 7] = (R[v & 7] + l) & 0xFFFF;
       break;
     case 040:        // mode 4 autodecrement
       if (((v & 7) >= 6) || ((v & 010) != 0)) {
         l = 2;
       }
-      R[v & 7] -= l;
+      R[v & 7] = (R[v & 7] - l) & 0xFFFF;
       addr = R[v & 7];
       break;
     case 060:       //  mode 6 index
@@ -210,10 +258,20 @@ static uint16_t aget(uint32_t v, uint32_t l) {
       addr += R[v & 7];
       break;
   }
-  // addr &= 0xFFFF;
-  if (v & 010) { // handle deferred
+  // a carry out of the sum would read as the ISPACE tag
+  addr &= 0xFFFF;
+  if ((v & 067) == 027) { // (PC)+ and @(PC)+ read the instruction stream
+    if (v & 010) {
+      addr = readi16(addr);
+    } else {
+      addr = (addr & 0xFFFF) | ISPACE;
+    }
+  } else if (v & 010) { // handle deferred
     addr = read16(addr);
   }
+  if (tbuf::on) {
+    tbuf::ea(addr);
+  }
   return addr;
 }
 
@@ -248,7 +306,6 @@ void switchmode(const bool newm) {
 }
 
 static void MOV(const uint32_t instr) {
-  //istat[0]++;
   const uint32_t d = instr & 077;
   const uint32_t s = (instr & 07700) >> 6;
   uint32_t l = 2 - (instr >> 15);
@@ -271,7 +328,6 @@ static void MOV(const uint32_t instr) {
 }
 
 static void CMP(uint32_t instr) {
-  //istat[1]++;
   const uint32_t d = instr & 077;
   const uint32_t s = (instr & 07700) >> 6;
   const uint32_t l = 2 - (instr >> 15);
@@ -295,7 +351,6 @@ static void CMP(uint32_t instr) {
 }
 
 static void BIT(uint32_t instr) {
-  //istat[2]++;
   const uint32_t d = instr & 077;
   const uint32_t s = (instr & 07700) >> 6;
   const uint32_t l = 2 - (instr >> 15);
@@ -312,7 +367,6 @@ static void BIT(uint32_t instr) {
 }
 
 static void BIC(uint32_t instr) {
-  //istat[3]++;
   const uint32_t d = instr & 077;
   const uint32_t s = (instr & 07700) >> 6;
   const uint32_t l = 2 - (instr >> 15);
@@ -331,7 +385,6 @@ static void BIC(uint32_t instr) {
 }
 
 static void BIS(uint32_t instr) {
-  //istat[4]++;
   uint32_t d = instr & 077;
   uint32_t s = (instr & 07700) >> 6;
   uint32_t l = 2 - (instr >> 15);
@@ -353,7 +406,6 @@ DEBUG: aget: PC: 011504, 000067, 002
 DEBUG: PC: 011504, ADD: da: 017360, val1: 177777, val2: 000000, uval: 177777
 */
 static void ADD(uint32_t instr) {
-  //istat[5]++;
   uint32_t d = instr & 077;
   uint32_t s = (instr & 07700) >> 6;
   //uint8_t l = 2 - (instr >> 15);
@@ -374,7 +426,6 @@ static void ADD(uint32_t instr) {
 }
 
 static void SUB(uint32_t instr) {
-  //istat[6]++;
   uint32_t d = instr & 077;
   uint32_t s = (instr & 07700) >> 6;
   //uint8_t l = 2 - (instr >> 15);  
@@ -405,7 +456,6 @@ static void SUB(uint32_t instr) {
 }
 
 static void JSR(uint32_t instr) {
-  //istat[7]++;
   uint32_t d = instr & 077;
   uint32_t s = (instr & 07700) >> 6;
   uint32_t l = 2 - (instr >> 15);
@@ -424,12 +474,11 @@ static void JSR(uint32_t instr) {
   }
   */
   R[s & 7] = R[7]; 
-  R[7] = dst;
+  R[7] = dst & 0xFFFF;
   //Serial.printf("jsr %06o\r\n", uval);
 }
 
 static void MUL(const uint32_t instr) {
-  //istat[8]++;
   uint32_t d = instr & 077;
   uint32_t s = (instr & 07700) >> 6;
   if (s == 0 && d == 0) {
@@ -459,7 +508,6 @@ static void MUL(const uint32_t instr) {
 }
 
 static void DIV(uint32_t instr) {
-  //istat[9]++;
   uint32_t d = instr & 077;
   uint32_t s = (instr & 07700) >> 6;
   int32_t src = (R[s & 7] << 16) | (R[(s & 7) | 1]);
@@ -500,7 +548,6 @@ static void DIV(uint32_t instr) {
 }
 
 static void ASH(uint32_t instr) {
-  //istat[10]++;
   uint32_t d = instr & 077;
   uint32_t s = (instr & 07700) >> 6;
   uint32_t val1 = R[s & 7];
@@ -537,7 +584,6 @@ static void ASH(uint32_t instr) {
 }
 
 static void ASHC(uint32_t instr) {
-  //istat[11]++;
   uint32_t d = instr & 077;
   uint32_t s = (instr & 07700) >> 6;
   uint32_t val1 = R[s & 7] << 16 | R[(s & 7) | 1]; // was uint16_t
@@ -574,7 +620,6 @@ static void ASHC(uint32_t instr) {
 }
 
 static void XOR(uint32_t instr) {
-  //istat[12]++;
   const uint32_t d = instr & 077;
   const uint32_t s = (instr & 07700) >> 6;
   const uint32_t val1 = R[s & 7];
@@ -590,7 +635,6 @@ static void XOR(uint32_t instr) {
 }
 
 static void SOB(const uint32_t instr) {
-  //istat[13]++;
   const uint32_t s = (instr & 07700) >> 6;
   uint32_t o = instr & 0xFF;
   R[s & 7]--;
@@ -602,7 +646,6 @@ static void SOB(const uint32_t instr) {
 }
 
 static void CLR(uint32_t instr) {
-  //istat[14]++;
   const uint32_t d = instr & 077;
   const uint32_t l = 2 - (instr >> 15);
   PS.Word &= 0xFFF0;
@@ -612,7 +655,6 @@ static void CLR(uint32_t instr) {
 }
 
 static void COM(uint32_t instr) {
-  //istat[15]++;
   uint32_t d = instr & 077;
   //uint8_t s = (instr & 07700) >> 6;
   uint32_t l = 2 - (instr >> 15);
@@ -630,7 +672,6 @@ static void COM(uint32_t instr) {
 }
 
 static void INC(const uint32_t instr) {
-  //istat[16]++;
   const uint32_t d = instr & 077;
   const uint32_t l = 2 - (instr >> 15);
   const uint32_t msb = l == 2 ? 0x8000 : 0x80;
@@ -647,7 +688,6 @@ static void INC(const uint32_t instr) {
 }
 
 static void _DEC(uint32_t instr) {
-  //istat[17]++;
   uint32_t d = instr & 077;
   uint32_t l = 2 - (instr >> 15);
   uint32_t msb = l == 2 ? 0x8000 : 0x80;
@@ -667,7 +707,6 @@ static void _DEC(uint32_t instr) {
 }
 
 static void NEG(uint32_t instr) {
-  //istat[18]++;
   uint32_t d = instr & 077;
   uint32_t l = 2 - (instr >> 15);
   uint32_t msb = l == 2 ? 0x8000 : 0x80;
@@ -690,7 +729,6 @@ static void NEG(uint32_t instr) {
 }
 
 static void ADC(uint32_t instr) {
-  //istat[19]++;
   uint32_t d = instr & 077;
   uint32_t l = 2 - (instr >> 15);
   uint32_t msb = l == 2 ? 0x8000 : 0x80;
@@ -720,7 +758,6 @@ static void ADC(uint32_t instr) {
 }
 
 static void SBC(uint32_t instr) {
-  //istat[20]++;
   uint32_t d = instr & 077;
   uint32_t l = 2 - (instr >> 15);
   //uint16_t msb = l == 2 ? 0x8000 : 0x80;
@@ -739,7 +776,6 @@ static void SBC(uint32_t instr) {
 }
 
 static void TST(uint32_t instr) {
-  //istat[21]++;
   uint32_t d = instr & 077;
   uint32_t l = 2 - (instr >> 15); // result is 0 if word addressed, else 1
   uint32_t msb = l == 2 ? 0x8000 : 0x80; // l == 1?
@@ -752,7 +788,6 @@ static void TST(uint32_t instr) {
 }
 
 static void ROR(uint32_t instr) {
-  //istat[22]++;
   uint32_t d = instr & 077;
   uint32_t l = 2 - (instr >> 15);
   uint32_t da = aget(d, l);
@@ -774,7 +809,6 @@ static void ROR(uint32_t instr) {
 }
 
 static void ROL(uint32_t instr) {
-  //istat[23]++;
   uint32_t d = instr & 077;
   uint32_t l = 2 - (instr >> 15);
   uint32_t da = aget(d, l);
@@ -795,7 +829,6 @@ static void ROL(uint32_t instr) {
 }
 
 static void ASR(uint32_t instr) {
-  //istat[24]++;
   uint32_t d = instr & 077;
   uint32_t l = 2 - (instr >> 15);
   uint32_t msb = l == 2 ? 0x8000 : 0x80;
@@ -823,7 +856,6 @@ static void ASR(uint32_t instr) {
 }
 
 static void ASL(uint32_t instr) {
-  //istat[25]++;
   uint32_t d = instr & 077;
   uint32_t l = 2 - (instr >> 15);
   uint32_t msb = l == 2 ? 0x8000 : 0x80;
@@ -847,7 +879,6 @@ static void ASL(uint32_t instr) {
 }
 
 static void SXT(uint32_t instr) {
-  //istat[26]++;
   uint32_t d = instr & 077;
   uint32_t l = 2 - (instr >> 15);
   uint32_t da = aget(d, l);
@@ -862,7 +893,6 @@ static void SXT(uint32_t instr) {
 }
 
 static void JMP(uint32_t instr) {
-  //istat[27]++;
   uint32_t d = instr & 077;
   uint32_t uval = aget(d, 2);
   if (isReg(uval)) {
@@ -870,12 +900,11 @@ static void JMP(uint32_t instr) {
     //panic();
     longjmp(trapbuf, INTINVAL);
   }
-  R[7] = uval;
+  R[7] = uval & 0xFFFF;
   //Serial.printf("jmp %06o\r\n", uval);
 }
 
 static void SWAB(uint32_t instr) {
-  //istat[28]++;
   uint32_t d = instr & 077;
   uint32_t l = 2 - (instr >> 15);
   uint32_t da = aget(d, l);
@@ -890,14 +919,14 @@ static void SWAB(uint32_t instr) {
 }
 
 static void MARK(uint32_t instr) {
-  //istat[29]++;
   R[6] = R[7] + ((instr & 077) << 1);
   R[7] = R[5];
   R[5] = pop();
 }
 
-static void MFPI(uint32_t instr) {
-  //istat[30]++;
+// move from and to the previous mode's instruction space (MFPI, MTPI)
+// or data space (MFPD, MTPD)
+static void mfp(const uint32_t instr, const bool i) {
   uint32_t d = instr & 077;
   uint32_t da = aget(d, 2);
   uint32_t uval = 0;
@@ -916,7 +945,7 @@ static void MFPI(uint32_t instr) {
     Serial.println(F("invalid MFPI instruction"));
     longjmp(trapbuf, INTINVAL);
   } else {
-    uval = unibus::read16(mmu::decode((uint16_t)da, false, prevuser));
+    uval = unibus::read16(mmu::decode((uint16_t)da, false, prevuser, i));
   }
   push(uval);
   /* XXX STKL
@@ -934,8 +963,7 @@ static void MFPI(uint32_t instr) {
   }
 }
 
-static void MTPI(uint32_t instr) {
-  //istat[31]++;
+static void mtp(const uint32_t instr, const bool i) {
   uint32_t d = instr & 077;  // destination operand 
   uint32_t da = aget(d, 2); // destination address
   uint32_t uval = pop();
@@ -954,15 +982,30 @@ static void MTPI(uint32_t instr) {
     //longjmp(trapbuf, INTINVAL);
     R[da & 7] = uval;
   } else {
-    unibus::write16(mmu::decode((uint16_t)da, true, prevuser), uval);
+    unibus::write16(mmu::decode((uint16_t)da, true, prevuser, i), uval);
   }
   PS.Word &= 0xFFF0;
   PS.Flags.Z = (uval == 0);
   PS.Flags.N = GET_SIGN_W(uval);
 }
 
+static void MFPI(uint32_t instr) {
+  mfp(instr, true);
+}
+
+static void MTPI(uint32_t instr) {
+  mtp(instr, true);
+}
+
+static void MFPD(const uint32_t instr) {
+  mfp(instr, false);
+}
+
+static void MTPD(const uint32_t instr) {
+  mtp(instr, false);
+}
+
 static void RTS(uint32_t instr) {
-  //istat[32]++;
   uint32_t d = instr & 077;
   R[7] = R[d & 7];
   R[d & 7] = pop();
@@ -970,7 +1013,6 @@ static void RTS(uint32_t instr) {
 }
 
 static void EMTX(uint32_t instr) {
-  //istat[33]++;
   uint32_t uval;
   if ((instr & 0177400) == 0104000) { // EMT
     uval = 030; // trap vector (PC), new PS is 032;
@@ -993,19 +1035,17 @@ static void EMTX(uint32_t instr) {
 }
 
 static void RTT(uint32_t instr) {
-  //istat[34]++;
   R[7] = pop();
   uint32_t uval = pop();
   if (curuser) {
     uval &= 047;
     uval |= PS.Word & 0177730;
   }
-  unibus::write16(0777776, uval);
+  unibus::write16(IOPAGE | 017776, uval); // PS
   //Serial.printf("rts %06o\r\n", R[7]);
 }
 
 static void RESET(uint32_t instr) {
-  //istat[35]++;
   if (curuser) {
     return;
   }
@@ -1014,24 +1054,252 @@ static void RESET(uint32_t instr) {
   dl11::reset();
   rk11::reset();
   tm11::reset();
+  dz11::reset();
+}
+
+static bool cond(const uint32_t instr) {
+  switch (instr & 0177400) {
+    case 0000400: return true;                                   // BR
+    case 0001000: return !PS.Flags.Z;                            // BNE
+    case 0001400: return PS.Flags.Z;                             // BEQ
+    case 0002000: return !(PS.Flags.N ^ PS.Flags.V);             // BGE
+    case 0002400: return PS.Flags.N ^ PS.Flags.V;                // BLT
+    case 0003000: return !(PS.Flags.Z || (PS.Flags.N ^ PS.Flags.V)); // BGT
+    case 0003400: return PS.Flags.Z || (PS.Flags.N ^ PS.Flags.V);    // BLE
+    case 0100000: return !PS.Flags.N;                            // BPL
+    case 0100400: return PS.Flags.N;                             // BMI
+    case 0101000: return !(PS.Flags.C || PS.Flags.Z);            // BHI
+    case 0101400: return PS.Flags.C || PS.Flags.Z;               // BLOS
+    case 0102000: return !PS.Flags.V;                            // BVC
+    case 0102400: return PS.Flags.V;                             // BVS
+    case 0103000: return !PS.Flags.C;                            // BCC
+    case 0103400: return PS.Flags.C;                             // BCS
+  }
+  return false;
+}
+
+static inline bool isbranch(const uint32_t instr) {
+  return ((instr & 0177400) >= 0000400 && (instr & 0177400) <= 0003400) ||
+         ((instr & 0177400) >= 0100000 && (instr & 0177400) <= 0103400);
+}
+
+// superinstructions. a fused handler runs a whole idiom in one dispatch
+// and leaves the machine exactly as the single steps would. it only
+// fires if nothing in between could fault or touch the io page, and
+// never runs past the next device deadline.
+MACHINE_STATE bool fusion = true;
+MACHINE_STATE uint32_t fused[FUSE_N];
+MACHINE_STATE uint32_t fusedinstr[FUSE_N];
+
+// the next instruction word, if it can be read without a fault
+static bool peek(const uint32_t a, uint32_t &v) {
+  uint32_t pa;
+  if (!mmu::probe(a, false, curuser, pa, true) || pa >= unibus::memsize) {
+    return false;
+  }
+  v = unibus::core16[pa >> 1];
+  return true;
+}
+
+static inline uint32_t budget() {
+  return sched::next > sched::icount ? sched::next - sched::icount : 0;
+}
+
+// count n executed instructions beyond the one step() counts
+static void account(const uint32_t f, const uint32_t n, const uint64_t ns) {
+  fused[f]++;
+  fusedinstr[f] += n + 1;
+  sched::icount += n;
+  if (INSTR_TIMING) {
+    kd11::cycles += ns;
+  }
+}
+
+// physical range of n words at virtual a, in core, not crossing a page
+static bool range(const uint32_t a, const uint32_t n, const bool w, uint32_t &pa) {
+  uint32_t last;
+  if ((a & 1) || !mmu::probe(a, w, curuser, pa) ||
+      !mmu::probe(a + (n - 1) * 2, w, curuser, last)) {
+    return false;
+  }
+  return last < unibus::memsize && last - pa == (n - 1) * 2;
+}
+
+static inline bool overlaps(const uint32_t a, const uint32_t an, const uint32_t b, const uint32_t bn) {
+  return a < b + bn && b < a + an;
+}
+
+// iterations of a loop of n instructions until the deadline, bounded by
+// the sob counter and the 8k pages of the operands
+static uint32_t iterations(const uint32_t c, const uint32_t n, const uint32_t a, const uint32_t b) {
+  uint32_t k = budget() / n;
+  k = min(k, R[c]);
+  k = min(k, (020000 - (a & 017777)) / 2);
+  k = min(k, (020000 - (b & 017777)) / 2);
+  return k;
+}
+
+// MOV (Rs)+,(Rd)+ ; SOB Rc,.-2
+static bool movsob(const uint32_t instr) {
+  uint32_t sob;
+  const uint32_t s = (instr >> 6) & 7;
+  const uint32_t d = instr & 7;
+  if (!peek(R[7], sob) || (sob & 0177077) != 0077002) {
+    return false;
+  }
+  const uint32_t c = (sob >> 6) & 7;
+  if (s == d || s == c || d == c || s > 5 || d > 5 || c > 5 || R[c] == 0) {
+    return false;
+  }
+  const uint32_t k = iterations(c, 2, R[s], R[d]);
+  uint32_t ps, pd, pc;
+  if (k < 2 || !range(R[s], k, false, ps) || !range(R[d], k, true, pd) ||
+      !mmu::probe(PC, false, curuser, pc, true) ||
+      overlaps(ps, k * 2, pd, k * 2) || overlaps(pc, 4, pd, k * 2)) {
+    return false;
+  }
+  mmu::decode(R[d], true, curuser); // the W bit of the page
+  unibus::copy16(pd, ps, k);
+  const uint32_t v = unibus::core16[(pd >> 1) + k - 1];
+  PS.Flags.N = (v & 0x8000) != 0;
+  PS.Flags.Z = v == 0;
+  PS.Flags.V = 0;
+  R[s] = (R[s] + 2 * k) & 0xFFFF; // a copy up to 0177776 wraps to 0
+  R[d] = (R[d] + 2 * k) & 0xFFFF;
+  R[c] -= k;
+  R[7] = R[c] ? PC : PC + 4;
+  account(FUSE_MOVSOB, 2 * k - 1, k * (kd11::time(instr) + kd11::time(sob)) - kd11::time(instr));
+  return true;
+}
+
+// CLR (Rd)+ ; SOB Rc,.-2
+static bool clrsob(const uint32_t instr) {
+  uint32_t sob;
+  const uint32_t d = instr & 7;
+  if (!peek(R[7], sob) || (sob & 0177077) != 0077002) {
+    return false;
+  }
+  const uint32_t c = (sob >> 6) & 7;
+  if (d == c || d > 5 || c > 5 || R[c] == 0) {
+    return false;
+  }
+  const uint32_t k = iterations(c, 2, R[d], R[d]);
+  uint32_t pd, pc;
+  if (k < 2 || !range(R[d], k, true, pd) || !mmu::probe(PC, false, curuser, pc, true) ||
+      overlaps(pc, 4, pd, k * 2)) {
+    return false;
+  }
+  mmu::decode(R[d], true, curuser);
+  unibus::fill16(pd, 0, k);
+  PS.Word = (PS.Word & ~017) | 004;
+  R[d] = (R[d] + 2 * k) & 0xFFFF;
+  R[c] -= k;
+  R[7] = R[c] ? PC : PC + 4;
+  account(FUSE_CLRSOB, 2 * k - 1, k * (kd11::time(instr) + kd11::time(sob)) - kd11::time(instr));
+  return true;
+}
+
+// TST/CMP followed by a branch: run the branch in the same dispatch. a
+// TST (Rn) or TST @#a polling loop, branching back to itself, is skipped
+// forward to the next device deadline, nothing it reads can change
+// before that.
+static void brfuse(const uint32_t f, const uint32_t instr) {
+  uint32_t br;
+  if (budget() < 2 || !peek(R[7], br) || !isbranch(br)) {
+    return;
+  }
+  R[7] += 2;
+  const uint32_t t = kd11::time(br);
+  if (!cond(br)) {
+    account(f, 1, t);
+    return;
+  }
+  branch(br & 0xFF);
+  if (f == FUSE_TSTBR && (R[7] & 0xFFFF) == PC && budget() > 4 &&
+      (((instr & 070) == 010 && (instr & 7) != 7) || (instr & 077) == 037)) {
+    const uint32_t m = (budget() - 1) / 2;
+    account(FUSE_TSTPOLL, 1 + 2 * m, t + m * (t + kd11::time(instr)));
+    return;
+  }
+  account(f, 1, t);
+}
+
+// the fusion candidates, the idiom is looked for at run time
+static void MOVX(const uint32_t instr) {
+  if ((instr & 0177070) == 0012020 && fusion && trace <= 0 && !tbuf::on && movsob(instr)) {
+    return;
+  }
+  MOV(instr);
+}
+
+static void CMPX(const uint32_t instr) {
+  CMP(instr);
+  if (fusion && trace <= 0 && !tbuf::on) {
+    brfuse(FUSE_CMPBR, instr);
+  }
+}
+
+static void CLRX(const uint32_t instr) {
+  if ((instr & 0177770) == 0005020 && fusion && trace <= 0 && !tbuf::on && clrsob(instr)) {
+    return;
+  }
+  CLR(instr);
+}
+
+static void TSTX(const uint32_t instr) {
+  TST(instr);
+  if (fusion && trace <= 0 && !tbuf::on) {
+    brfuse(FUSE_TSTBR, instr);
+  }
 }
 
+static void exec(uint32_t instr);
+
+// handlers indexed by the top ten bits of the instruction. every group
+// of 64 opcodes sharing a handler gets it directly, the mixed groups
+// (HALT .. RTT, RTS/SPL/CCs, MARK, undefined) decode through exec()
+static MACHINE_STATE bcache::handler dispatch[02000];
+
 #define PRINTSTATE 0
 void step() {
   PC = R[7];
-  const uint32_t instr = unibus::read16(mmu::decode(PC, false, curuser));
+  if (hle::enabled && !curuser && hle::hook(PC)) {
+    return;
+  }
+  const uint32_t instr = readi16(PC);
   R[7] += 2;
+  if (INSTR_TIMING) {
+    kd11::cycles += kd11::time(instr);
+  }
+  if constexpr (ENABLE_ISTAT) {
+    istat::count(instr, curuser);
+  }
+  if (tbuf::on) {
+    tbuf::insn(PC, instr);
+  }
   if (trace > 0 || PRINTSTATE) {
     trace--;
     print_state();
   }
+  dispatch[instr >> 6](instr);
+}
+
+uint32_t operand(const uint32_t v, const uint32_t l) {
+  return aget(v, l);
+}
 
+void execute(const uint32_t instr) {
+  dispatch[instr >> 6](instr);
+}
+
+// execute a fetched instruction, R7 points past the instruction word
+static void exec(const uint32_t instr) {
   switch (instr & 0070000) {
     case 0010000: // MOV
-      MOV(instr);
+      MOVX(instr);
       return;
     case 0020000: // CMP
-      CMP(instr);
+      CMPX(instr);
       return;
     case 0030000: // BIT
       BIT(instr);
@@ -1050,6 +1318,9 @@ void step() {
     case 0160000: // SUB
       SUB(instr);
       return;
+    case 0170000: // FP11
+      fp11::step(instr);
+      return;
   }
   switch (instr & 0177000) {
     case 0004000: // JSR
@@ -1076,7 +1347,7 @@ void step() {
   }
   switch (instr & 0077700) {
     case 0005000: // CLR
-      CLR(instr);
+      CLRX(instr);
       return;
     case 0005100: // COM
       COM(instr);
@@ -1097,7 +1368,7 @@ void step() {
       SBC(instr);
       return;
     case 0005700: // TST
-      TST(instr);
+      TSTX(instr);
       return;
     case 0006000: // ROR
       ROR(instr);
@@ -1131,86 +1402,27 @@ void step() {
     case 0006600: // MTPI
       MTPI(instr);
       return;
+    case 0106500: // MFPD
+      MFPD(instr);
+      return;
+    case 0106600: // MTPD
+      MTPD(instr);
+      return;
   }
   if ((instr & 0177770) == 0000200) { // RTS
     RTS(instr);
     return;
   }
+  if ((instr & 0177740) == 0075000) { // FADD FSUB FMUL FDIV
+    fp11::fis(instr);
+    return;
+  }
 
-  switch (instr & 0177400) { // 177400
-    case 0000400: // BR
-      branch(instr & 0xFF); 
-      return;
-    case 0001000: // BNE
-      if (!PS.Flags.Z) {
-        branch(instr & 0xFF);
-      }
-      return;
-    case 0001400: // BEQ
-      if (PS.Flags.Z) {
-        branch(instr & 0xFF);
-      }
-      return;
-    case 0002000: // BGE
-      if (!(PS.Flags.N ^ PS.Flags.V)) {
-        branch(instr & 0xFF);
-      }
-      return;
-    case 0002400: // BLT
-      if (PS.Flags.N ^ PS.Flags.V) { 
-        branch(instr & 0xFF);
-      }
-      return;
-    case 0003000: // BGT
-      if (!(PS.Flags.Z || (PS.Flags.N ^ PS.Flags.V ))) {
-        branch(instr & 0xFF);
-      }
-      return;
-    case 0003400: // BLE
-      if (PS.Flags.Z || (PS.Flags.N ^ PS.Flags.V)) {
-        branch(instr & 0xFF);
-      }
-      return;
-    case 0100000: // BPL
-      if (!PS.Flags.N) {
-        branch(instr & 0xFF);
-      }
-      return;
-    case 0100400: // BMI
-      if (PS.Flags.N) {
-        branch(instr & 0xFF);
-      }
-      return;
-    case 0101000: // BHI
-      if (!(PS.Flags.C || PS.Flags.Z))  {
-        branch(instr & 0xFF);
-      }
-      return;
-    case 0101400: // BLOS
-      if (PS.Flags.C || PS.Flags.Z) {
-        branch(instr & 0xFF);
-      }
-      return;
-    case 0102000: // BVC
-      if (!PS.Flags.V) {
-        branch(instr & 0xFF);
-      }
-      return;
-    case 0102400: // BVS
-      if (PS.Flags.V) {
-        branch(instr & 0xFF);
-      }
-      return;
-    case 0103000: // BCC
-      if (!PS.Flags.C) {
-        branch(instr & 0xFF);
-      }
-      return;
-    case 0103400: // BCS
-      if (PS.Flags.C) {
-        branch(instr & 0xFF);
-      }
-      return;
+  if (isbranch(instr)) {
+    if (cond(instr)) {
+      branch(instr & 0xFF);
+    }
+    return;
   }
   if (((instr & 0177000) == 0104000) || (instr == 3) || (instr == 4)) { // EMT TRAP IOT BPT
     EMTX(instr);
@@ -1236,6 +1448,7 @@ void step() {
       if (curuser) {
         break;
       }
+      sched::post(sched::WORK_WAIT);
       return;
     case 0000002: // RTI
     case 0000006: // RTT
@@ -1245,9 +1458,6 @@ void step() {
       RESET(instr);
       return;
   }
-  if (instr == 0170011) { // SETD ; not needed by UNIX, but used; therefore ignored
-    return;
-  }
 #ifdef INVLOG
   invlog.printf("invalid instruction: %06o: %06o\n", PC, instr);
   invlog.flush();
@@ -1256,6 +1466,373 @@ void step() {
   longjmp(trapbuf, INTINVAL);
 }
 
+static void BRANCH(const uint32_t instr) {
+  if (cond(instr)) {
+    branch(instr & 0xFF);
+  }
+}
+
+// the handler for instr, the common instructions go straight to their
+// handlers, everything else through exec()
+static bcache::handler decode(const uint32_t instr) {
+  switch (instr & 0170000) {
+    case 0010000: return MOVX;
+    case 0110000: return MOV;
+    case 0020000:
+    case 0120000: return CMPX;
+    case 0030000:
+    case 0130000: return BIT;
+    case 0040000:
+    case 0140000: return BIC;
+    case 0050000:
+    case 0150000: return BIS;
+    case 0060000: return ADD;
+    case 0160000: return SUB;
+    case 0170000: return fp11::step;
+  }
+  switch (instr & 0177000) {
+    case 0004000: return JSR;
+    case 0070000: return MUL;
+    case 0071000: return DIV;
+    case 0072000: return ASH;
+    case 0073000: return ASHC;
+    case 0074000: return XOR;
+    case 0077000: return SOB;
+    case 0104000: return EMTX;
+  }
+  switch (instr & 0077700) {
+    case 0005000: return CLRX;
+    case 0005100: return COM;
+    case 0005200: return INC;
+    case 0005300: return _DEC;
+    case 0005400: return NEG;
+    case 0005500: return ADC;
+    case 0005600: return SBC;
+    case 0005700: return TSTX;
+    case 0006000: return ROR;
+    case 0006100: return ROL;
+    case 0006200: return ASR;
+    case 0006300: return ASL;
+    case 0006700: return SXT;
+  }
+  switch (instr & 0177700) {
+    case 0000100: return JMP;
+    case 0000300: return SWAB;
+    case 0006500: return MFPI;
+    case 0006600: return MTPI;
+    case 0106500: return MFPD;
+    case 0106600: return MTPD;
+  }
+  if ((instr & 0177770) == 0000200) {
+    return RTS;
+  }
+  if (isbranch(instr)) {
+    return BRANCH;
+  }
+  return exec;
+}
+
+static void build_dispatch() {
+  for (uint32_t i = 0; i < 02000; i++) {
+    bcache::handler fn = decode(i << 6);
+    for (uint32_t j = 1; j < 0100; j++) {
+      if (decode((i << 6) | j) != fn) {
+        fn = exec;
+        break;
+      }
+    }
+    dispatch[i] = fn;
+  }
+}
+
+// instruction length from the operand modes, a wrong guess only ends
+// the block early
+static uint32_t length(const uint32_t instr) {
+  uint32_t n = 2;
+  if (instr < 0000400 && (instr & 0177700) != 0000100 && (instr & 0177700) != 0000300) {
+    return n;
+  }
+  const uint32_t d = instr & 077;
+  if ((d & 060) == 060 || d == 027 || d == 037) {
+    n += 2;
+  }
+  if ((instr & 0070000) && (instr & 0070000) != 0070000) { // double operand
+    const uint32_t s = (instr >> 6) & 077;
+    if ((s & 060) == 060 || s == 027 || s == 037) {
+      n += 2;
+    }
+  }
+  return n;
+}
+
+// instructions that leave the straight line
+static bool ends(const uint32_t instr) {
+  return isbranch(instr) || instr < 0000010 || (instr & 0177000) == 0077000 ||
+         (instr & 0177700) == 0000100 || (instr & 0177000) == 0004000 ||
+         (instr & 0177770) == 0000200 || (instr & 0177000) == 0104000 ||
+         (instr & 0177700) == 0006400;
+}
+
+static void build(bcache::block *b, const uint32_t pa) {
+  const uint32_t end = (pa & ~077) + 0100;
+  uint32_t a = pa;
+  b->n = 0;
+  while (b->n < BC_OPS && a < end) {
+    const uint32_t instr = unibus::core16[a >> 1];
+    const uint32_t len = length(instr);
+    bcache::op &o = b->ops[b->n++];
+    o.fn = dispatch[instr >> 6];
+    o.instr = instr;
+    o.len = len;
+    o.ns = kd11::time(instr);
+    a += len;
+    if (ends(instr)) {
+      break;
+    }
+  }
+  b->pa = pa;
+#if BC_JIT
+  b->code = nullptr;
+  b->key = UINT32_MAX;
+#endif
+  bcache::mark(pa);
+}
+
+// compare the ops of a block that just ran with core and a fresh decode
+static void check(const bcache::block *b, const uint32_t pa, const uint32_t n) {
+  uint32_t a = pa;
+  for (uint32_t i = 0; i < n; i++) {
+    const bcache::op &o = b->ops[i];
+    const uint32_t instr = unibus::core16[a >> 1];
+    if (instr != o.instr || dispatch[instr >> 6] != o.fn) {
+      bcache::mismatches++;
+      Serial.printf("bcache: %06o: cached %06o, core %06o\r\n", a, o.instr, instr);
+      bcache::flush();
+      return;
+    }
+    a += o.len;
+  }
+}
+
+// what the instructions change besides core, for the lockstep verify:
+// the cpu, the fp11 and the mmu. the counters are only put back, the
+// rest is compared.
+struct regs {
+  uint32_t R[8];
+  uint32_t PS, KSP, USP;
+  bool curuser, prevuser;
+  uint64_t icount, cycles;
+  uint32_t traps;
+  uint32_t fused[FUSE_N], fusedinstr[FUSE_N];
+  double AC[6];
+  uint32_t FPS, FEC, FEA;
+  mmu::page pages[64];
+  uint16_t SR0, SR1, SR2, SR3;
+};
+
+static void save(regs &s) {
+  memcpy(s.R, R, sizeof(R));
+  s.PS = PS.Word;
+  s.KSP = KSP;
+  s.USP = USP;
+  s.curuser = curuser;
+  s.prevuser = prevuser;
+  s.icount = sched::icount;
+  s.cycles = kd11::cycles;
+  s.traps = traps;
+  memcpy(s.fused, fused, sizeof(fused));
+  memcpy(s.fusedinstr, fusedinstr, sizeof(fusedinstr));
+  memcpy(s.AC, fp11::AC, sizeof(fp11::AC));
+  s.FPS = fp11::FPS;
+  s.FEC = fp11::FEC;
+  s.FEA = fp11::FEA;
+  memcpy(s.pages, mmu::pages, sizeof(mmu::pages));
+  s.SR0 = mmu::SR0;
+  s.SR1 = mmu::SR1;
+  s.SR2 = mmu::SR2;
+  s.SR3 = mmu::SR3;
+}
+
+static void load(const regs &s) {
+  memcpy(R, s.R, sizeof(R));
+  PS.Word = s.PS;
+  KSP = s.KSP;
+  USP = s.USP;
+  curuser = s.curuser;
+  prevuser = s.prevuser;
+  sched::icount = s.icount;
+  kd11::cycles = s.cycles;
+  traps = s.traps;
+  memcpy(fused, s.fused, sizeof(fused));
+  memcpy(fusedinstr, s.fusedinstr, sizeof(fusedinstr));
+  memcpy(fp11::AC, s.AC, sizeof(fp11::AC));
+  fp11::FPS = s.FPS;
+  fp11::FEC = s.FEC;
+  fp11::FEA = s.FEA;
+  memcpy(mmu::pages, s.pages, sizeof(mmu::pages));
+  mmu::SR0 = s.SR0;
+  mmu::SR1 = s.SR1;
+  mmu::SR2 = s.SR2;
+  mmu::setsr3(s.SR3);
+}
+
+static bool same(const char *what, const uint32_t b, const uint32_t i) {
+  if (b != i) {
+    Serial.printf("bcache: %s: block %06o, interpreter %06o\r\n", what, b, i);
+  }
+  return b == i;
+}
+
+static bool same(const regs &b, const regs &i) {
+  static const char *const names[8] = { "R0", "R1", "R2", "R3", "R4", "R5", "SP", "PC" };
+  bool ok = true;
+  for (uint32_t r = 0; r < 8; r++) {
+    ok &= same(names[r], b.R[r], i.R[r]);
+  }
+  ok &= same("PS", b.PS, i.PS);
+  ok &= same("KSP", b.KSP, i.KSP);
+  ok &= same("USP", b.USP, i.USP);
+  ok &= same("mode", b.curuser << 1 | b.prevuser, i.curuser << 1 | i.prevuser);
+  ok &= same("instructions", b.icount, i.icount);
+  ok &= same("FPS", b.FPS, i.FPS);
+  ok &= same("SR0", b.SR0, i.SR0);
+  ok &= same("SR3", b.SR3, i.SR3);
+  if (memcmp(b.AC, i.AC, sizeof(b.AC))) {
+    Serial.printf("bcache: the fp11 accumulators differ\r\n");
+    ok = false;
+  }
+  if (memcmp(b.pages, i.pages, sizeof(b.pages))) {
+    Serial.printf("bcache: the mmu pages differ\r\n");
+    ok = false;
+  }
+  return ok;
+}
+
+// run the n instructions of the block at pa again in the interpreter,
+// from the state s0 before the block and with its core writes rolled
+// back, and compare the two runs. the interpreter fetches through the
+// mmu where the block used its cached ops.
+static void lockstep(const regs &s0, const uint32_t pa, const uint32_t n, const uint32_t last) {
+  if (!bcache::logging || !bcache::replayable || n == 0 || last <= 1 || last == 5) { // HALT WAIT RESET
+    bcache::logging = false;
+    bcache::skipped++;
+    return;
+  }
+  regs sb, si;
+  save(sb);
+  bcache::rollback();
+  const uint32_t nb = bcache::nlog;
+  bcache::undo wrote[BC_LOG];
+  memcpy(wrote, bcache::journal, nb * sizeof(bcache::undo));
+  load(s0);
+  bcache::begin();
+  for (uint32_t k = 0; k < n; k++) {
+    PC = R[7];
+    const uint32_t instr = readi16(PC);
+    R[7] += 2;
+    if (INSTR_TIMING) {
+      kd11::cycles += kd11::time(instr);
+    }
+    dispatch[instr >> 6](instr);
+    sched::icount++;
+  }
+  bcache::logging = false;
+  bcache::verified++;
+  save(si);
+  bool ok = same(sb, si);
+  for (uint32_t j = 0; j < nb; j++) {
+    const uint32_t v = unibus::core16[wrote[j].pa >> 1];
+    if (v != wrote[j].now) {
+      Serial.printf("bcache: %06o: block %06o, interpreter %06o\r\n", wrote[j].pa, wrote[j].now, v);
+      ok = false;
+    }
+  }
+  for (uint32_t j = 0; j < bcache::nlog; j++) {
+    const bcache::undo &u = bcache::journal[j];
+    const uint32_t v = unibus::core16[u.pa >> 1];
+    bool in = false;
+    for (uint32_t k = 0; k < nb; k++) {
+      in |= wrote[k].pa == u.pa;
+    }
+    if (!in && v != u.old) {
+      Serial.printf("bcache: %06o: block %06o, interpreter %06o\r\n", u.pa, u.old, v);
+      ok = false;
+    }
+  }
+  if (!ok) {
+    bcache::mismatches++;
+    Serial.printf("bcache: %06o: the block of %u instructions and the interpreter differ\r\n", pa, n);
+    bcache::flush();
+  }
+}
+
+// run instructions from a predecoded block until it ends, the control
+// flow leaves it, or the main loop has to look at the machine. on the
+// host the compiled code of the block runs first and the handlers go on
+// where it left. with verify the interpreter runs it again, its result
+// stays.
+void run() {
+  PC = R[7];
+  if (hle::enabled && !curuser && hle::hook(PC)) {
+    sched::icount++;
+    return;
+  }
+  const uint32_t pa = mmu::decode(PC, false, curuser, true);
+  if (pa >= unibus::memsize || trace > 0) {
+    step();
+    sched::icount++;
+    return;
+  }
+  bcache::block *b = bcache::slot(pa);
+  if (b->pa != pa || b->n == 0) {
+    bcache::misses++;
+    build(b, pa);
+  } else {
+    bcache::hits++;
+  }
+  const uint32_t gen = bcache::gen;
+  regs s0;
+  if (bcache::verify) {
+    save(s0);
+    bcache::begin();
+  }
+  uint32_t i = 0;
+  bool stop = false;
+#if BC_JIT
+  if (jit::enabled && fusion && !tbuf::on && !ENABLE_ISTAT) {
+    i = jit::run(b);
+    stop = i & JIT_STOP;
+    i &= ~JIT_STOP;
+  }
+#endif
+  while (!stop && i < b->n) {
+    const bcache::op &o = b->ops[i++];
+    PC = R[7];
+    R[7] += 2;
+    if (INSTR_TIMING) {
+      kd11::cycles += o.ns;
+    }
+    if constexpr (ENABLE_ISTAT) {
+      istat::count(o.instr, curuser);
+    }
+    if (tbuf::on) {
+      tbuf::insn(PC, o.instr);
+    }
+    o.fn(o.instr);
+    sched::icount++;
+    if (R[7] != PC + o.len || gen != bcache::gen || irqpending() ||
+        sched::icount >= sched::next || sched::work) {
+      break;
+    }
+  }
+  if (bcache::verify) {
+    if (gen == bcache::gen) {
+      check(b, pa, i);
+    }
+    lockstep(s0, pa, i, i ? b->ops[i - 1].instr : 0);
+  }
+}
+
 void trapat(const uint16_t vec) { // , msg string) {
   if (vec & 1) {
     Serial.println(F("trapat() with an odd vector number?"));
@@ -1263,6 +1840,13 @@ void trapat(const uint16_t vec) { // , msg string) {
   }
   yield();
   //Serial.print(F("trap: ")); Serial.println(vec, OCT);
+  traps++;
+  if (tbuf::on) {
+    tbuf::trap(vec, false);
+  }
+  if (INSTR_TIMING) {
+    kd11::cycles += KD11_TRAP;
+  }
 
   uint16_t prev = PS.Word;
   switchmode(false);
@@ -1276,71 +1860,59 @@ void trapat(const uint16_t vec) { // , msg string) {
   }
 }
 
-void interrupt(const uint8_t vec, const uint8_t pri) {
+void interrupt(const uint16_t vec, const uint8_t pri) {
   //yield();
-  if (vec & 1) {
-    Serial.printf("interrupt vector is odd: %06o\r\n", vec);
+  if ((vec & 3) || (vec > 0774)) {
+    Serial.printf("interrupt vector is invalid: %06o\r\n", vec);
     panic();
   }
+  // raising a pending vector again is a no-op, like a device
+  // holding its request line
   __disable_irq();
-  // fast path
-  if (itab[0].vec == 0) {
-    itab[0].vec = vec;
-    itab[0].pri = pri;
-    __enable_irq();
-    return;
-  }
-  uint8_t i;
-  for (i = 0; i < ITABN; i++) {
-    if ((itab[i].vec == 0) || (itab[i].pri < pri)) {
-      break;
-    }
-  }
-  for (; i < ITABN; i++) {
-    if ((itab[i].vec == 0) || (itab[i].vec >= vec)) {
-      break;
-    }
-  }
-  if (i >= ITABN) {
-    Serial.println(F("interrupt table full")); 
-    for (int i = 0; i < ITABN; i++) {
-      Serial.printf("itab[%d] vec: %d, pri: %d\r\n", i, itab[i].vec, itab[i].pri);
-    }
-    __enable_irq();
-    panic();
-  }
-  for (int j = i + 1; j < ITABN; j++) {
-    itab[j] = itab[j - 1];
-  }
-  itab[i].vec = vec;
-  itab[i].pri = pri;
+  itab.vecs[pri][vec >> 7] |= 1 << ((vec >> 2) & 31);
+  itab.pri |= 1 << pri;
+  irqlevel = 32 - __builtin_clz(itab.pri);
   __enable_irq();
 }
 
-// pop the top interrupt off the itab.
-static void popirq() {
+// take the highest priority, lowest vector interrupt off the itab.
+static uint32_t popirq() {
   __disable_irq();
-  for (int i = 0; i < ITABN - 1; i++) {
-    itab[i] = itab[i + 1];
+  if (itab.pri == 0) {
+    __enable_irq();
+    return 0;
   }
-  itab[ITABN - 1].vec = 0;
-  itab[ITABN - 1].pri = 0;
+  const uint32_t pri = 31 - __builtin_clz(itab.pri);
+  uint32_t *vecs = itab.vecs[pri];
+  uint32_t i = 0;
+  while (vecs[i] == 0) {
+    i++;
+  }
+  const uint32_t bit = __builtin_ctz(vecs[i]);
+  vecs[i] &= ~(1 << bit);
+  if ((vecs[0] | vecs[1] | vecs[2] | vecs[3]) == 0) {
+    itab.pri &= ~(1 << pri);
+  }
+  irqlevel = itab.pri ? 32 - __builtin_clz(itab.pri) : 0;
   __enable_irq();
+  return (i << 7) | (bit << 2);
 }
 
 void handleinterrupt() {
-  __disable_irq();
-  const uint32_t vec = itab[0].vec;
-  if (DEBUG_INTER && vec != 0100) {
-    for (int i = 0; i < ITABN; i++) {
-      Serial.printf("%x: %03o/%1o, ", i, itab[i].vec, itab[i].pri);
-      if (i == 7) {
-        Serial.println();
-      }
+  if (DEBUG_INTER && !(itab.pri == (1 << 6) && itab.vecs[6][0] == (1 << (INTCLOCK >> 2)))) {
+    for (int i = 7; i >= 0; i--) {
+      Serial.printf("%1o: %08x %08x %08x %08x\r\n", i, itab.vecs[i][3], itab.vecs[i][2], itab.vecs[i][1], itab.vecs[i][0]);
     }
-    Serial.println();
   }
-  __enable_irq();
+  const uint32_t vec = popirq();
+  sched::clear(sched::WORK_WAIT);
+  interrupts++;
+  if (tbuf::on) {
+    tbuf::trap(vec, true);
+  }
+  if (INSTR_TIMING) {
+    kd11::cycles += KD11_TRAP;
+  }
   const uint32_t trapvec = setjmp(trapbuf);
   if (trapvec == 0) {
     uint32_t prev = PS.Word;
@@ -1356,7 +1928,24 @@ void handleinterrupt() {
   if (prevuser) {
     PS.Word |= (1 << 13) | (1 << 12);
   }
-  popirq();
+}
+
+// the registers of both modes and the pending interrupts
+void snapshot(snap::io &s) {
+  s(R);
+  s(PS);
+  s(PC);
+  s(lastPC);
+  s(KSP);
+  s(USP);
+  s(LKS);
+  s(curuser);
+  s(prevuser);
+  s(itab);
+  s(irqlevel);
+  if (s.load) {
+    build_dispatch(); // a restore at the first prompt comes before reset()
+  }
 }
 
 };
@@ -1,17 +1,19 @@
+#pragma once
+
+#include <pdp11.h>
 #include <setjmp.h>
 
-extern jmp_buf trapbuf;
+extern MACHINE_STATE jmp_buf trapbuf;
 
 namespace pdp11 {
-struct intr {
-  uint32_t vec;
-  uint32_t pri;
+// pending interrupts, a bitmap of vectors (vec >> 2) per priority level
+struct irqs {
+  uint32_t vecs[8][4];
+  uint32_t pri; // bitmap of levels with pending vectors
 };
 };
 
-#define ITABN 32
-
-extern pdp11::intr itab[ITABN];
+extern MACHINE_STATE pdp11::irqs itab;
 
 typedef union {
   struct {
@@ -31,24 +33,54 @@ typedef union {
 
 namespace cpu {
 
-extern uint32_t R[8];
+extern MACHINE_STATE uint32_t R[8];
+
+extern MACHINE_STATE PSW PS;
+extern MACHINE_STATE uint32_t PC;
+extern MACHINE_STATE uint32_t USP;
+extern MACHINE_STATE uint32_t KSP;
+extern MACHINE_STATE uint32_t LKS;
+extern MACHINE_STATE bool curuser;
+extern MACHINE_STATE bool prevuser;
+extern MACHINE_STATE bool g_cmd;
+// highest pending interrupt priority + 1, 0 if none is pending
+extern MACHINE_STATE volatile uint32_t irqlevel;
+// traps and interrupts taken since power on
+extern MACHINE_STATE uint32_t traps;
+extern MACHINE_STATE uint32_t interrupts;
 
-extern PSW PS;
-extern uint32_t PC;
-extern uint32_t USP;
-extern uint32_t KSP;
-extern uint32_t LKS;
-extern bool curuser;
-extern bool prevuser;
-extern bool g_cmd;
+// fused instruction sequences
+enum {
+  FUSE_MOVSOB,  // MOV (Rs)+,(Rd)+ ; SOB
+  FUSE_CLRSOB,  // CLR (Rd)+ ; SOB
+  FUSE_TSTBR,   // TST ; Bxx
+  FUSE_TSTPOLL, // TST (Rn) ; Bxx .-2 device poll
+  FUSE_CMPBR,   // CMP ; Bxx
+  FUSE_N
+};
+extern MACHINE_STATE bool fusion;
+extern MACHINE_STATE uint32_t fused[FUSE_N];      // times fired
+extern MACHINE_STATE uint32_t fusedinstr[FUSE_N]; // instructions covered
 
 void print_stats();
 void step();
+void run();
 void reset(void);
+void snapshot(snap::io &s);
 void switchmode(bool newm);
 
+// the inner paths for ubench: the address of operand mode v for an
+// access of l bytes, and the handler of a fetched instruction
+uint32_t operand(uint32_t v, uint32_t l);
+void execute(uint32_t instr);
+
 void trapat(uint16_t vec);
-void interrupt(uint8_t vec, uint8_t pri);
+void interrupt(uint16_t vec, uint8_t pri);
 void handleinterrupt();
 
+// a single load, safe against interrupts raised from the clock isr
+static inline bool irqpending() {
+  return irqlevel > ((PS.Word >> 5) & 7);
+}
+
 };
@@ -17,6 +17,7 @@ enum {
   NN = 1 << 3,
   RR = 1 << 4,
   O = 1 << 5,
+  AC = 1 << 6,
 };
 
 const char *Reg[] = {
@@ -24,6 +25,33 @@ const char *Reg[] = {
 };
 
 instr table[] = {
+    { 0177400, "LDCDF", 1, AC|SF },
+    { 0177000, "LDCIF", 1, AC|SF },
+    { 0176400, "LDEXP", 1, AC|SF },
+    { 0176000, "STCFD", 1, AC|DF },
+    { 0175400, "STCFI", 1, AC|DF },
+    { 0175000, "STEXP", 1, AC|DF },
+    { 0174400, "DIVF",  2, AC|SF },
+    { 0174000, "STF",   3, AC|DF },
+    { 0173400, "CMPF",  2, AC|SF },
+    { 0173000, "SUBF",  2, AC|SF },
+    { 0172400, "LDF",   3, AC|SF },
+    { 0172000, "ADDF",  2, AC|SF },
+    { 0171400, "MODF",  2, AC|SF },
+    { 0171000, "MULF",  2, AC|SF },
+    { 0170700, "NEGF",  2, DF },
+    { 0170600, "ABSF",  2, DF },
+    { 0170500, "TSTF",  2, DF },
+    { 0170400, "CLRF",  2, DF },
+    { 0170300, "STST",  2, DF },
+    { 0170200, "STFPS", 1, DF },
+    { 0170100, "LDFPS", 1, DF },
+    { 0170012, "SETL",  2, 0 },
+    { 0170011, "SETD",  2, 0 },
+    { 0170002, "SETI",  2, 0 },
+    { 0170001, "SETF",  2, 0 },
+    { 0170000, "CFCC",  2, 0 },
+
     { 0160000, "SUB",   2, SF|DF },
     { 0150000, "BISB",  1, SF|DF },
     { 0140000, "BICB",  1, SF|DF },
@@ -74,6 +102,8 @@ instr table[] = {
     { 0010000, "MOV",   2, SF|DF },
 
     { 0006700, "SXT",   2, DF },
+    { 0106600, "MTPD",  1, DF },
+    { 0106500, "MFPD",  1, DF },
     { 0006600, "MTPI",  1, DF },
     { 0006500, "MFPI",  1, DF }, // was SF
     { 0006400, "MARK",  1, NN },
@@ -126,6 +156,17 @@ instr table[] = {
     { 0177777, "ILL?",  0, 0 },
 };
 
+// the mnemonic of an instruction word, for the trace buffer
+const char *mnemonic(const uint16_t opcode) {
+  instr *p;
+  for (p = &table[0]; p->mask != 0177777; p++) {
+    if ((opcode & p->mask) == p->mask) {
+      break;
+    }
+  }
+  return p->mnemonic;
+}
+
 const char *space(uint8_t n) {
   switch (n) {
     case 1:
@@ -160,7 +201,7 @@ void print_state() {
   Serial.printf("R5 %06o ", uint16_t(cpu::R[5]));
   Serial.printf("R6 %06o ", uint16_t(cpu::R[6]));
   Serial.printf("R7 %06o ", uint16_t(cpu::R[7]));
-  disasm(mmu::decode(cpu::PC, false, cpu::curuser));  
+  disasm(mmu::decode(cpu::PC, false, cpu::curuser, true));  
 }
 
 uint32_t disasmaddr(uint16_t m, uint32_t a) {
@@ -275,6 +316,17 @@ uint32_t disasm(uint32_t a) {
         Serial.print(' ');
         Serial.print(Reg[opcode & 7]);
         break;
+      case AC|SF:
+        ss = opcode & 077;
+        Serial.print(' ');
+        next += disasmaddr(ss, a);
+        Serial.printf(", AC%d", (opcode >> 6) & 3);
+        break;
+      case AC|DF:
+        dd = opcode & 077;
+        Serial.printf(" AC%d, ", (opcode >> 6) & 3);
+        next += disasmaddr(dd, a);
+        break;
       case NN:
         nn = opcode & 0377;
         Serial.printf(" %03o", nn);
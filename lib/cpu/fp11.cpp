@@ -0,0 +1,662 @@
+#include <Arduino.h>
+#include <math.h>
+#include <pdp11.h>
+#include "cpu.h"
+#include "mmu.h"
+#include "unibus.h"
+#include "fp11.h"
+#include "snap.h"
+
+namespace fp11 {
+
+MACHINE_STATE double AC[6];
+MACHINE_STATE uint32_t FPS;
+MACHINE_STATE uint32_t FEC;
+MACHINE_STATE uint32_t FEA;
+
+using cpu::R;
+
+// faddr tags the instruction stream, index words and immediates, with
+// ISPACE. with split I/D space they go through the I pages. the tag is
+// above the carry of a data address plus the words of an operand.
+#define ISPACE 01000000
+
+static uint16_t read16(const uint32_t a) {
+  return unibus::read16(mmu::decode(a, false, cpu::curuser, a & ISPACE));
+}
+
+static void write16(const uint32_t a, const uint32_t v) {
+  unibus::write16(mmu::decode(a, true, cpu::curuser, a & ISPACE), v);
+}
+
+void reset() {
+  for (int i = 0; i < 6; i++) {
+    AC[i] = 0;
+  }
+  FPS = 0;
+  FEC = 0;
+  FEA = 0;
+}
+
+// floating exception. op code errors and division by zero always trap,
+// the others only if enabled in the FPS. FID suppresses the trap.
+static void fpexc(const uint32_t code) {
+  static const uint32_t enable[] = { 0, 0, 0, FPS_IC, FPS_IV, FPS_IU, FPS_IUV };
+  if (code >= FEC_ICVT && !(FPS & enable[code >> 1])) {
+    return;
+  }
+  FPS |= FPS_ER;
+  FEC = code;
+  FEA = cpu::PC;
+  if (!(FPS & FPS_ID)) {
+    longjmp(trapbuf, INTFP);
+  }
+}
+
+// operand address for mode/reg, len bytes. register mode is handled by
+// the callers, immediate mode reads a single word.
+static uint32_t faddr(const uint32_t m, uint32_t len) {
+  const uint32_t r = m & 7;
+  uint32_t addr = 0;
+  if (r == 7 && (m & 070) == 020) {
+    len = 2;
+  }
+  switch (m & 070) {
+    case 010:
+      addr = R[r] & 0xFFFF;
+      break;
+    case 020:
+      addr = r == 7 ? R[r] | ISPACE : R[r] & 0xFFFF;
+      R[r] = (R[r] + len) & 0xFFFF;
+      break;
+    case 030:
+      addr = read16(r == 7 ? R[r] | ISPACE : R[r]);
+      R[r] = (R[r] + 2) & 0xFFFF;
+      break;
+    case 040:
+      R[r] = (R[r] - len) & 0xFFFF;
+      addr = R[r];
+      break;
+    case 050:
+      R[r] = (R[r] - 2) & 0xFFFF;
+      addr = read16(R[r]);
+      break;
+    case 060:
+    case 070:
+      addr = read16(R[7] | ISPACE);
+      R[7] = (R[7] + 2) & 0xFFFF;
+      addr = (addr + R[r]) & 0xFFFF;
+      if (m & 010) {
+        addr = read16(addr);
+      }
+      break;
+  }
+  return addr;
+}
+
+static inline bool immediate(const uint32_t m) {
+  return m == 027;
+}
+
+// PDP-11 F/D to host: 0.1fff * 2^(exp - 128), exp 0 is zero
+static double unpack(const uint16_t *w, const uint32_t n) {
+  const uint32_t exp = (w[0] >> 7) & 0377;
+  if (exp == 0) {
+    if (w[0] & 0x8000) {
+      fpexc(FEC_UNDEF); // -0, the undefined variable
+    }
+    return 0;
+  }
+  uint64_t frac = (uint64_t)((w[0] & 0177) | 0200) << 48 | (uint64_t)w[1] << 32;
+  if (n == 4) {
+    // the 3 bits a double has no room for are dropped, rounded they
+    // could carry the largest D out of the range
+    frac |= (uint64_t)w[2] << 16 | (w[3] & ~7);
+  }
+  const double v = ldexp((double)frac, (int)exp - 128 - 56);
+  return (w[0] & 0x8000) ? -v : v;
+}
+
+// host to PDP-11 F (n = 2) or D (n = 4), F is rounded unless chop.
+// returns 0 or the exception code, overflow and underflow store an
+// exact zero.
+static uint32_t pack(const double v, uint16_t *w, const uint32_t n, const bool chop = FPS & FPS_T) {
+  for (uint32_t i = 0; i < n; i++) {
+    w[i] = 0;
+  }
+  if (v == 0) {
+    return 0;
+  }
+  if (!isfinite(v)) {
+    return FEC_OVFL;
+  }
+  int e;
+  const double m = frexp(fabs(v), &e);
+  const int bits = n == 2 ? 24 : 56;
+  uint64_t frac;
+  if (n == 2 && !chop) {
+    frac = (uint64_t)floor(ldexp(m, bits) + 0.5);
+    if (frac >> bits) {
+      frac >>= 1;
+      e++;
+    }
+  } else {
+    frac = (uint64_t)ldexp(m, bits);
+  }
+  const int exp = e + 128;
+  if (exp > 0377) {
+    return FEC_OVFL;
+  }
+  if (exp < 1) {
+    return FEC_UNFL;
+  }
+  frac <<= 56 - bits;
+  w[0] = (v < 0 ? 0x8000 : 0) | exp << 7 | ((frac >> 48) & 0177);
+  w[1] = (frac >> 32) & 0xFFFF;
+  if (n == 4) {
+    w[2] = (frac >> 16) & 0xFFFF;
+    w[3] = frac & 0xFFFF;
+  }
+  return 0;
+}
+
+// round to the current precision and check the range
+static uint32_t fround(double &v) {
+  uint16_t w[4];
+  const uint32_t n = (FPS & FPS_D) ? 4 : 2;
+  const uint32_t err = pack(v, w, n);
+  if (err == 0 && n == 2) {
+    v = unpack(w, n);
+  } else if (err) {
+    v = 0;
+  }
+  return err;
+}
+
+static void setcc(const double v) {
+  FPS &= ~(FPS_N | FPS_Z | FPS_V | FPS_C);
+  if (v < 0) {
+    FPS |= FPS_N;
+  }
+  if (v == 0) {
+    FPS |= FPS_Z;
+  }
+}
+
+// the fpp condition codes to the cpu, for the integer stores
+static void copycc() {
+  cpu::PS.Word = (cpu::PS.Word & ~017) | (FPS & 017);
+}
+
+// fsrc/fdst: mode 0 is an accumulator, AC6 and AC7 do not exist
+static double *acreg(const uint32_t m) {
+  if ((m & 7) > 5) {
+    fpexc(FEC_OPCODE);
+  }
+  return &AC[m & 7];
+}
+
+static double getf(const uint32_t m, const uint32_t n) {
+  if ((m & 070) == 0) {
+    return *acreg(m);
+  }
+  uint16_t w[4] = { 0, 0, 0, 0 };
+  const uint32_t a = faddr(m, n * 2);
+  if (immediate(m)) {
+    w[0] = read16(a);
+  } else {
+    for (uint32_t i = 0; i < n; i++) {
+      w[i] = read16(a + i * 2);
+    }
+  }
+  return unpack(w, n);
+}
+
+// store, the value is already rounded to the destination precision
+static void putf(const uint32_t m, const uint32_t n, const double v) {
+  if ((m & 070) == 0) {
+    *acreg(m) = v;
+    return;
+  }
+  uint16_t w[4];
+  pack(v, w, n);
+  const uint32_t a = faddr(m, n * 2);
+  const uint32_t k = immediate(m) ? 1 : n;
+  for (uint32_t i = 0; i < k; i++) {
+    write16(a + i * 2, w[i]);
+  }
+}
+
+// integer source, 16 bit or with FL 32 bit
+static int32_t geti(const uint32_t m, const bool l) {
+  if ((m & 070) == 0) {
+    return l ? (int32_t)(R[m & 7] << 16) : (int16_t)R[m & 7];
+  }
+  const uint32_t a = faddr(m, l ? 4 : 2);
+  if (!l || immediate(m)) {
+    const int32_t v = (int16_t)read16(a);
+    return l ? v << 16 : v;
+  }
+  return (int32_t)((uint32_t)read16(a) << 16 | read16(a + 2));
+}
+
+static void puti(const uint32_t m, const bool l, const int32_t v) {
+  if ((m & 070) == 0) {
+    R[m & 7] = (l ? v >> 16 : v) & 0xFFFF;
+    return;
+  }
+  const uint32_t a = faddr(m, l ? 4 : 2);
+  if (!l || immediate(m)) {
+    write16(a, (l ? v >> 16 : v) & 0xFFFF);
+    return;
+  }
+  write16(a, (v >> 16) & 0xFFFF);
+  write16(a + 2, v & 0xFFFF);
+}
+
+// general word operand for LDFPS/STFPS/STST
+static uint32_t wordaddr(const uint32_t m) {
+  return faddr(m, 2);
+}
+
+// the result goes to the accumulator first, the trap comes after the store
+static void result(double &ac, double v) {
+  const uint32_t err = fround(v);
+  ac = v;
+  setcc(v);
+  if (err == FEC_OVFL) {
+    FPS |= FPS_V;
+  }
+  if (err) {
+    fpexc(err);
+  }
+}
+
+static void misc(const uint32_t instr) {
+  const uint32_t m = instr & 077;
+  switch (instr & 0300) {
+    case 0000:
+      switch (instr) {
+        case 0170000: // CFCC
+          copycc();
+          return;
+        case 0170001: // SETF
+          FPS &= ~FPS_D;
+          return;
+        case 0170002: // SETI
+          FPS &= ~FPS_L;
+          return;
+        case 0170011: // SETD
+          FPS |= FPS_D;
+          return;
+        case 0170012: // SETL
+          FPS |= FPS_L;
+          return;
+      }
+      fpexc(FEC_OPCODE);
+      return;
+    case 0100: // LDFPS
+      if (m & 070) {
+        FPS = read16(wordaddr(m)) & 0147777;
+      } else {
+        FPS = R[m & 7] & 0147777;
+      }
+      return;
+    case 0200: // STFPS
+      if (m & 070) {
+        write16(wordaddr(m), FPS);
+      } else {
+        R[m & 7] = FPS;
+      }
+      return;
+    case 0300: { // STST, the FEA only goes to memory
+      if (m & 070) {
+        const uint32_t a = faddr(m, 4);
+        write16(a, FEC);
+        if (!immediate(m)) {
+          write16(a + 2, FEA);
+        }
+      } else {
+        R[m & 7] = FEC;
+      }
+      return;
+    }
+  }
+}
+
+static void single(const uint32_t instr) {
+  const uint32_t m = instr & 077;
+  const uint32_t n = (FPS & FPS_D) ? 4 : 2;
+  switch (instr & 0300) {
+    case 0000: // CLRF
+      putf(m, n, 0);
+      setcc(0);
+      return;
+    case 0100: // TSTF
+      setcc(getf(m, n));
+      return;
+    case 0200: // ABSF
+    case 0300: { // NEGF
+      // read modify write, the address is computed once
+      double v;
+      double *ac = nullptr;
+      uint32_t a = 0;
+      uint16_t w[4] = { 0, 0, 0, 0 };
+      const uint32_t k = immediate(m) ? 1 : n;
+      if ((m & 070) == 0) {
+        ac = acreg(m);
+        v = *ac;
+      } else {
+        a = faddr(m, n * 2);
+        for (uint32_t i = 0; i < k; i++) {
+          w[i] = read16(a + i * 2);
+        }
+        v = unpack(w, n);
+      }
+      v = (instr & 0100) ? -v : fabs(v);
+      if (ac) {
+        *ac = v;
+      } else {
+        pack(v, w, n);
+        for (uint32_t i = 0; i < k; i++) {
+          write16(a + i * 2, w[i]);
+        }
+      }
+      setcc(v);
+      return;
+    }
+  }
+}
+
+void step(const uint32_t instr) {
+  const uint32_t m = instr & 077;
+  double &ac = AC[(instr >> 6) & 3];
+  const uint32_t n = (FPS & FPS_D) ? 4 : 2;
+  switch ((instr >> 8) & 017) {
+    case 000:
+      misc(instr);
+      return;
+    case 001:
+      single(instr);
+      return;
+    case 002: // MULF
+      result(ac, ac * getf(m, n));
+      return;
+    case 003: { // MODF
+      const double v = ac * getf(m, n);
+      double ip;
+      double fp = modf(v, &ip);
+      if (fround(ip) == FEC_OVFL) {
+        FPS |= FPS_V;
+        ip = 0;
+        fp = 0;
+        fpexc(FEC_OVFL);
+      }
+      if (!((instr >> 6) & 1)) {
+        AC[((instr >> 6) & 3) | 1] = ip;
+      }
+      result(ac, fp);
+      return;
+    }
+    case 004: // ADDF
+      result(ac, ac + getf(m, n));
+      return;
+    case 005: // LDF
+      ac = getf(m, n);
+      setcc(ac);
+      return;
+    case 006: // SUBF
+      result(ac, ac - getf(m, n));
+      return;
+    case 007: { // CMPF, the codes of src - ac
+      const double v = getf(m, n);
+      FPS &= ~(FPS_N | FPS_Z | FPS_V | FPS_C);
+      if (v < ac) {
+        FPS |= FPS_N;
+      }
+      if (v == ac) {
+        FPS |= FPS_Z;
+      }
+      return;
+    }
+    case 010: // STF
+      putf(m, n, ac);
+      return;
+    case 011: { // DIVF
+      const double v = getf(m, n);
+      if (v == 0) {
+        fpexc(FEC_DIVZ);
+        return;
+      }
+      result(ac, ac / v);
+      return;
+    }
+    case 012: { // STEXP
+      int e = 0;
+      if (ac != 0) {
+        frexp(ac, &e);
+      }
+      FPS &= ~(FPS_N | FPS_Z | FPS_V | FPS_C);
+      if (e < 0) {
+        FPS |= FPS_N;
+      }
+      if (e == 0) {
+        FPS |= FPS_Z;
+      }
+      copycc();
+      puti(m, false, e);
+      return;
+    }
+    case 013: { // STCFI STCFL STCDI STCDL
+      const bool l = FPS & FPS_L;
+      const double t = trunc(ac);
+      int32_t v = 0;
+      bool err = false;
+      if (l ? (t >= 2147483648.0 || t < -2147483648.0) : (t >= 32768.0 || t < -32768.0)) {
+        err = true;
+      } else {
+        v = (int32_t)t;
+      }
+      FPS &= ~(FPS_N | FPS_Z | FPS_V | FPS_C);
+      if (err) {
+        FPS |= FPS_C;
+      }
+      if (v < 0) {
+        FPS |= FPS_N;
+      }
+      if (v == 0) {
+        FPS |= FPS_Z;
+      }
+      copycc();
+      puti(m, l, v);
+      if (err) {
+        fpexc(FEC_ICVT);
+      }
+      return;
+    }
+    case 014: { // STCFD STCDF, store in the other precision
+      const uint32_t k = n == 4 ? 2 : 4;
+      uint16_t w[4];
+      const uint32_t err = pack(ac, w, k);
+      const double v = err ? 0 : unpack(w, k);
+      putf(m, k, v);
+      setcc(v);
+      if (err == FEC_OVFL) {
+        FPS |= FPS_V;
+      }
+      if (err) {
+        fpexc(err);
+      }
+      return;
+    }
+    case 015: { // LDEXP
+      const int32_t e = (m & 070) ? (int16_t)read16(faddr(m, 2)) : (int16_t)R[m & 7];
+      if (ac == 0) {
+        setcc(ac);
+        return;
+      }
+      int old;
+      const double f = frexp(ac, &old);
+      if (e > 0177) {
+        ac = 0;
+        setcc(ac);
+        FPS |= FPS_V;
+        fpexc(FEC_OVFL);
+        return;
+      }
+      if (e < -0177) {
+        ac = 0;
+        setcc(ac);
+        fpexc(FEC_UNFL);
+        return;
+      }
+      ac = ldexp(f, e);
+      setcc(ac);
+      return;
+    }
+    case 016: { // LDCIF LDCID LDCLF LDCLD
+      result(ac, (double)geti(m, FPS & FPS_L));
+      return;
+    }
+    case 017: { // LDCDF LDCFD, load from the other precision
+      double v = getf(m, n == 4 ? 2 : 4);
+      result(ac, v);
+      return;
+    }
+  }
+}
+
+// an F operand of the FIS, which has no undefined variable: -0 is 0
+static double fisget(const uint32_t a) {
+  const uint16_t w[2] = { read16(a & 0xFFFF), read16((a + 2) & 0xFFFF) };
+  if (((w[0] >> 7) & 0377) == 0) {
+    return 0;
+  }
+  return unpack(w, 2);
+}
+
+void fis(const uint32_t instr) {
+  const uint32_t r = instr & 7;
+  const uint32_t sp = R[r] & 0xFFFF;
+  const double a = fisget(sp);
+  const double b = fisget(sp + 4);
+  double v = 0;
+  uint32_t cc = 0;
+  switch (instr & 030) {
+    case 000: // FADD
+      v = b + a;
+      break;
+    case 010: // FSUB
+      v = b - a;
+      break;
+    case 020: // FMUL
+      v = b * a;
+      break;
+    case 030: // FDIV
+      if (a == 0) {
+        cc = 013; // N V C
+      } else {
+        v = b / a;
+      }
+      break;
+  }
+  uint16_t w[2];
+  if (!cc) {
+    const uint32_t err = pack(v, w, 2, false);
+    if (err == FEC_OVFL) {
+      cc = 002; // V
+    } else if (err == FEC_UNFL) {
+      cc = 012; // N V
+    }
+  }
+  if (cc) {
+    cpu::PS.Word = (cpu::PS.Word & ~017) | cc;
+    longjmp(trapbuf, INTFP);
+  }
+  write16((sp + 4) & 0xFFFF, w[0]);
+  write16((sp + 6) & 0xFFFF, w[1]);
+  R[r] = (sp + 4) & 0xFFFF;
+  cpu::PS.Word = (cpu::PS.Word & ~017) | (v < 0 ? 010 : 0) | (v == 0 ? 004 : 0);
+}
+
+// the conversions at the edges of the formats. v packs to w, or to
+// zero and err, and w unpacks to a value which packs to w again.
+struct conv {
+  double v;
+  uint32_t n;
+  bool chop;
+  uint16_t w[4];
+  uint32_t err;
+};
+
+static const conv convs[] = {
+  { 0, 2, false, { 0, 0 } },
+  { 0, 4, false, { 0, 0, 0, 0 } },
+  { 0x1p-128, 2, false, { 0000200, 0 } },                                  // smallest F
+  { -0x1p-128, 2, false, { 0100200, 0 } },
+  { 0x1p-128, 4, false, { 0000200, 0, 0, 0 } },                            // smallest D
+  { -0x1p-128, 4, false, { 0100200, 0, 0, 0 } },
+  { 0x1.fffffep126, 2, false, { 0077777, 0177777 } },                      // largest F
+  { -0x1.fffffep126, 2, false, { 0177777, 0177777 } },
+  { 0x1.fffffffffffffp126, 4, false, { 0077777, 0177777, 0177777, 0177770 } }, // largest D
+  { -0x1.fffffffffffffp126, 4, false, { 0177777, 0177777, 0177777, 0177770 } },
+  { 0x1.000001p0, 2, false, { 0040200, 0000001 } },                        // half up
+  { 0x1.01ffffp0, 2, false, { 0040201, 0000000 } },                       // carry into the first word
+  { 0x1.ffffffp-1, 2, false, { 0040200, 0000000 } },                       // carry into the exponent
+  { 0x1.ffffffp-1, 2, true, { 0040177, 0177777 } },                        // chopped
+  { 0x1.ffffffp126, 2, false, { 0, 0 }, FEC_OVFL },                        // rounded out of range
+  { 0x1p127, 4, false, { 0, 0, 0, 0 }, FEC_OVFL },
+  { 0x1p-129, 2, false, { 0, 0 }, FEC_UNFL },
+  { 0x1p-129, 4, false, { 0, 0, 0, 0 }, FEC_UNFL },
+};
+
+// D operands with the bits a double drops, and the undefined -0
+struct unconv {
+  uint16_t w[4];
+  double v;
+};
+
+static const unconv unconvs[] = {
+  { { 0077777, 0177777, 0177777, 0177777 }, 0x1.fffffffffffffp126 },
+  { { 0177777, 0177777, 0177777, 0177777 }, -0x1.fffffffffffffp126 },
+  { { 0040200, 0000000, 0000000, 0000007 }, 1 },
+  { { 0100000, 0000000, 0000000, 0000000 }, 0 },
+};
+
+uint32_t check(Stream *dev) {
+  static const uint32_t N = sizeof(convs) / sizeof(convs[0]);
+  static const uint32_t M = sizeof(unconvs) / sizeof(unconvs[0]);
+  const uint32_t fps = FPS;
+  FPS = 0; // no trap on -0
+  uint32_t failed = 0;
+  for (uint32_t i = 0; i < N; i++) {
+    const conv &c = convs[i];
+    uint16_t w[4], back[4];
+    const uint32_t err = pack(c.v, w, c.n, c.chop);
+    if (err != c.err || memcmp(w, c.w, c.n * 2) ||
+        (!err && (pack(unpack(w, c.n), back, c.n, c.chop) || memcmp(back, w, c.n * 2)))) {
+      dev->printf("fp11: %c %.17g packs to %06o %06o %06o %06o, error %u\r\n", c.n == 2 ? 'F' : 'D',
+        c.v, w[0], w[1], c.n == 4 ? w[2] : 0, c.n == 4 ? w[3] : 0, err);
+      failed++;
+    }
+  }
+  for (uint32_t i = 0; i < M; i++) {
+    const unconv &c = unconvs[i];
+    const double v = unpack(c.w, 4);
+    if (v != c.v) {
+      dev->printf("fp11: D %06o %06o %06o %06o unpacks to %.17g\r\n", c.w[0], c.w[1], c.w[2], c.w[3], v);
+      failed++;
+    }
+  }
+  FPS = fps;
+  return failed;
+}
+
+void snapshot(snap::io &s) {
+  s(AC);
+  s(FPS);
+  s(FEC);
+  s(FEA);
+}
+
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+#include <pdp11.h>
+
+// FP11 floating point processor, instructions 170000-177777. the
+// accumulators are host doubles, F and D are converted on load and
+// store. a double has 53 fraction bits, D has 56: the low 3 bits of a
+// D operand are lost.
+namespace fp11 {
+
+    enum {
+      FPS_ER   = 1 << 15, // error
+      FPS_ID   = 1 << 14, // interrupt disable
+      FPS_IUV  = 1 << 11, // interrupt on undefined variable
+      FPS_IU   = 1 << 10, // interrupt on underflow
+      FPS_IV   = 1 << 9,  // interrupt on overflow
+      FPS_IC   = 1 << 8,  // interrupt on integer conversion error
+      FPS_D    = 1 << 7,  // double precision
+      FPS_L    = 1 << 6,  // long integer
+      FPS_T    = 1 << 5,  // truncate
+      FPS_N    = 1 << 3,
+      FPS_Z    = 1 << 2,
+      FPS_V    = 1 << 1,
+      FPS_C    = 1 << 0,
+    };
+
+    // floating exception codes
+    enum {
+      FEC_OPCODE = 2,
+      FEC_DIVZ   = 4,
+      FEC_ICVT   = 6,
+      FEC_OVFL   = 8,
+      FEC_UNFL   = 10,
+      FEC_UNDEF  = 12,
+    };
+
+    extern MACHINE_STATE double AC[6];
+    extern MACHINE_STATE uint32_t FPS;
+    extern MACHINE_STATE uint32_t FEC;
+    extern MACHINE_STATE uint32_t FEA;
+
+    void step(uint32_t instr);
+    // KE11-F floating instruction set of the 11/40, 075000-075037:
+    // FADD FSUB FMUL FDIV R. the F operands are on the stack at R, b
+    // at R+4 over a at R. b op a, rounded, replaces b and R points to
+    // it. an overflow, underflow or division by zero leaves the stack
+    // and R as they were and traps to 244 with the condition codes of
+    // the handbook. the FPS is not involved.
+    void fis(uint32_t instr);
+    void reset();
+    void snapshot(snap::io &s);
+    // F and D packed from and unpacked to host doubles at the edges:
+    // zero, the smallest and largest of both signs, roundings which
+    // carry into the next word or the exponent or out of the range.
+    // prints the failures and returns their number.
+    uint32_t check(Stream *dev);
+
+};
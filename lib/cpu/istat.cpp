@@ -0,0 +1,156 @@
+#include <Arduino.h>
+#include <SdFat.h>
+#include <pdp11.h>
+#include "istat.h"
+
+namespace istat {
+
+MACHINE_STATE uint32_t (*counts)[IS_N][IS_MODES];
+
+static const char *const names[IS_N] = {
+  "HALT", "WAIT", "RTI", "BPT", "IOT", "RESET", "RTT", "JMP",
+  "RTS", "SPL", "CCOP", "SWAB",
+  "BR", "BNE", "BEQ", "BGE", "BLT", "BGT", "BLE", "JSR",
+  "CLR", "COM", "INC", "DEC", "NEG", "ADC", "SBC", "TST",
+  "ROR", "ROL", "ASR", "ASL", "MARK", "MFPI", "MTPI", "SXT",
+  "MOV", "CMP", "BIT", "BIC", "BIS", "ADD",
+  "MUL", "DIV", "ASH", "ASHC", "XOR", "FIS", "ILL", "SOB",
+  "BPL", "BMI", "BHI", "BLOS", "BVC", "BVS", "BCC", "BCS",
+  "EMT", "TRAP",
+  "CLRB", "COMB", "INCB", "DECB", "NEGB", "ADCB", "SBCB", "TSTB",
+  "RORB", "ROLB", "ASRB", "ASLB", "MTPS", "MFPD", "MTPD", "MFPS",
+  "MOVB", "CMPB", "BITB", "BICB", "BISB", "SUB", "FP11",
+};
+
+// class by instr >> 6, the instructions below 0000400 are sorted out
+// in count() like in kd11::time()
+static MACHINE_STATE uint8_t opclass[02000];
+// the mode bits that belong to the class, 077 both operands, 007 the
+// destination (or the source of the register instructions)
+static MACHINE_STATE uint8_t modemask[IS_N];
+
+uint32_t classify(const uint32_t instr) {
+  if (instr < 0000400) {
+    if (instr <= 0000006) {
+      return IS_HALT + instr;
+    }
+    switch (instr & 0177770) {
+      case 0000200: return IS_RTS;
+      case 0000230: return IS_SPL;
+    }
+    if ((instr & 0177700) == 0000100) {
+      return IS_JMP;
+    }
+    if ((instr & 0177700) == 0000300) {
+      return IS_SWAB;
+    }
+    if ((instr & 0177740) == 0000240) {
+      return IS_CC;
+    }
+    return IS_ILL;
+  }
+  const uint32_t dop = (instr >> 12) & 017;
+  if (dop >= 001 && dop <= 006) {
+    return IS_MOV + dop - 001;
+  }
+  if (dop >= 011 && dop <= 016) {
+    return IS_MOVB + dop - 011;
+  }
+  if (dop == 017) {
+    return IS_FPP;
+  }
+  const uint32_t br = instr >> 8;
+  if (br >= 0001 && br <= 0007) {
+    return IS_BR + br - 0001;
+  }
+  if (br == 0010 || br == 0011) {
+    return IS_JSR;
+  }
+  if (br >= 0200 && br <= 0211) {
+    return IS_BPL + br - 0200;
+  }
+  const uint32_t sop = instr >> 6;
+  if (sop >= 0050 && sop <= 0067) {
+    return IS_CLR + sop - 0050;
+  }
+  if (sop >= 01050 && sop <= 01067) {
+    return IS_CLRB + sop - 01050;
+  }
+  const uint32_t eis = instr >> 9;
+  if (eis >= 070 && eis <= 077) {
+    return IS_MUL + eis - 070;
+  }
+  return IS_ILL;
+}
+
+uint32_t operands(const uint32_t c) {
+  if ((c >= IS_MOV && c <= IS_ADD) || (c >= IS_MOVB && c <= IS_SUB)) {
+    return 077;
+  }
+  if ((c >= IS_CLR && c <= IS_SXT && c != IS_MARK) || (c >= IS_CLRB && c <= IS_MFPS) ||
+      (c >= IS_MUL && c <= IS_XOR) || c == IS_JMP || c == IS_JSR || c == IS_SWAB || c == IS_FPP) {
+    return 007;
+  }
+  return 0;
+}
+
+const char *name(const uint32_t c) {
+  return c < IS_N ? names[c] : "?";
+}
+
+void init() {
+  for (uint32_t i = 0; i < 02000; i++) {
+    opclass[i] = classify(i << 6);
+  }
+  for (uint32_t c = 0; c < IS_N; c++) {
+    modemask[c] = operands(c);
+  }
+  if (ENABLE_ISTAT && !counts) {
+    counts = (uint32_t (*)[IS_N][IS_MODES]) malloc(2 * sizeof(*counts));
+    if (!counts) {
+      Serial.println("istat: malloc failed");
+      return;
+    }
+    reset();
+  }
+}
+
+void reset() {
+  if (counts) {
+    memset(counts, 0, 2 * sizeof(*counts));
+  }
+}
+
+void count(const uint32_t instr, const bool user) {
+  const uint32_t c = instr < 0000400 ? classify(instr) : opclass[instr >> 6];
+  const uint32_t m = (((instr >> 6) & 070) | ((instr >> 3) & 007)) & modemask[c];
+  counts[user][c][m]++;
+}
+
+// raw counts for offline analysis: "ISTA", the number of classes and
+// modes, the class names in 8 byte fields, then the kernel and the user
+// counts as little endian uint32 [class][mode]
+bool dump(const char *path) {
+  if (!counts) {
+    return false;
+  }
+  FsFile f;
+  if (!f.open(path, O_CREAT|O_TRUNC|O_WRITE)) {
+    return false;
+  }
+  const uint32_t head[3] = { 0x41545349, IS_N, IS_MODES };
+  bool ok = f.write(head, sizeof(head)) == sizeof(head);
+  for (uint32_t c = 0; c < IS_N && ok; c++) {
+    char n[8] = { 0 };
+    memcpy(n, names[c], min(strlen(names[c]), sizeof(n)));
+    ok = f.write(n, sizeof(n)) == sizeof(n);
+  }
+  if (ok) {
+    ok = f.write(counts, 2 * sizeof(*counts)) == 2 * sizeof(*counts);
+  }
+  f.sync();
+  f.close();
+  return ok;
+}
+
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+#include <pdp11.h>
+
+// instruction statistics, counts per opcode class, addressing modes and
+// kernel or user mode. compiled in with ENABLE_ISTAT in pdp11.h, off
+// step() and run() carry no trace of it.
+#define IS_MODES 64 // source mode << 3 | destination mode
+
+namespace istat {
+
+    enum {
+      IS_HALT, IS_WAIT, IS_RTI, IS_BPT, IS_IOT, IS_RESET, IS_RTT, IS_JMP,
+      IS_RTS, IS_SPL, IS_CC, IS_SWAB,
+      IS_BR, IS_BNE, IS_BEQ, IS_BGE, IS_BLT, IS_BGT, IS_BLE, IS_JSR,
+      IS_CLR, IS_COM, IS_INC, IS_DEC, IS_NEG, IS_ADC, IS_SBC, IS_TST,
+      IS_ROR, IS_ROL, IS_ASR, IS_ASL, IS_MARK, IS_MFPI, IS_MTPI, IS_SXT,
+      IS_MOV, IS_CMP, IS_BIT, IS_BIC, IS_BIS, IS_ADD,
+      IS_MUL, IS_DIV, IS_ASH, IS_ASHC, IS_XOR, IS_FIS, IS_ILL, IS_SOB,
+      IS_BPL, IS_BMI, IS_BHI, IS_BLOS, IS_BVC, IS_BVS, IS_BCC, IS_BCS,
+      IS_EMT, IS_TRAP,
+      IS_CLRB, IS_COMB, IS_INCB, IS_DECB, IS_NEGB, IS_ADCB, IS_SBCB, IS_TSTB,
+      IS_RORB, IS_ROLB, IS_ASRB, IS_ASLB, IS_MTPS, IS_MFPD, IS_MTPD, IS_MFPS,
+      IS_MOVB, IS_CMPB, IS_BITB, IS_BICB, IS_BISB, IS_SUB, IS_FPP,
+      IS_N
+    };
+
+    // [user][class][modes], nullptr unless compiled in
+    extern MACHINE_STATE uint32_t (*counts)[IS_N][IS_MODES];
+
+    void init();
+    void count(uint32_t instr, bool user);
+    void reset();
+    uint32_t classify(uint32_t instr);
+    const char *name(uint32_t c);
+    uint32_t operands(uint32_t c);
+    bool dump(const char *path);
+
+};
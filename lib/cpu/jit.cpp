@@ -0,0 +1,1144 @@
+#include <Arduino.h>
+#include <pdp11.h>
+#include "mmu.h"
+#include "unibus.h"
+#include "cpu.h"
+#include "kd11.h"
+#include "sched.h"
+#include "bcache.h"
+#include "jit.h"
+
+#if BC_JIT
+
+#include <sys/mman.h>
+
+#define JIT_BLOCK 16384 // bytes of code of one block at most
+#define JIT_LABELS 128
+#define JIT_FIXUPS 256
+
+namespace jit {
+
+MACHINE_STATE bool enabled = true;
+MACHINE_STATE uint32_t compiled, failed, resets;
+MACHINE_STATE uint32_t native, called;
+MACHINE_STATE uint64_t runs, exits;
+
+// the code of the blocks, filled from the start and dropped as a whole
+static MACHINE_STATE uint8_t *code;
+static MACHINE_STATE uint32_t used;
+
+// the block being compiled
+static MACHINE_STATE uint8_t buf[JIT_BLOCK];
+static MACHINE_STATE uint32_t at;
+static MACHINE_STATE bool overflow;
+static MACHINE_STATE int32_t labels[JIT_LABELS];
+static MACHINE_STATE uint32_t nlabels;
+static MACHINE_STATE struct fixup { uint32_t at, label; } fixups[JIT_FIXUPS];
+static MACHINE_STATE uint32_t nfixups;
+
+// x86-64 registers and conditions
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+enum { CC_O, CC_NO, CC_B, CC_AE, CC_E, CC_NE, CC_BE, CC_A, CC_S, CC_NS, CC_P, CC_NP, CC_L, CC_GE, CC_LE, CC_G };
+// the /digit of the immediate alu group
+enum { I_ADD = 0, I_OR = 1, I_AND = 4, I_SUB = 5, I_XOR = 6, I_CMP = 7 };
+
+// the registers of the code: rbp points at cpu::R, all machine state is
+// addressed from there, r15 holds unibus::core16. R0-R6 live in rbx and
+// r12-r14 where the block uses them, rax-r11 are scratch.
+static const int hosts[4] = { RBX, R12, R13, R14 };
+// the frame: two saved guest registers, a write in a call, the gen
+enum { S_SAVE = 0, S_VAL = 16, S_PA = 20, S_GEN = 24, S_FRAME = 40 };
+
+static void b1(const uint32_t v) {
+  if (at < JIT_BLOCK) {
+    buf[at++] = v;
+  } else {
+    overflow = true;
+  }
+}
+
+static void b4(const uint32_t v) {
+  for (uint32_t i = 0; i < 32; i += 8) {
+    b1(v >> i);
+  }
+}
+
+static void b8(const uint64_t v) {
+  b4(v);
+  b4(v >> 32);
+}
+
+static uint32_t label() {
+  if (nlabels == JIT_LABELS) {
+    overflow = true;
+    return 0;
+  }
+  labels[nlabels] = -1;
+  return nlabels++;
+}
+
+static void bind(const uint32_t l) {
+  labels[l] = at;
+}
+
+static void rel(const uint32_t l) {
+  if (nfixups == JIT_FIXUPS) {
+    overflow = true;
+    return;
+  }
+  fixups[nfixups++] = { at, l };
+  b4(0);
+}
+
+// [base + index * scale + disp], index -1 for none
+struct mem {
+  int base, index, scale;
+  int32_t disp;
+};
+
+static MACHINE_STATE intptr_t tlsbase;
+
+// a variable of the machine, all of them are thread locals of the same
+// block, addressed relative to cpu::R
+static mem tls(const volatile void *v, const int index = -1, const int scale = 1) {
+  const intptr_t d = (intptr_t) v - tlsbase;
+  if (d != (int32_t) d) {
+    overflow = true;
+  }
+  return { RBP, index, scale, (int32_t) d };
+}
+
+static mem core(const int pa) {
+  return { R15, pa, 1, 0 };
+}
+
+// spl, bpl, sil and dil need a rex prefix as byte registers
+static bool low8(const int r) {
+  return r >= 4 && r < 8;
+}
+
+static void rex(const int w, const int r, const int x, const int b, const bool force) {
+  const uint32_t v = 0x40 | (w == 8) << 3 | (r >> 3 & 1) << 2 | (x >> 3 & 1) << 1 | (b >> 3 & 1);
+  if (v != 0x40 || force) {
+    b1(v);
+  }
+}
+
+static void opcode(const uint32_t op) {
+  if (op > 0xFF) {
+    b1(op >> 8);
+  }
+  b1(op);
+}
+
+static void modrm(const int reg, const mem &m) {
+  const int mod = m.disp == 0 && (m.base & 7) != 5 ? 0 : m.disp == (int8_t) m.disp ? 1 : 2;
+  if (m.index < 0 && (m.base & 7) != 4) {
+    b1(mod << 6 | (reg & 7) << 3 | (m.base & 7));
+  } else {
+    const int s = m.scale == 8 ? 3 : m.scale == 4 ? 2 : m.scale == 2 ? 1 : 0;
+    b1(mod << 6 | (reg & 7) << 3 | 4);
+    b1(s << 6 | ((m.index < 0 ? RSP : m.index) & 7) << 3 | (m.base & 7));
+  }
+  if (mod == 1) {
+    b1(m.disp);
+  } else if (mod == 2) {
+    b4(m.disp);
+  }
+}
+
+// op reg, [m] or op [m], reg with operands of w bytes
+static void opm(const int w, const uint32_t op, const int reg, const mem &m) {
+  if (w == 2) {
+    b1(0x66);
+  }
+  rex(w, reg, m.index < 0 ? 0 : m.index, m.base, w == 1 && low8(reg));
+  opcode(op);
+  modrm(reg, m);
+}
+
+// op rm, reg between registers, w 1 also for the byte sources of movzx and setcc
+static void opr(const int w, const uint32_t op, const int reg, const int rm) {
+  if (w == 2) {
+    b1(0x66);
+  }
+  rex(w, reg, 0, rm, w == 1 && (low8(reg) || low8(rm)));
+  opcode(op);
+  b1(0xC0 | (reg & 7) << 3 | (rm & 7));
+}
+
+// the two operand alu ops by their word opcode, the byte one is one less
+static void alu(const int w, const uint32_t op, const int reg, const int rm) {
+  opr(w, w == 1 ? op - 1 : op, reg, rm);
+}
+
+static void imm(const int w, const int32_t v, const bool i8) {
+  if (i8) {
+    b1(v);
+  } else if (w == 2) {
+    b1(v);
+    b1(v >> 8);
+  } else {
+    b4(v);
+  }
+}
+
+static void opri(const int w, const int ext, const int rm, const int32_t v) {
+  const bool i8 = w == 1 || v == (int8_t) v;
+  if (w == 2) {
+    b1(0x66);
+  }
+  rex(w, 0, 0, rm, w == 1 && low8(rm));
+  b1(w == 1 ? 0x80 : i8 ? 0x83 : 0x81);
+  b1(0xC0 | ext << 3 | (rm & 7));
+  imm(w, v, i8);
+}
+
+static void opmi(const int w, const int ext, const mem &m, const int32_t v) {
+  const bool i8 = w == 1 || v == (int8_t) v;
+  opm(w, w == 1 ? 0x80 : i8 ? 0x83 : 0x81, ext, m);
+  imm(w, v, i8);
+}
+
+static void movi(const int r, const uint32_t v) {
+  rex(4, 0, 0, r, false);
+  b1(0xB8 + (r & 7));
+  b4(v);
+}
+
+static void movi64(const int r, const uint64_t v) {
+  rex(8, 0, 0, r, false);
+  b1(0xB8 + (r & 7));
+  b8(v);
+}
+
+static void movmi(const mem &m, const uint32_t v) {
+  opm(4, 0xC7, 0, m);
+  b4(v);
+}
+
+static void mov(const int dst, const int src) {
+  opr(4, 0x89, src, dst);
+}
+
+static void load(const int dst, const mem &m) {
+  opm(4, 0x8B, dst, m);
+}
+
+static void store(const mem &m, const int src) {
+  opm(4, 0x89, src, m);
+}
+
+// shl 4, shr 5
+static void shift(const int ext, const int r, const uint32_t n) {
+  rex(4, 0, 0, r, false);
+  b1(0xC1);
+  b1(0xC0 | ext << 3 | (r & 7));
+  b1(n);
+}
+
+static void testi(const int w, const int r, const uint32_t v) {
+  if (w == 2) {
+    b1(0x66);
+  }
+  rex(w, 0, 0, r, w == 1 && low8(r));
+  b1(w == 1 ? 0xF6 : 0xF7);
+  b1(0xC0 | (r & 7));
+  imm(w, v, w == 1);
+}
+
+static void setcc(const int cc, const int r) {
+  opr(1, 0x0F90 + cc, 0, r);
+}
+
+static void jcc(const int cc, const uint32_t l) {
+  b1(0x0F);
+  b1(0x80 + cc);
+  rel(l);
+}
+
+static void jmp(const uint32_t l) {
+  b1(0xE9);
+  rel(l);
+}
+
+static void call(const void *fn) {
+  movi64(RAX, (uintptr_t) fn);
+  b1(0xFF);
+  b1(0xD0);
+}
+
+static void push(const int r) {
+  rex(4, 0, 0, r, false);
+  b1(0x50 + (r & 7));
+}
+
+static void pop(const int r) {
+  rex(4, 0, 0, r, false);
+  b1(0x58 + (r & 7));
+}
+
+// the instructions the code does itself
+enum { K_CALL, K_MOV, K_CMP, K_BIT, K_BIC, K_BIS, K_ADD, K_SUB, K_CLR, K_INC, K_DEC, K_TST, K_BR, K_SOB };
+
+static bool isbranch(const uint32_t instr) {
+  return ((instr & 0177400) >= 0000400 && (instr & 0177400) <= 0003400) ||
+         ((instr & 0177400) >= 0100000 && (instr & 0177400) <= 0103400);
+}
+
+static uint32_t kind(const uint32_t instr) {
+  switch (instr & 0170000) {
+    case 0010000: case 0110000: return K_MOV;
+    case 0020000: case 0120000: return K_CMP;
+    case 0030000: case 0130000: return K_BIT;
+    case 0040000: case 0140000: return K_BIC;
+    case 0050000: case 0150000: return K_BIS;
+    case 0060000: return K_ADD;
+    case 0160000: return K_SUB;
+  }
+  switch (instr & 0077700) {
+    case 0005000: return K_CLR;
+    case 0005200: return K_INC;
+    case 0005300: return K_DEC;
+    case 0005700: return K_TST;
+  }
+  if ((instr & 0177000) == 0077000) {
+    return K_SOB;
+  }
+  return isbranch(instr) ? K_BR : K_CALL;
+}
+
+static bool twoop(const uint32_t k) {
+  return k >= K_MOV && k <= K_SUB;
+}
+
+static bool writes(const uint32_t k) {
+  return k == K_MOV || k == K_BIC || k == K_BIS || k == K_ADD || k == K_SUB ||
+         k == K_CLR || k == K_INC || k == K_DEC;
+}
+
+// operand modes the code does, the pc only as immediate, absolute,
+// relative and relative deferred, and written only through the latter
+static bool usable(const uint32_t v, const bool w) {
+  const uint32_t m = v >> 3 & 7;
+  if ((v & 7) != 7) {
+    return true;
+  }
+  if (m == 0 || m == 2) {
+    return !w;
+  }
+  return m == 3 || m == 6 || m == 7;
+}
+
+static uint32_t words(const uint32_t v) {
+  const uint32_t m = v >> 3 & 7;
+  return m >= 6 || ((v & 7) == 7 && (m == 2 || m == 3)) ? 1 : 0;
+}
+
+// the branch condition for the flags f, NZVC
+static bool taken(const uint32_t instr, const uint32_t f) {
+  const bool N = f & 8, Z = f & 4, V = f & 2, C = f & 1;
+  switch (instr & 0177400) {
+    case 0000400: return true;
+    case 0001000: return !Z;
+    case 0001400: return Z;
+    case 0002000: return !(N ^ V);
+    case 0002400: return N ^ V;
+    case 0003000: return !(Z || (N ^ V));
+    case 0003400: return Z || (N ^ V);
+    case 0100000: return !N;
+    case 0100400: return N;
+    case 0101000: return !(C || Z);
+    case 0101400: return C || Z;
+    case 0102000: return !V;
+    case 0102400: return V;
+    case 0103000: return !C;
+    case 0103400: return C;
+  }
+  return false;
+}
+
+static uint32_t target(const uint32_t br, const uint32_t r7) {
+  uint32_t o = br & 0xFF;
+  if (o & 0x80) {
+    o = -(((~o) + 1) & 0xFF);
+  }
+  return r7 + (o << 1);
+}
+
+// the block being compiled and the instruction being emitted
+static MACHINE_STATE const bcache::block *blk;
+static MACHINE_STATE int home[8];       // host register of R0-R6, -1 in memory
+static MACHINE_STATE bool mmuon, bits22;
+static MACHINE_STATE uint32_t pbase, parmask;
+static MACHINE_STATE uint32_t ipc, ipa;  // the instruction
+static MACHINE_STATE uint32_t ppc;       // the one before
+static MACHINE_STATE uint32_t r7;        // R7 as the interpreter has it at this point
+static MACHINE_STATE uint32_t pn;        // instructions and time not yet counted
+static MACHINE_STATE uint64_t pns;
+static MACHINE_STATE uint32_t epilogue;
+
+// the ways out of the code, emitted after the ops
+enum { X_EXIT, X_INVAL, X_STOP };
+struct stub {
+  uint32_t label, kind, i;
+  uint32_t n;
+  uint64_t ns;
+  uint32_t saved[2], nsaved;
+  uint32_t pc, prev, next; // the instruction, the one before, the one after
+};
+static MACHINE_STATE stub stubs[BC_OPS * 3];
+static MACHINE_STATE uint32_t nstubs;
+
+static uint32_t exitto(const uint32_t kind, const uint32_t i, const uint32_t *saved, const uint32_t nsaved) {
+  stub &s = stubs[nstubs++];
+  s.label = label();
+  s.kind = kind;
+  s.i = i;
+  s.n = pn;
+  s.ns = pns;
+  s.nsaved = nsaved;
+  for (uint32_t k = 0; k < nsaved; k++) {
+    s.saved[k] = saved[k];
+  }
+  s.pc = ipc;
+  s.prev = ppc;
+  s.next = ipc + blk->ops[i].len;
+  return s.label;
+}
+
+static void getr(const int dst, const uint32_t r) {
+  if (r == 7) {
+    movi(dst, r7);
+  } else if (home[r] >= 0) {
+    mov(dst, home[r]);
+  } else {
+    load(dst, tls(&cpu::R[r]));
+  }
+}
+
+static void setr(const uint32_t r, const int src) {
+  if (home[r] >= 0) {
+    mov(home[r], src);
+  } else {
+    store(tls(&cpu::R[r]), src);
+  }
+}
+
+static void writeback() {
+  for (uint32_t r = 0; r < 7; r++) {
+    if (home[r] >= 0) {
+      store(tls(&cpu::R[r]), home[r]);
+    }
+  }
+}
+
+static void reload() {
+  for (uint32_t r = 0; r < 7; r++) {
+    if (home[r] >= 0) {
+      load(home[r], tls(&cpu::R[r]));
+    }
+  }
+}
+
+static void account(const uint32_t n, const uint64_t ns) {
+  if (n) {
+    opmi(8, I_ADD, tls(&sched::icount), n);
+  }
+  if (INSTR_TIMING && ns) {
+    opmi(8, I_ADD, tls(&kd11::cycles), ns);
+  }
+}
+
+// leave with R7 at next, the counts of the ops done and ret
+static void leave(const uint32_t next, const uint32_t pc, const uint32_t ret) {
+  writeback();
+  movmi(tls(&cpu::R[7]), next);
+  account(pn, pns);
+  movmi(tls(&cpu::PC), pc);
+  movi(RAX, ret);
+  jmp(epilogue);
+}
+
+// the next word of the instruction stream, from the cached core
+static uint32_t word() {
+  const uint32_t v = unibus::core16[(ipa + (r7 - ipc)) >> 1];
+  r7 += 2;
+  return v;
+}
+
+// the physical address of the virtual one in eax to out, as mmu::decode
+// without the faults: x is taken instead. r11 gets the page of a write.
+static void xlate(const int out, const bool w, const bool odd, const uint32_t x) {
+  if (odd) {
+    b1(0xA8); // test al, 1
+    b1(1);
+    jcc(CC_NE, x);
+  }
+  if (!mmuon) {
+    opri(4, I_CMP, RAX, 0167777);
+    jcc(CC_A, x);
+    opm(4, 0x3B, RAX, tls(&unibus::memsize));
+    jcc(CC_AE, x);
+    mov(out, RAX);
+    return;
+  }
+  mov(RCX, RAX);
+  shift(5, RCX, 13);
+  if (pbase) {
+    opri(4, I_OR, RCX, pbase);
+  }
+  opm(4, 0x0FB7, R8, tls(&mmu::pages[0].pdr, RCX, 4));
+  testi(1, R8, 2);
+  jcc(CC_E, x);
+  mov(R9, RAX);
+  shift(5, R9, 6);
+  opri(4, I_AND, R9, 0177);
+  mov(R10, R8);
+  shift(5, R10, 8);
+  opri(4, I_AND, R10, 0177);
+  const uint32_t down = label(), ok = label();
+  testi(1, R8, 8);
+  jcc(CC_NE, down);
+  alu(4, 0x39, R10, R9);
+  jcc(CC_A, x);
+  jmp(ok);
+  bind(down);
+  alu(4, 0x39, R10, R9);
+  jcc(CC_B, x);
+  bind(ok);
+  opm(4, 0x0FB7, R10, tls(&mmu::pages[0].par, RCX, 4));
+  if (parmask != 0177777) {
+    opri(4, I_AND, R10, parmask);
+  }
+  alu(4, 0x01, R9, R10);
+  shift(4, R10, 6);
+  mov(out, RAX);
+  opri(4, I_AND, out, 077);
+  alu(4, 0x01, R10, out);
+  if (bits22) {
+    opri(4, I_AND, out, 017777777);
+  } else {
+    mov(R9, out);
+    opri(4, I_AND, R9, 0760000);
+    opri(4, I_CMP, R9, 0760000);
+    jcc(CC_E, x);
+    opri(4, I_AND, out, 0777777);
+  }
+  opm(4, 0x3B, out, tls(&unibus::memsize));
+  jcc(CC_AE, x);
+  if (w) {
+    mov(R11, RCX);
+  }
+}
+
+// an operand: a register, an immediate or core at the address in a host register
+enum { O_REG, O_IMM, O_MEM };
+struct opnd {
+  uint32_t kind, r, imm;
+};
+
+// aget for operand v of l bytes: the register updates and the address
+// translation, the physical address goes to pa
+static opnd ea(const uint32_t v, const uint32_t l, const int pa, const bool w, const uint32_t x) {
+  const uint32_t m = v >> 3 & 7, r = v & 7;
+  if (m == 0) {
+    return { O_REG, r, 0 };
+  }
+  if (r == 7) {
+    const uint32_t a = word();
+    switch (m) {
+      case 2:
+        return { O_IMM, 0, a };
+      case 3:
+        movi(RAX, a);
+        break;
+      default:
+        movi(RAX, (a + r7) & 0xFFFF);
+        if (m == 7) {
+          xlate(RDX, false, true, x);
+          opm(4, 0x0FB7, RAX, core(RDX));
+        }
+    }
+  } else {
+    const uint32_t inc = r >= 6 || (m & 1) ? 2 : l;
+    switch (m) {
+      case 1:
+        getr(RAX, r);
+        opri(4, I_AND, RAX, 0xFFFF);
+        break;
+      case 2:
+      case 3:
+        getr(RAX, r);
+        opm(4, 0x8D, RCX, { RAX, -1, 1, (int32_t) inc });
+        opri(4, I_AND, RCX, 0xFFFF);
+        setr(r, RCX);
+        opri(4, I_AND, RAX, 0xFFFF);
+        break;
+      case 4:
+      case 5:
+        getr(RAX, r);
+        opri(4, I_SUB, RAX, inc);
+        opri(4, I_AND, RAX, 0xFFFF);
+        setr(r, RAX);
+        break;
+      default: {
+        const uint32_t a = word();
+        getr(RAX, r);
+        opri(4, I_ADD, RAX, a);
+        opri(4, I_AND, RAX, 0xFFFF);
+      }
+    }
+    if ((m & 1) && m != 1) {
+      xlate(RDX, false, true, x);
+      opm(4, 0x0FB7, RAX, core(RDX));
+    }
+  }
+  xlate(pa, w, l == 2, x);
+  return { O_MEM, 0, 0 };
+}
+
+// memread of an operand into dst
+static void value(const opnd &o, const uint32_t l, const int dst, const int pa) {
+  switch (o.kind) {
+    case O_REG:
+      getr(dst, o.r);
+      opri(4, I_AND, dst, l == 2 ? 0xFFFF : 0xFF);
+      break;
+    case O_IMM:
+      movi(dst, l == 2 ? o.imm : o.imm & 0xFF);
+      break;
+    default:
+      opm(4, l == 2 ? 0x0FB7 : 0x0FB6, dst, core(pa));
+  }
+}
+
+// memwrite of ecx to an operand, the pa of core is in rdi. a write to
+// code drops its blocks and ends this one at inval.
+static void put(const opnd &o, const uint32_t l, const uint32_t inval) {
+  if (o.kind == O_REG) {
+    if (l == 2) {
+      setr(o.r, RCX);
+    } else {
+      getr(R8, o.r);
+      opri(4, I_AND, R8, 0xFF00);
+      alu(4, 0x09, RCX, R8);
+      setr(o.r, R8);
+    }
+    return;
+  }
+  if (mmuon) {
+    opmi(2, I_OR, tls(&mmu::pages[0].pdr, R11, 4), 0100);
+  }
+  const uint32_t quiet = label();
+  opmi(1, I_CMP, tls(&bcache::logging), 0);
+  jcc(CC_E, quiet);
+  store({ RSP, -1, 1, S_VAL }, RCX);
+  store({ RSP, -1, 1, S_PA }, RDI);
+  call((const void *) bcache::note);
+  load(RCX, { RSP, -1, 1, S_VAL });
+  load(RDI, { RSP, -1, 1, S_PA });
+  bind(quiet);
+  opm(l, l == 2 ? 0x89 : 0x88, RCX, core(RDI));
+  // unibus::touched
+  mov(RAX, RDI);
+  shift(5, RAX, 11);
+  mov(RCX, RDI);
+  shift(5, RCX, 6);
+  opri(4, I_AND, RCX, 31);
+  movi(RDX, 1);
+  opr(4, 0xD3, 4, RDX); // shl edx, cl
+  opm(4, 0x09, RDX, tls(unibus::dirty, RAX, 4));
+  // bcache::written
+  mov(RAX, RDI);
+  shift(5, RAX, 9);
+  opm(4, 0x0FB6, RAX, tls(bcache::code, RAX, 1));
+  mov(RCX, RDI);
+  shift(5, RCX, 6);
+  opri(4, I_AND, RCX, 7);
+  opr(4, 0x0FA3, RCX, RAX); // bt eax, ecx
+  jcc(CC_B, inval);
+}
+
+// PS from the host flags of the last op at the width of the operands:
+// N and Z, V and C if asked, V as N for INC
+static void flags(const uint32_t mask, const bool v, const bool c, const bool nv = false) {
+  setcc(CC_E, R8);
+  setcc(CC_S, R9);
+  if (v) {
+    setcc(CC_O, R10);
+  }
+  if (c) {
+    setcc(CC_B, RAX);
+  }
+  opr(1, 0x0FB6, R8, R8);
+  shift(4, R8, 2);
+  opr(1, 0x0FB6, R9, R9);
+  shift(4, R9, 3);
+  alu(4, 0x09, R9, R8);
+  if (nv) {
+    shift(5, R9, 2);
+    alu(4, 0x09, R9, R8);
+  }
+  if (v) {
+    opr(1, 0x0FB6, R10, R10);
+    shift(4, R10, 1);
+    alu(4, 0x09, R10, R8);
+  }
+  if (c) {
+    opr(1, 0x0FB6, RAX, RAX);
+    alu(4, 0x09, RAX, R8);
+  }
+  load(RAX, tls(&cpu::PS.Word));
+  opri(4, I_AND, RAX, mask);
+  alu(4, 0x09, R8, RAX);
+  store(tls(&cpu::PS.Word), RAX);
+}
+
+// jump to l if the branch br is taken with the flags in PS
+static void branch(const uint32_t br, const uint32_t l) {
+  uint32_t mask = 0;
+  for (uint32_t f = 0; f < 16; f++) {
+    mask |= taken(br, f) << f;
+  }
+  if (mask == 0xFFFF) {
+    jmp(l);
+    return;
+  }
+  load(RAX, tls(&cpu::PS.Word));
+  opri(4, I_AND, RAX, 15);
+  movi(RCX, mask);
+  opr(4, 0x0FA3, RAX, RCX); // bt ecx, eax
+  jcc(CC_B, l);
+}
+
+// R7 after a branch or SOB at the end of the block, ret as the result
+static void fork(const uint32_t l, const uint32_t t, const uint32_t ret) {
+  leave(ipc + 2, ipc, ret);
+  bind(l);
+  leave(t, ipc, ret);
+}
+
+// an instruction the code does, i of the block. its operands are
+// checked before anything changes, a failed check leaves at the
+// instruction with the saved registers put back.
+static void op(const uint32_t i, const uint32_t k, const bool fuse) {
+  const bcache::op &o = blk->ops[i];
+  const uint32_t instr = o.instr;
+  const uint32_t n = blk->n;
+  r7 = ipc + 2;
+  if (k == K_BR) {
+    pn++;
+    pns += o.ns;
+    const uint32_t t = label();
+    branch(instr, t);
+    fork(t, target(instr, r7), n);
+    return;
+  }
+  if (k == K_SOB) {
+    const uint32_t r = instr >> 6 & 7, t = label();
+    pn++;
+    pns += o.ns;
+    if (home[r] >= 0) {
+      opri(4, I_SUB, home[r], 1);
+    } else {
+      opmi(4, I_SUB, tls(&cpu::R[r]), 1);
+    }
+    jcc(CC_NE, t);
+    fork(t, r7 - ((instr & 077) << 1), n);
+    return;
+  }
+  const uint32_t l = k == K_ADD || k == K_SUB ? 2 : 2 - (instr >> 15);
+  const uint32_t s = instr >> 6 & 077, d = instr & 077;
+  uint32_t saved[2], nsaved = 0;
+  for (uint32_t j = twoop(k) ? 0 : 1; j < 2; j++) {
+    const uint32_t v = j ? d : s;
+    if ((v & 7) == 7 || (v >> 3 & 7) < 2 || (v >> 3 & 7) > 5) {
+      continue;
+    }
+    if (nsaved == 0 || saved[0] != (v & 7)) {
+      saved[nsaved] = v & 7;
+      getr(RAX, v & 7);
+      store({ RSP, -1, 1, (int32_t) (S_SAVE + 8 * nsaved) }, RAX);
+      nsaved++;
+    }
+  }
+  const uint32_t x = exitto(X_EXIT, i, saved, nsaved);
+  if (twoop(k)) {
+    const opnd so = ea(s, l, RSI, false, x);
+    value(so, l, RSI, RSI);
+  }
+  const opnd dop = ea(d, l, RDI, writes(k), x);
+  if (k != K_MOV && k != K_CLR) {
+    value(dop, l, RDX, RDI);
+  }
+  // no faults from here
+  const int w = l == 2 ? 2 : 1;
+  const uint32_t msb = l == 2 ? 0x8000 : 0x80;
+  switch (k) {
+    case K_MOV:
+      mov(RCX, RSI);
+      alu(w, 0x85, RCX, RCX);
+      flags(0xFFF1, false, false);
+      if (dop.kind == O_REG && l == 1) {
+        opr(1, 0x0FBE, RCX, RCX); // movsx ecx, cl
+        opri(4, I_AND, RCX, 0xFFFF);
+        setr(dop.r, RCX);
+      }
+      break;
+    case K_CMP:
+      alu(w, 0x39, RDX, RSI);
+      flags(0xFFF0, true, true);
+      break;
+    case K_BIT:
+      mov(RCX, RSI);
+      alu(w, 0x21, RDX, RCX);
+      flags(0xFFF1, false, false);
+      break;
+    case K_BIC:
+      mov(RCX, RSI);
+      opri(4, I_XOR, RCX, msb | (msb - 1));
+      alu(w, 0x21, RDX, RCX);
+      flags(0xFFF1, false, false);
+      break;
+    case K_BIS:
+      mov(RCX, RSI);
+      alu(w, 0x09, RDX, RCX);
+      flags(0xFFF1, false, false);
+      break;
+    case K_ADD:
+      mov(RCX, RDX);
+      alu(2, 0x01, RSI, RCX);
+      flags(0xFFF0, true, true);
+      break;
+    case K_SUB:
+      mov(RCX, RDX);
+      alu(2, 0x29, RSI, RCX);
+      flags(0xFFF0, true, true);
+      break;
+    case K_CLR:
+      load(RAX, tls(&cpu::PS.Word));
+      opri(4, I_AND, RAX, 0xFFF0);
+      opri(4, I_OR, RAX, 4);
+      store(tls(&cpu::PS.Word), RAX);
+      alu(4, 0x31, RCX, RCX);
+      break;
+    case K_INC:
+      mov(RCX, RDX);
+      opri(w, I_ADD, RCX, 1);
+      flags(0xFFF1, false, false, true);
+      break;
+    case K_DEC:
+      mov(RCX, RDX);
+      opri(w, I_SUB, RCX, 1);
+      flags(0xFFF1, true, false);
+      break;
+    case K_TST:
+      alu(w, 0x85, RDX, RDX);
+      flags(0xFFF0, false, false);
+      break;
+  }
+  if (writes(k) && !(k == K_MOV && dop.kind == O_REG && l == 1)) {
+    pn++;
+    pns += o.ns;
+    const uint32_t inval = exitto(X_INVAL, i, nullptr, 0);
+    pn--;
+    pns -= o.ns;
+    put(dop, l, inval);
+  }
+  pn++;
+  pns += o.ns;
+  if (fuse) {
+    // CMPX and TSTX run the branch that follows, the block ends there
+    const bcache::op &b = blk->ops[i + 1];
+    const uint32_t f = k == K_CMP ? cpu::FUSE_CMPBR : cpu::FUSE_TSTBR;
+    opmi(4, I_ADD, tls(&cpu::fused[f]), 1);
+    opmi(4, I_ADD, tls(&cpu::fusedinstr[f]), 2);
+    pn++;
+    pns += b.ns;
+    const uint32_t t = label();
+    branch(b.instr, t);
+    const uint32_t after = ipc + o.len + 2;
+    leave(after, ipc, (i + 1) | JIT_STOP);
+    bind(t);
+    leave(target(b.instr, after), ipc, (i + 1) | JIT_STOP);
+  }
+}
+
+// an instruction through its handler as run() does it, the block goes
+// on if the handler left R7 after it and nothing asks to stop
+static void callout(const uint32_t i) {
+  const bcache::op &o = blk->ops[i];
+  account(pn, pns + o.ns);
+  pn = 0;
+  pns = 0;
+  writeback();
+  movmi(tls(&cpu::PC), ipc);
+  movmi(tls(&cpu::R[7]), ipc + 2);
+  movi(RDI, o.instr);
+  call((const void *) o.fn);
+  opmi(8, I_ADD, tls(&sched::icount), 1);
+  if (i + 1 == blk->n) {
+    movi(RAX, blk->n);
+    jmp(epilogue);
+    return;
+  }
+  reload();
+  const uint32_t x = exitto(X_STOP, i, nullptr, 0);
+  opmi(4, I_CMP, tls(&cpu::R[7]), ipc + o.len);
+  jcc(CC_NE, x);
+  load(RAX, tls(&bcache::gen));
+  opm(4, 0x3B, RAX, { RSP, -1, 1, S_GEN });
+  jcc(CC_NE, x);
+  load(RAX, tls(&cpu::PS.Word));
+  shift(5, RAX, 5);
+  opri(4, I_AND, RAX, 7);
+  opm(4, 0x39, RAX, tls(&cpu::irqlevel)); // cmp irqlevel, eax
+  jcc(CC_A, x);
+  opm(8, 0x8B, RAX, tls(&sched::icount));
+  opm(8, 0x3B, RAX, tls(&sched::next));
+  jcc(CC_AE, x);
+  opmi(4, I_CMP, tls(&sched::work), 0);
+  jcc(CC_NE, x);
+}
+
+static void stubcode(const stub &s) {
+  bind(s.label);
+  pn = s.n;
+  pns = s.ns;
+  switch (s.kind) {
+    case X_EXIT:
+      for (uint32_t k = 0; k < s.nsaved; k++) {
+        load(RAX, { RSP, -1, 1, (int32_t) (S_SAVE + 8 * k) });
+        setr(s.saved[k], RAX);
+      }
+      opmi(8, I_ADD, tls(&exits), 1);
+      writeback();
+      movmi(tls(&cpu::R[7]), s.pc);
+      account(pn, pns);
+      if (s.i) {
+        movmi(tls(&cpu::PC), s.prev);
+      }
+      movi(RAX, s.i);
+      jmp(epilogue);
+      break;
+    case X_INVAL:
+      call((const void *) bcache::invalidate);
+      leave(s.next, s.pc, (s.i + 1) | JIT_STOP);
+      break;
+    case X_STOP:
+      movi(RAX, (s.i + 1) | JIT_STOP);
+      jmp(epilogue);
+      break;
+  }
+}
+
+// R0-R6 by their uses in the ops the code does, the most used get the
+// host registers
+static void allocate(const bool *nat) {
+  uint32_t uses[7] = {};
+  for (uint32_t i = 0; i < blk->n; i++) {
+    if (!nat[i]) {
+      continue;
+    }
+    const uint32_t instr = blk->ops[i].instr;
+    const uint32_t k = kind(instr);
+    if (k == K_SOB) {
+      uses[instr >> 6 & 7] += 2;
+    } else if (k != K_BR) {
+      if (twoop(k) && (instr >> 6 & 7) != 7) {
+        uses[instr >> 6 & 7]++;
+      }
+      if ((instr & 7) != 7) {
+        uses[instr & 7]++;
+      }
+    }
+  }
+  for (uint32_t r = 0; r < 8; r++) {
+    home[r] = -1;
+  }
+  for (uint32_t h = 0; h < 4; h++) {
+    uint32_t best = 7;
+    for (uint32_t r = 0; r < 7; r++) {
+      if (home[r] < 0 && uses[r] && (best == 7 || uses[r] > uses[best])) {
+        best = r;
+      }
+    }
+    if (best == 7) {
+      break;
+    }
+    home[best] = hosts[h];
+  }
+}
+
+// can op i of the block be done here, and does it take the branch after it
+static bool doable(const uint32_t i, const uint32_t pc, const uint32_t pa, bool &fuse) {
+  const bcache::op &o = blk->ops[i];
+  const uint32_t instr = o.instr;
+  const uint32_t k = kind(instr);
+  const bool last = i + 1 == blk->n;
+  const uint32_t next = last ? 0 : blk->ops[i + 1].instr;
+  fuse = false;
+  if (k == K_CALL) {
+    return false;
+  }
+  if (k == K_BR) {
+    return true;
+  }
+  if (k == K_SOB) {
+    return (instr >> 6 & 7) != 7;
+  }
+  const uint32_t s = instr >> 6 & 077, d = instr & 077;
+  if ((twoop(k) && !usable(s, false)) || !usable(d, writes(k))) {
+    return false;
+  }
+  const uint32_t len = 2 + 2 * (words(d) + (twoop(k) ? words(s) : 0));
+  if (len != o.len || (pa & 077) + len > 0100) {
+    return false; // the operand words are not all in the chunk of the block
+  }
+  // the fusions of MOVX, CLRX, CMPX and TSTX look at the next word
+  if ((k == K_MOV && (instr & 0177070) == 0012020) || (k == K_CLR && (instr & 0177770) == 0005020)) {
+    return !last && (next & 0177077) != 0077002;
+  }
+  if (k == K_CMP || k == K_TST) {
+    if (last) {
+      return false;
+    }
+    if (isbranch(next)) {
+      // a TST (Rn) or TST @#a polling loop is skipped forward by TSTX
+      if (k == K_TST && target(next, pc + len + 2) == pc &&
+          (((instr & 070) == 010 && (instr & 7) != 7) || (instr & 077) == 037)) {
+        return false;
+      }
+      fuse = true;
+    }
+  }
+  return true;
+}
+
+static bool compile(bcache::block *b) {
+  blk = b;
+  at = 0;
+  nlabels = 0;
+  nfixups = 0;
+  nstubs = 0;
+  overflow = false;
+  tlsbase = (intptr_t) cpu::R;
+  mmuon = mmu::SR0 & 1;
+  bits22 = mmu::SR3 & mmu::SR3_22;
+  parmask = bits22 ? 0177777 : 07777;
+  pbase = cpu::curuser ? 060 | ((mmu::SR3 & mmu::SR3_UD) ? 8 : 0) : (mmu::SR3 & mmu::SR3_KD) ? 8 : 0;
+  bool nat[BC_OPS], fuse[BC_OPS];
+  uint32_t n = b->n;
+  uint32_t pc = cpu::R[7], pa = b->pa;
+  for (uint32_t i = 0; i < n; i++) {
+    nat[i] = doable(i, pc, pa, fuse[i]);
+    if (fuse[i]) {
+      n = i + 1; // the branch runs in the op before it
+    }
+    pc += b->ops[i].len;
+    pa += b->ops[i].len;
+  }
+  allocate(nat);
+  epilogue = label();
+  for (const int r : { RBX, RBP, R12, R13, R14, R15 }) {
+    push(r);
+  }
+  opri(8, I_SUB, RSP, S_FRAME);
+  movi64(RBP, tlsbase);
+  opm(8, 0x8B, R15, tls(&unibus::core16));
+  load(RAX, tls(&bcache::gen));
+  store({ RSP, -1, 1, S_GEN }, RAX);
+  reload();
+  pn = 0;
+  pns = 0;
+  ipc = cpu::R[7];
+  ipa = b->pa;
+  ppc = ipc;
+  for (uint32_t i = 0; i < n; i++) {
+    if (nat[i]) {
+      op(i, kind(b->ops[i].instr), fuse[i]);
+      native++;
+    } else {
+      callout(i);
+      called++;
+    }
+    ppc = ipc;
+    ipc += b->ops[i].len;
+    ipa += b->ops[i].len;
+  }
+  const bcache::op &last = b->ops[n - 1];
+  if (nat[n - 1] && kind(last.instr) != K_BR && kind(last.instr) != K_SOB && !fuse[n - 1]) {
+    leave(ipc, ipc - last.len, n);
+  }
+  const uint32_t ns = nstubs;
+  for (uint32_t k = 0; k < ns; k++) {
+    stubcode(stubs[k]);
+  }
+  bind(epilogue);
+  opri(8, I_ADD, RSP, S_FRAME);
+  for (const int r : { R15, R14, R13, R12, RBP, RBX }) {
+    pop(r);
+  }
+  b1(0xC3);
+  for (uint32_t k = 0; k < nfixups && !overflow; k++) {
+    const fixup &f = fixups[k];
+    if (labels[f.label] < 0) {
+      overflow = true;
+      break;
+    }
+    const int32_t d = labels[f.label] - (int32_t) (f.at + 4);
+    memcpy(&buf[f.at], &d, 4);
+  }
+  if (overflow) {
+    return false;
+  }
+  if (used + at > JIT_CODE) {
+    // full, the blocks are built and compiled again
+    resets++;
+    used = 0;
+    bcache::flush();
+    return false;
+  }
+  memcpy(code + used, buf, at);
+  b->code = code + used;
+  used += (at + 15) & ~15;
+  compiled++;
+  return true;
+}
+
+uint32_t run(bcache::block *b) {
+  const uint32_t key = cpu::curuser | (mmu::SR0 & 1) << 1 | mmu::SR3 << 2;
+  if (b->vpc != cpu::R[7] || b->key != key) {
+    if (!code) {
+      void *m = mmap(nullptr, JIT_CODE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (m == MAP_FAILED) {
+        Serial.printf("jit: no memory for the code, the blocks run their handlers\r\n");
+        enabled = false;
+        return 0;
+      }
+      code = (uint8_t *) m;
+    }
+    b->code = nullptr;
+    b->vpc = cpu::R[7];
+    b->key = key;
+    if (!compile(b)) {
+      failed++;
+      return 0;
+    }
+  }
+  if (!b->code || sched::icount + b->n + 2 > sched::next) {
+    return 0;
+  }
+  runs++;
+  return ((uint32_t (*)()) b->code)();
+}
+
+void reset() {
+  used = 0;
+  bcache::flush();
+}
+
+};
+
+#endif
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+#include <pdp11.h>
+#include "bcache.h"
+
+// x86-64 code for the blocks of bcache, host builds only. a compiled
+// block keeps R0-R6 in host registers where it uses them, translates
+// its core operands inline through the mmu pages and does the common
+// instructions (MOV, CMP, BIT, BIC, BIS, ADD, SUB, CLR, INC, DEC, TST,
+// the branches and SOB) natively, the others call their handlers.
+//
+// an instruction checks its operands before it changes anything: a
+// fault, the io page, an odd address or missing core leaves the block
+// at that instruction with the state as before it, the handlers of the
+// block go on from there and take the trap. writes to code end the
+// block after the instruction like a write from a handler would.
+//
+// the code is compiled for the virtual pc, the mode and the mmu setup
+// of the first run and runs only when those are the same, the handler
+// ops of the block are the fallback for everything else and the only
+// path on the teensy. blocks verify checks the compiled run against the
+// interpreter like the handler run.
+#define JIT_CODE (16 << 20) // bytes of code per machine
+#define JIT_STOP 0x80000000 // run() result: the block has to end
+
+namespace jit {
+
+    extern MACHINE_STATE bool enabled;
+    extern MACHINE_STATE uint32_t compiled, failed, resets;
+    extern MACHINE_STATE uint32_t native, called; // ops compiled natively and as handler calls
+    extern MACHINE_STATE uint64_t runs, exits;    // compiled runs, side exits to the handlers
+
+    // run the compiled code of b from its first op, compile it if the
+    // code is missing or was made for another pc or mapping. the result
+    // is the number of ops that ran, with JIT_STOP if the block has to
+    // end after them, 0 if the code can not run.
+    uint32_t run(bcache::block *b);
+    void reset();
+
+};
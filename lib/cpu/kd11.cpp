@@ -0,0 +1,177 @@
+#include <Arduino.h>
+#include <pdp11.h>
+#include "kd11.h"
+#include "snap.h"
+
+namespace kd11 {
+
+MACHINE_STATE uint64_t cycles;
+MACHINE_STATE uint32_t speed = 0;
+
+// address mode times in ns, indexed by mode
+static const uint16_t none[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+static const uint16_t src[8]  = { 0, 780, 840, 1740, 840, 1740, 1460, 2360 };
+static const uint16_t dst[8]  = { 0, 1400, 1400, 2300, 1460, 2360, 2300, 3200 }; // read modify write
+static const uint16_t dmov[8] = { 0, 900, 900, 1800, 960, 1860, 1800, 2700 };    // write only
+static const uint16_t drd[8]  = { 0, 780, 840, 1740, 840, 1740, 1460, 2360 };    // read only
+static const uint16_t jmp[8]  = { 0, 1040, 1300, 1540, 1300, 1540, 1540, 2440 };
+
+struct op {
+  uint32_t base;
+  const uint16_t *src;
+  const uint16_t *dst;
+};
+
+enum {
+  OP_ILL, OP_MOV, OP_DOP, OP_CMP, OP_SOP, OP_TST, OP_CLR, OP_SHF, OP_BR,
+  OP_SOB, OP_JMP, OP_JSR, OP_RTS, OP_RTI, OP_MARK, OP_MFPI, OP_MTPI,
+  OP_TRAP, OP_CC, OP_HALT, OP_RESET, OP_MUL, OP_DIV, OP_ASH, OP_XOR, OP_FPP,
+  OP_N
+};
+
+static const op ops[OP_N] = {
+  { 0,     none, none }, // OP_ILL, the trap is counted separately
+  { 900,   src,  dmov }, // MOV
+  { 990,   src,  dst  }, // ADD SUB BIC BIS
+  { 990,   src,  drd  }, // CMP BIT
+  { 990,   none, dst  }, // COM INC DEC NEG ADC SBC SWAB SXT
+  { 990,   none, drd  }, // TST
+  { 990,   none, dmov }, // CLR
+  { 1140,  none, dst  }, // ROR ROL ASR ASL
+  { 760,   none, none }, // Bxx
+  { 1360,  none, none }, // SOB
+  { 0,     none, jmp  }, // JMP
+  { 1120,  none, jmp  }, // JSR
+  { 1860,  none, none }, // RTS
+  { 2760,  none, none }, // RTI RTT
+  { 2560,  none, none }, // MARK
+  { 2720,  none, drd  }, // MFPI
+  { 2720,  none, dmov }, // MTPI
+  { 4800,  none, none }, // EMT TRAP IOT BPT
+  { 900,   none, none }, // CLx SEx
+  { 1800,  none, none }, // HALT WAIT
+  { 70000000, none, none }, // RESET, INIT is asserted for 70 ms
+  { 8880,  none, drd  }, // MUL
+  { 11300, none, drd  }, // DIV
+  { 2640,  none, drd  }, // ASH ASHC, without the time per shift
+  { 990,   none, dst  }, // XOR
+  { 4000,  none, drd  }, // FP11, an average, operands are 2 or 4 words
+};
+
+// operation class by instr >> 6, 64k instructions in 1k
+static MACHINE_STATE uint8_t opclass[02000];
+static MACHINE_STATE uint32_t t0;
+static MACHINE_STATE uint64_t c0;
+
+static uint32_t classify(const uint32_t instr) {
+  switch (instr & 0070000) {
+    case 0010000: return OP_MOV;
+    case 0020000: return OP_CMP;
+    case 0030000: return OP_CMP;
+    case 0040000: return OP_DOP;
+    case 0050000: return OP_DOP;
+  }
+  switch (instr & 0170000) {
+    case 0060000: return OP_DOP;
+    case 0160000: return OP_DOP;
+    case 0170000: return OP_FPP;
+  }
+  switch (instr & 0177000) {
+    case 0004000: return OP_JSR;
+    case 0070000: return OP_MUL;
+    case 0071000: return OP_DIV;
+    case 0072000: return OP_ASH;
+    case 0073000: return OP_ASH;
+    case 0074000: return OP_XOR;
+    case 0077000: return OP_SOB;
+    case 0104000: return OP_TRAP;
+  }
+  switch (instr & 0077700) {
+    case 0005000: return OP_CLR;
+    case 0005700: return OP_TST;
+    case 0006000: case 0006100: case 0006200: case 0006300: return OP_SHF;
+    case 0005100: case 0005200: case 0005300: case 0005400:
+    case 0005500: case 0005600: case 0006700: return OP_SOP;
+  }
+  switch (instr & 0177700) {
+    case 0000100: return OP_JMP;
+    case 0000300: return OP_SOP;
+    case 0006400: return OP_MARK;
+    case 0006500: return OP_MFPI;
+    case 0006600: return OP_MTPI;
+    case 0106500: return OP_MFPI; // MFPD
+    case 0106600: return OP_MTPI; // MTPD
+  }
+  if ((instr & 0177400) >= 0000400 && (instr & 0177400) <= 0003400) {
+    return OP_BR;
+  }
+  if ((instr & 0177400) >= 0100000 && (instr & 0177400) <= 0103400) {
+    return OP_BR;
+  }
+  return OP_ILL;
+}
+
+// the class table is indexed by the top ten bits, the operand-less
+// instructions below 0000400 are sorted out in time()
+void init() {
+  for (uint32_t i = 0; i < 02000; i++) {
+    opclass[i] = classify(i << 6);
+  }
+  sync();
+}
+
+uint32_t time(const uint32_t instr) {
+  uint32_t c = opclass[instr >> 6];
+  if (instr < 0000400) {
+    if ((instr & 0177770) == 0000200) {
+      c = OP_RTS;
+    } else if ((instr & 0177740) == 0000240) {
+      c = OP_CC;
+    } else if (instr <= 0000001) {
+      c = OP_HALT;
+    } else if (instr == 0000002 || instr == 0000006) {
+      c = OP_RTI;
+    } else if (instr == 0000003 || instr == 0000004) {
+      c = OP_TRAP;
+    } else if (instr == 0000005) {
+      c = OP_RESET;
+    }
+  }
+  const op &o = ops[c];
+  return o.base + o.src[(instr >> 9) & 7] + o.dst[(instr >> 3) & 7];
+}
+
+// restart the governor, after a pause in the console or a speed change
+void sync() {
+  t0 = micros();
+  c0 = cycles;
+}
+
+// called between batches, holds the guest to speed times a real 11/40
+void govern() {
+  if (speed == 0) {
+    return;
+  }
+  const uint32_t target = (uint32_t)((cycles - c0) / 1000 / speed);
+  uint32_t elapsed = micros() - t0;
+  if (elapsed > target + 20000) {
+    sync(); // the host fell behind, don't race to catch up
+    return;
+  }
+  while (elapsed < target) {
+    elapsed = micros() - t0;
+  }
+  if (elapsed > 1000000) {
+    sync();
+  }
+}
+
+// the governor starts over from the restored guest time
+void snapshot(snap::io &s) {
+  s(cycles);
+  if (s.load) {
+    sync();
+  }
+}
+
+};
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+#include <pdp11.h>
+
+// KD11-A instruction timing. the execution time of an 11/40 instruction
+// is base + source mode + destination mode time, from the instruction
+// timing tables of the 11/40 processor handbook (core memory). the
+// microcycle of the KD11-A varies, so the model counts guest time in ns.
+#define KD11_TRAP 4800 // ns, trap and interrupt service
+
+namespace kd11 {
+
+    extern MACHINE_STATE uint64_t cycles; // guest time in ns
+    extern MACHINE_STATE uint32_t speed;  // governor, multiple of a real 11/40, 0 unlimited
+
+    void init();
+    uint32_t time(uint32_t instr);
+    void govern();
+    void sync();
+    void snapshot(snap::io &s);
+
+};
@@ -0,0 +1,134 @@
+#include <Arduino.h>
+#include <SdFat.h>
+#include <pdp11.h>
+#include "cpu.h"
+#include "tbuf.h"
+
+namespace tbuf {
+
+MACHINE_STATE bool on = false;
+MACHINE_STATE uint16_t lo = 0, hi = 0177777;
+MACHINE_STATE uint8_t mode = 0;
+MACHINE_STATE uint32_t stopvec = UINT32_MAX;
+MACHINE_STATE uint32_t post = 16;
+MACHINE_STATE uint32_t count;
+
+static MACHINE_STATE entry *ring;
+static MACHINE_STATE entry *cur;       // instruction in execution
+static MACHINE_STATE uint16_t regs[7]; // R0-R6 before it
+static MACHINE_STATE uint32_t stopping;
+
+// the registers the current instruction changed
+static void finish() {
+  if (!cur) {
+    return;
+  }
+  uint32_t k = 0;
+  for (uint32_t i = 0; i < 7; i++) {
+    if ((cpu::R[i] & 0xFFFF) != regs[i]) {
+      cur->changed |= 1 << i;
+      if (k < 3) {
+        cur->val[k++] = cpu::R[i];
+      }
+    }
+  }
+  cur = nullptr;
+}
+
+static entry *next() {
+  entry *e = &ring[count++ % TB_ENTRIES];
+  memset(e, 0, sizeof(*e));
+  return e;
+}
+
+bool start() {
+  if (!ring) {
+    ring = (entry *) malloc(TB_ENTRIES * sizeof(entry));
+    if (!ring) {
+      return false;
+    }
+  }
+  cur = nullptr;
+  stopping = 0;
+  on = true;
+  return true;
+}
+
+void stop() {
+  finish();
+  on = false;
+}
+
+void clear() {
+  cur = nullptr;
+  count = 0;
+}
+
+// before the instruction at pc runs
+void insn(const uint16_t pc, const uint16_t instr) {
+  finish();
+  if (stopping && --stopping == 0) {
+    on = false;
+    return;
+  }
+  const bool user = cpu::curuser;
+  if (pc < lo || pc > hi || (mode && (mode == 2) != user)) {
+    return;
+  }
+  cur = next();
+  cur->pc = pc;
+  cur->instr = instr;
+  cur->ps = cpu::PS.Word;
+  cur->flags = user ? TB_USER : 0;
+  for (uint32_t i = 0; i < 7; i++) {
+    regs[i] = cpu::R[i];
+  }
+}
+
+// an operand address from aget()
+void ea(const uint32_t a) {
+  if (cur && (cur->flags & TB_NEA) < 2) {
+    cur->ea[cur->flags & TB_NEA] = a;
+    cur->flags++;
+  }
+}
+
+void trap(const uint16_t vec, const bool irq) {
+  finish();
+  entry *e = next();
+  e->pc = cpu::R[7];
+  e->instr = vec;
+  e->ps = cpu::PS.Word;
+  e->flags = (cpu::curuser ? TB_USER : 0) | (irq ? TB_IRQ : TB_TRAP);
+  if (vec == stopvec && !stopping) {
+    stopping = post + 1;
+  }
+}
+
+const entry *last(const uint32_t i) {
+  if (!ring || i >= count || i >= TB_ENTRIES) {
+    return nullptr;
+  }
+  return &ring[(count - 1 - i) % TB_ENTRIES];
+}
+
+// "TBUF", the entry size and the number of entries, then the entries
+// oldest first
+bool save(const char *path) {
+  FsFile f;
+  if (!f.open(path, O_CREAT|O_TRUNC|O_WRITE)) {
+    return false;
+  }
+  finish();
+  const uint32_t n = min(count, (uint32_t) TB_ENTRIES);
+  const uint32_t head[3] = { 0x46554254, sizeof(entry), n };
+  bool ok = f.write(head, sizeof(head)) == sizeof(head);
+  for (uint32_t i = n; i > 0 && ok; i--) {
+    ok = f.write(last(i - 1), sizeof(entry)) == sizeof(entry);
+  }
+  f.sync();
+  f.close();
+  return ok;
+}
+
+};
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+#include <pdp11.h>
+
+// binary instruction trace. every recorded instruction leaves its pc,
+// instruction word, psw, operand addresses and the registers it changed
+// in a ring, traps and interrupts leave their vector. filters on the pc
+// range and the mode select what is recorded, a trap through the stop
+// vector freezes the ring a number of entries later.
+#if defined(TEENSYDUINO)
+#define TB_ENTRIES 4096
+#else
+#define TB_ENTRIES 65536
+#endif
+
+namespace tbuf {
+
+    enum {
+      TB_NEA  = 3,      // operand addresses taken
+      TB_USER = 1 << 2,
+      TB_TRAP = 1 << 3, // instr is the vector
+      TB_IRQ  = 1 << 4,
+    };
+
+    struct entry {
+      uint16_t pc;
+      uint16_t instr;
+      uint16_t ps;      // before the instruction
+      uint8_t flags;
+      uint8_t changed;  // R0-R6 written by the instruction
+      uint16_t ea[2];   // operand virtual addresses
+      uint16_t val[3];  // new values of the first three changed registers
+    };
+
+    extern MACHINE_STATE bool on;
+    extern MACHINE_STATE uint16_t lo, hi;   // pc range
+    extern MACHINE_STATE uint8_t mode;      // 0 any, 1 kernel, 2 user
+    extern MACHINE_STATE uint32_t stopvec;  // UINT32_MAX none
+    extern MACHINE_STATE uint32_t post;     // entries recorded after the stop vector
+    extern MACHINE_STATE uint32_t count;    // entries recorded since the clear
+
+    bool start();
+    void stop();
+    void clear();
+    void insn(uint16_t pc, uint16_t instr);
+    void ea(uint32_t a);
+    void trap(uint16_t vec, bool irq);
+    const entry *last(uint32_t i); // i entries back, 0 the newest
+    bool save(const char *path);
+
+};
@@ -1,17 +1,30 @@
 #include <Arduino.h>
 #include <pdp11.h>
 #include "dl11.h"
+#include "snap.h"
 #include "cpu.h"
 #include "console.h"
+#include "sched.h"
+#include "rr.h"
 
 namespace dl11 {
 
-  uint32_t RCSR; // 777560
-  uint32_t RBUF; // 777562
-  uint32_t XCSR; // 777564
-  uint32_t XBUF; // 777566
+  MACHINE_STATE Stream *port = &Serial;
+
+  MACHINE_STATE uint32_t RCSR; // 777560
+  MACHINE_STATE uint32_t RBUF; // 777562
+  MACHINE_STATE uint32_t XCSR; // 777564
+  MACHINE_STATE uint32_t XBUF; // 777566
   
-  uint32_t count;
+  MACHINE_STATE uint64_t txdone; // guest time the character in XBUF is sent
+
+  // type-ahead fifo between the host serial port and RBUF. characters are 
+  // fed into RBUF only after the guest has read the previous one.
+  MACHINE_STATE uint8_t  rxfifo[RX_FIFO_SIZE];
+  MACHINE_STATE uint32_t rxhead, rxtail;
+  MACHINE_STATE uint32_t rxdelay = RX_DELAY; // instructions between two characters
+  MACHINE_STATE uint64_t rxready;            // guest time the next character may be fed
+  MACHINE_STATE bool     paste = false;      // bulk paste, feed characters without delay
 
   void reset() {
     RCSR = 0;
@@ -20,7 +33,17 @@ namespace dl11 {
     XBUF = 0;
   }
 
+  uint32_t rxpending() {
+    return (rxhead - rxtail) & (RX_FIFO_SIZE - 1);
+  }
+
+  void rxflush() {
+    rxhead = rxtail = 0;
+    rxready = 0;
+  }
+
   static void addchar(const char c) {
+    rr::input(c);
     RCSR |= 0x80;
 	  RBUF = c;
     if (RCSR & (1 << 6)) { // int enabled
@@ -28,9 +51,26 @@ namespace dl11 {
     }
   }
 
+  // a character of a replay, straight into RBUF
+  void inject(const uint8_t c) {
+    addchar(c);
+  }
+
+  static void rxput(const char c) {
+    const uint32_t next = (rxhead + 1) & (RX_FIFO_SIZE - 1);
+    if (next == rxtail) { // full, drop like a real uart would
+      return;
+    }
+    rxfifo[rxhead] = c;
+    rxhead = next;
+  }
+
   void poll() {
-    if (Serial.available()) {
-      char c = Serial.read();
+    while (port->available()) {
+      if (rxpending() == RX_FIFO_SIZE - 1 && port->peek() != 0x10) {
+        break; // fifo full, leave the rest in the host buffer
+      }
+      char c = port->read();
       switch (c) {
         case 0x10: // ctrl-p
           console::loop(true);
@@ -40,16 +80,29 @@ namespace dl11 {
           toggle_trace();
           break;
         default:
-          addchar(c);
+          if (rr::mode != rr::RR_REPLAY) { // the log has the input
+            rxput(c);
+          }
+      }
+    }
+    if ((rxhead != rxtail) && !(RCSR & 0x80)) {
+      if (sched::icount >= rxready) {
+        addchar(rxfifo[rxtail]);
+        rxtail = (rxtail + 1) & (RX_FIFO_SIZE - 1);
+        rxready = sched::icount + (paste ? 0 : rxdelay);
+      } else {
+        sched::at(sched::EV_DL11, rxready);
       }
     }
     if ((XCSR & 0x80) == 0) {
-      if (++count > 64) { // 32: change this and unibus errors happen .oO(?)
-        Serial.write(XBUF & 0x7f);        
+      if (sched::icount >= txdone) {
+        port->write(XBUF & 0x7f);        
         XCSR |= 0x80;
         if (XCSR & (1 << 6)) {
           cpu::interrupt(INTTTYOUT, 4);
         }
+      } else {
+        sched::at(sched::EV_DL11, txdone);
       }
     }    
   }
@@ -65,6 +118,9 @@ namespace dl11 {
       case 0777562:
         if (RCSR & 0x80) {
           RCSR &= 0xff7e;
+          if (rxhead != rxtail) {
+            sched::at(sched::EV_DL11, rxready);
+          }
           return RBUF;
         }
         return 0;
@@ -100,11 +156,33 @@ namespace dl11 {
       case 0777566:
         XBUF = v & 0xff;
         XCSR &= 0xff7f;
-        count = 0;
+        // 32: change this and unibus errors happen .oO(?)
+        txdone = sched::icount + 64;
+        sched::at(sched::EV_DL11, txdone);
         break;
       default:
         Serial.printf("dl11: write16 to invalid address: %06o\r\n", a); // " + ostr(a, 6))
         panic();
     }
   }
+
+  // the registers and the type-ahead, the console stream stays as it is.
+  // a save from the console runs inside poll(), its event is not queued,
+  // so a restore polls at once. the event queue is loaded before.
+  void snapshot(snap::io &s) {
+    s(RCSR);
+    s(RBUF);
+    s(XCSR);
+    s(XBUF);
+    s(txdone);
+    s(rxfifo);
+    s(rxhead);
+    s(rxtail);
+    s(rxdelay);
+    s(rxready);
+    if (s.load) {
+      sched::at(sched::EV_DL11, sched::icount);
+    }
+  }
+
 };
@@ -1,8 +1,27 @@
+#pragma once
+
+#include <pdp11.h>
+
+// receive fifo size, must be a power of 2
+#define RX_FIFO_SIZE 1024
+// default number of polls between two characters fed into RBUF
+#define RX_DELAY 2000
+
 namespace dl11 {
 
+    // the console stream, the usb serial port unless a machine was
+    // started with its own
+    extern MACHINE_STATE Stream *port;
+    extern MACHINE_STATE uint32_t rxdelay;
+    extern MACHINE_STATE bool paste;
+
     uint16_t read16(uint32_t a);
     void write16(uint32_t a, uint16_t v);
     void reset();
     void poll();
+    uint32_t rxpending();
+    void rxflush();
+    void inject(uint8_t c);
+    void snapshot(snap::io &s);
 
 };
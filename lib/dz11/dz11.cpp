@@ -0,0 +1,633 @@
+#include <Arduino.h>
+#include <pdp11.h>
+#include "dz11.h"
+#include "snap.h"
+#include "cpu.h"
+#include "sched.h"
+#include "rr.h"
+
+#if !defined(TEENSYDUINO)
+#include <fcntl.h>
+#include <errno.h>
+#include <termios.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#endif
+
+#define DEBUG_DZ11 0
+
+// CSR 760100
+#define DZ_MAINT (1 << 3)
+#define DZ_CLR   (1 << 4)
+#define DZ_MSE   (1 << 5)  // master scan enable
+#define DZ_RIE   (1 << 6)  // receiver interrupt enable
+#define DZ_RDONE (1 << 7)  // receiver done
+#define DZ_SAE   (1 << 12) // silo alarm enable
+#define DZ_SA    (1 << 13) // silo alarm
+#define DZ_TIE   (1 << 14) // transmitter interrupt enable
+#define DZ_TRDY  (1 << 15) // transmitter ready
+#define DZ_CSRW  (DZ_MAINT|DZ_MSE|DZ_RIE|DZ_SAE|DZ_TIE)
+
+// RBUF 760102
+#define DZ_DVAL  (1 << 15)
+
+// LPR 760102 (write)
+#define DZ_RXON  (1 << 12)
+
+namespace dz11 {
+
+  MACHINE_STATE uint16_t CSR; // 760100 control and status
+  MACHINE_STATE uint16_t TCR; // 760104 transmit control, line enable and dtr
+  MACHINE_STATE uint16_t TDR; // 760106 transmit data, break bits
+
+  MACHINE_STATE uint16_t silo[DZ_SILO];
+  MACHINE_STATE uint32_t shead, scount;
+  MACHINE_STATE uint32_t rxscan; // next line to move into the silo
+  MACHINE_STATE uint8_t msr;     // carrier of the lines as the guest sees it
+
+  MACHINE_STATE struct line lines[DZ_LINES];
+  MACHINE_STATE bool active = false;
+
+  static bool fput(struct fifo &f, const uint8_t c) {
+    const uint32_t next = (f.head + 1) & (DZ_FIFO - 1);
+    if (next == f.tail) {
+      return false;
+    }
+    f.buf[f.head] = c;
+    f.head = next;
+    return true;
+  }
+
+  static int fget(struct fifo &f) {
+    if (f.head == f.tail) {
+      return -1;
+    }
+    const uint8_t c = f.buf[f.tail];
+    f.tail = (f.tail + 1) & (DZ_FIFO - 1);
+    return c;
+  }
+
+  static bool ffull(const struct fifo &f) {
+    return ((f.head + 1) & (DZ_FIFO - 1)) == f.tail;
+  }
+
+#if defined(TEENSYDUINO)
+
+  static const uint32_t speeds[16] = {
+    50, 75, 110, 134, 150, 300, 600, 1200, 1800, 2000, 2400, 3600, 4800, 7200, 9600, 19200
+  };
+
+  static HardwareSerial *const serials[] = {
+    &Serial1, &Serial2, &Serial3, &Serial4, &Serial5, &Serial6, &Serial7,
+#if defined(ARDUINO_TEENSY41)
+    &Serial8,
+#endif
+  };
+  #define NSERIALS (sizeof(serials) / sizeof(serials[0]))
+
+  static Stream *stream(const struct line &l) {
+    switch (l.port) {
+      case PORT_SERIAL:
+        return serials[l.unit - 1];
+#if defined(USB_DUAL_SERIAL) || defined(USB_TRIPLE_SERIAL)
+      case PORT_USB:
+        if (l.unit == 1) {
+          return &SerialUSB1;
+        }
+#if defined(USB_TRIPLE_SERIAL)
+        return &SerialUSB2;
+#endif
+#endif
+    }
+    return NULL;
+  }
+
+  static bool open_port(struct line &l, const char *port, uint32_t arg) {
+    if (!strncmp(port, "serial", 6)) {
+      l.unit = atoi(port + 6);
+      if (l.unit < 1 || l.unit > NSERIALS) {
+        return false;
+      }
+      l.port = PORT_SERIAL;
+      serials[l.unit - 1]->begin(arg ? arg : 9600);
+      l.carrier = true;
+      return true;
+    }
+#if defined(USB_DUAL_SERIAL) || defined(USB_TRIPLE_SERIAL)
+    if (!strncmp(port, "usb", 3)) {
+      l.unit = atoi(port + 3);
+#if defined(USB_TRIPLE_SERIAL)
+      if (l.unit < 1 || l.unit > 2) {
+#else
+      if (l.unit != 1) {
+#endif
+        return false;
+      }
+      l.port = PORT_USB;
+      l.carrier = true;
+      return true;
+    }
+#endif
+    return false;
+  }
+
+  static void close_port(struct line &l) {
+    if (l.port == PORT_SERIAL) {
+      serials[l.unit - 1]->end();
+    }
+  }
+
+  static void set_speed(struct line &l) {
+    if (l.port == PORT_SERIAL) {
+      serials[l.unit - 1]->begin(speeds[(l.lpr >> 8) & 017]);
+    }
+  }
+
+  // move characters between the host port and the line fifos
+  static void service(struct line &l) {
+    Stream *s = stream(l);
+    if (s == NULL) {
+      return;
+    }
+    while (s->available() && !ffull(l.rx)) {
+      fput(l.rx, s->read());
+    }
+    int n = s->availableForWrite();
+    while (n-- > 0) {
+      const int c = fget(l.tx);
+      if (c < 0) {
+        break;
+      }
+      s->write((uint8_t) c);
+    }
+  }
+
+#else
+
+  static bool open_port(struct line &l, const char *port, uint32_t arg) {
+    if (!strcmp(port, "pty")) {
+      const int fd = posix_openpt(O_RDWR | O_NOCTTY);
+      if (fd < 0 || grantpt(fd) || unlockpt(fd)) {
+        return false;
+      }
+      struct termios t;
+      if (tcgetattr(fd, &t) == 0) {
+        cfmakeraw(&t);
+        tcsetattr(fd, TCSANOW, &t);
+      }
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+      l.port = PORT_PTY;
+      l.fd = fd;
+      l.carrier = true;
+      return true;
+    }
+    if (!strcmp(port, "tcp") && arg) {
+      const int fd = socket(AF_INET, SOCK_STREAM, 0);
+      if (fd < 0) {
+        return false;
+      }
+      const int on = 1;
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+      struct sockaddr_in sa;
+      memset(&sa, 0, sizeof(sa));
+      sa.sin_family = AF_INET;
+      sa.sin_port = htons(arg);
+      sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      if (bind(fd, (struct sockaddr *) &sa, sizeof(sa)) || listen(fd, 1)) {
+        close(fd);
+        return false;
+      }
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+      l.port = PORT_TCP;
+      l.unit = arg;
+      l.lfd = fd;
+      return true;
+    }
+    return false;
+  }
+
+  static void close_port(struct line &l) {
+    if (l.fd >= 0) {
+      close(l.fd);
+    }
+    if (l.lfd >= 0) {
+      close(l.lfd);
+    }
+    l.fd = l.lfd = -1;
+  }
+
+  static void set_speed(struct line &l) {
+    // pty and tcp lines run at host speed
+  }
+
+  static void hangup(struct line &l) {
+    close(l.fd);
+    l.fd = -1;
+    l.carrier = false;
+    l.rx.head = l.rx.tail = 0;
+    l.tx.head = l.tx.tail = 0;
+  }
+
+  // a write to a tcp peer which reset the connection must not raise
+  // SIGPIPE, that would end the emulator
+  static ssize_t send_port(const struct line &l, const void *buf, const size_t n) {
+    if (l.port == PORT_TCP) {
+      return send(l.fd, buf, n, MSG_NOSIGNAL);
+    }
+    return write(l.fd, buf, n);
+  }
+
+  static void service(struct line &l) {
+    if (l.port == PORT_TCP && l.fd < 0) {
+      l.fd = accept(l.lfd, NULL, NULL);
+      if (l.fd < 0) {
+        return;
+      }
+      fcntl(l.fd, F_SETFL, fcntl(l.fd, F_GETFL) | O_NONBLOCK);
+      // telnet: will echo, will suppress go ahead, the guest does the echoing
+      static const uint8_t iac[] = { 0377, 0373, 0001, 0377, 0373, 0003 };
+      if (send_port(l, iac, sizeof(iac)) < 0) {
+        hangup(l);
+        return;
+      }
+      l.carrier = true;
+    }
+    uint8_t buf[DZ_FIFO];
+    uint32_t room = (l.rx.tail - l.rx.head - 1) & (DZ_FIFO - 1);
+    if (room) {
+      const ssize_t n = read(l.fd, buf, room);
+      if (n == 0 || (n < 0 && errno != EAGAIN && errno != EIO)) {
+        if (l.port == PORT_TCP) {
+          hangup(l);
+          return;
+        }
+      }
+      for (ssize_t i = 0; i < n; i++) {
+        if (l.port == PORT_TCP && buf[i] == 0377 && i + 1 < n) {
+          // strip telnet commands, IAC IAC is a literal 0377
+          if (buf[i + 1] == 0377) {
+            fput(l.rx, buf[++i]);
+          } else {
+            i += (buf[i + 1] >= 0373) ? 2 : 1;
+          }
+          continue;
+        }
+        fput(l.rx, buf[i]);
+      }
+    }
+    uint32_t n = 0;
+    while (l.tx.head != l.tx.tail && n < sizeof(buf)) {
+      buf[n++] = fget(l.tx);
+    }
+    if (n) {
+      const ssize_t w = send_port(l, buf, n);
+      if (w < 0 && l.port == PORT_TCP && errno != EAGAIN) { // EPIPE, ECONNRESET
+        hangup(l);
+        return;
+      }
+      // put back what the host did not take
+      for (ssize_t i = n - 1; i >= (w < 0 ? 0 : w); i--) {
+        l.tx.tail = (l.tx.tail - 1) & (DZ_FIFO - 1);
+        l.tx.buf[l.tx.tail] = buf[i];
+      }
+    }
+  }
+
+#endif
+
+  static void update_rx() {
+    const uint16_t old = CSR;
+    if (scount) {
+      CSR |= DZ_RDONE;
+    } else {
+      CSR &= ~DZ_RDONE;
+    }
+    if ((CSR & DZ_SAE) && scount >= DZ_ALARM) {
+      CSR |= DZ_SA;
+    } else {
+      CSR &= ~DZ_SA;
+    }
+    if (!(CSR & DZ_RIE)) {
+      return;
+    }
+    // one interrupt per edge, the guest drains the silo in its handler
+    const uint16_t mask = (CSR & DZ_SAE) ? DZ_SA : DZ_RDONE;
+    if ((CSR & mask) && !(old & mask)) {
+      cpu::interrupt(INTDZRX, 5);
+    }
+  }
+
+  static void scan_tx() {
+    if (!(CSR & DZ_MSE)) {
+      CSR &= ~DZ_TRDY;
+      return;
+    }
+    if (CSR & DZ_TRDY) {
+      return;
+    }
+    const uint32_t tline = (CSR >> 8) & 7;
+    for (uint32_t i = 1; i <= DZ_LINES; i++) {
+      const uint32_t ln = (tline + i) & 7;
+      if ((TCR & (1 << ln)) && !ffull(lines[ln].tx)) {
+        CSR = (CSR & ~(7 << 8)) | (ln << 8) | DZ_TRDY;
+        if (CSR & DZ_TIE) {
+          cpu::interrupt(INTDZTX, 5);
+        }
+        return;
+      }
+    }
+  }
+
+  // fill the silo from the line fifos, round robin. a replay has the
+  // characters in its log, what the host sends meanwhile is dropped.
+  static void fill_silo() {
+    if (rr::mode == rr::RR_REPLAY) {
+      for (uint32_t i = 0; i < DZ_LINES; i++) {
+        lines[i].rx.head = lines[i].rx.tail = 0;
+      }
+      return;
+    }
+    if (!(CSR & DZ_MSE)) {
+      return;
+    }
+    for (uint32_t i = 0; i < DZ_LINES && scount < DZ_SILO; i++) {
+      const uint32_t ln = (rxscan + i) & 7;
+      struct line &l = lines[ln];
+      if (!(l.lpr & DZ_RXON)) {
+        continue;
+      }
+      int c;
+      while (scount < DZ_SILO && (c = fget(l.rx)) >= 0) {
+        silo[(shead + scount) % DZ_SILO] = DZ_DVAL | (ln << 8) | c;
+        scount++;
+        rr::line(ln, c);
+      }
+    }
+    rxscan = (rxscan + 1) & 7;
+  }
+
+  // the carrier of the host ports reaches the guest at the polls, or
+  // from the log of a replay
+  static void modem() {
+    if (rr::mode == rr::RR_REPLAY) {
+      return;
+    }
+    uint8_t co = 0;
+    for (uint32_t i = 0; i < DZ_LINES; i++) {
+      if (lines[i].carrier) {
+        co |= 1 << i;
+      }
+    }
+    if (co != msr) {
+      msr = co;
+      rr::modem(co);
+    }
+  }
+
+  // a character of a replay, it went into the silo at this instruction
+  void inject(const uint32_t ln, const uint8_t c) {
+    if (scount < DZ_SILO) {
+      silo[(shead + scount) % DZ_SILO] = DZ_DVAL | ((ln & 7) << 8) | c;
+      scount++;
+    }
+    update_rx();
+  }
+
+  void setmodem(const uint8_t co) {
+    msr = co;
+  }
+
+  void poll() {
+    if (active) {
+      sched::after(sched::EV_DZ11, DZ_POLL);
+    }
+    for (uint32_t i = 0; i < DZ_LINES; i++) {
+      if (lines[i].port != PORT_NONE) {
+        service(lines[i]);
+      }
+    }
+    modem();
+    fill_silo();
+    update_rx();
+    scan_tx();
+  }
+
+  bool attach(const uint32_t ln, const char *port, const uint32_t arg) {
+    if (ln >= DZ_LINES) {
+      return false;
+    }
+    detach(ln);
+    if (!open_port(lines[ln], port, arg)) {
+      lines[ln].port = PORT_NONE;
+      return false;
+    }
+    active = true;
+    sched::after(sched::EV_DZ11, DZ_POLL);
+    return true;
+  }
+
+  void detach(const uint32_t ln) {
+    if (ln >= DZ_LINES || lines[ln].port == PORT_NONE) {
+      return;
+    }
+    close_port(lines[ln]);
+    lines[ln].port = PORT_NONE;
+    lines[ln].carrier = false;
+    lines[ln].rx.head = lines[ln].rx.tail = 0;
+    lines[ln].tx.head = lines[ln].tx.tail = 0;
+    active = false;
+    for (uint32_t i = 0; i < DZ_LINES; i++) {
+      if (lines[i].port != PORT_NONE) {
+        active = true;
+      }
+    }
+    modem();
+  }
+
+  void describe(const uint32_t ln, char *buf, const uint32_t n) {
+    const struct line &l = lines[ln];
+    switch (l.port) {
+      case PORT_SERIAL:
+        snprintf(buf, n, "serial%d", l.unit);
+        break;
+      case PORT_USB:
+        snprintf(buf, n, "usb%d", l.unit);
+        break;
+#if !defined(TEENSYDUINO)
+      case PORT_PTY:
+        snprintf(buf, n, "pty %s", ptsname(l.fd));
+        break;
+#endif
+      case PORT_TCP:
+        snprintf(buf, n, "tcp %d%s", l.unit, l.carrier ? " (connected)" : "");
+        break;
+      default:
+        snprintf(buf, n, "-");
+    }
+  }
+
+  void reset() {
+    CSR = 0;
+    TCR = 0;
+    TDR = 0;
+    shead = scount = 0;
+    rxscan = 0;
+    for (uint32_t i = 0; i < DZ_LINES; i++) {
+      lines[i].lpr = 0;
+    }
+  }
+
+  uint16_t read16(const uint32_t a) {
+    if (DEBUG_DZ11) {
+      Serial.printf("dz11: read16: %06o\r\n", a);
+    }
+    switch (a) {
+      case 0760100:
+        return CSR;
+      case 0760102: {
+        if (scount == 0) {
+          return 0;
+        }
+        const uint16_t v = silo[shead];
+        shead = (shead + 1) % DZ_SILO;
+        scount--;
+        update_rx();
+        // the receiver interrupt is level triggered without the silo alarm
+        if (scount && (CSR & DZ_RIE) && !(CSR & DZ_SAE)) {
+          cpu::interrupt(INTDZRX, 5);
+        }
+        return v;
+      }
+      case 0760104:
+        return TCR;
+      case 0760106:
+        return msr << 8;
+      default:
+        Serial.printf("dz11: invalid read16: %06o\r\n", a);
+        longjmp(trapbuf, INTBUS);
+    }
+    return 0; // unreached
+  }
+
+  void write16(const uint32_t a, const uint16_t v) {
+    if (DEBUG_DZ11) {
+      Serial.printf("dz11: write16: %06o: %06o\r\n", a, v);
+    }
+    switch (a) {
+      case 0760100: {
+        if (v & DZ_CLR) {
+          reset();
+          return;
+        }
+        const uint16_t old = CSR;
+        CSR = (CSR & ~DZ_CSRW) | (v & DZ_CSRW);
+        if ((CSR & DZ_RIE) && !(old & DZ_RIE) && (CSR & ((CSR & DZ_SAE) ? DZ_SA : DZ_RDONE))) {
+          cpu::interrupt(INTDZRX, 5);
+        }
+        if ((CSR & DZ_TIE) && !(old & DZ_TIE) && (CSR & DZ_TRDY)) {
+          cpu::interrupt(INTDZTX, 5);
+        }
+        if (rr::mode == rr::RR_OFF) {
+          fill_silo(); // with rr the silo fills at the polls only, the log has no other place
+        }
+        update_rx();
+        scan_tx();
+        break;
+      }
+      case 0760102: { // LPR
+        struct line &l = lines[v & 7];
+        const uint16_t old = l.lpr;
+        l.lpr = v & ~7;
+        if (((old ^ l.lpr) >> 8) & 017) {
+          set_speed(l);
+        }
+        break;
+      }
+      case 0760104:
+        TCR = v;
+        scan_tx();
+        break;
+      case 0760106:
+        TDR = (TDR & 0xFF) | (v & 0xFF00); // break bits
+        if (CSR & DZ_TRDY) {
+          struct line &l = lines[(CSR >> 8) & 7];
+          if (l.port != PORT_NONE) {
+            fput(l.tx, v & 0xFF);
+          }
+          CSR &= ~DZ_TRDY;
+          scan_tx();
+        }
+        break;
+      default:
+        Serial.printf("dz11: invalid write16: %06o\r\n", a);
+        longjmp(trapbuf, INTBUS);
+    }
+  }
+
+  // a byte read of the receiver buffer takes the character off the
+  // silo like a word read
+  uint16_t read8(const uint32_t a) {
+    const uint16_t v = read16(a & ~1);
+    return (a & 1) ? v >> 8 : v & 0xFF;
+  }
+
+  // the halves of a register are written alone, a read-modify-write
+  // would pop the silo or send the carrier bits as breaks. the line
+  // parameter register is write only, the other byte goes in as 0.
+  void write8(const uint32_t a, const uint16_t v) {
+    if (DEBUG_DZ11) {
+      Serial.printf("dz11: write8: %06o: %03o\r\n", a, v & 0xFF);
+    }
+    const uint16_t b = v & 0xFF;
+    switch (a) {
+      case 0760100:
+        write16(a, (CSR & 0xFF00) | b);
+        break;
+      case 0760101:
+        write16(a & ~1, (CSR & 0xFF) | b << 8);
+        break;
+      case 0760102:
+        write16(a, b);
+        break;
+      case 0760103:
+        write16(a & ~1, b << 8);
+        break;
+      case 0760104:
+        TCR = (TCR & 0xFF00) | b;
+        scan_tx();
+        break;
+      case 0760105:
+        TCR = (TCR & 0xFF) | b << 8;
+        scan_tx();
+        break;
+      case 0760106:
+        write16(a, (TDR & 0xFF00) | b);
+        break;
+      case 0760107:
+        TDR = (TDR & 0xFF) | b << 8; // break bits, nothing is sent
+        break;
+      default:
+        Serial.printf("dz11: invalid write8: %06o\r\n", a);
+        longjmp(trapbuf, INTBUS);
+    }
+  }
+
+  // the registers, the silo and the line parameters. the host ports
+  // stay attached as they are.
+  void snapshot(snap::io &s) {
+    s(CSR);
+    s(TCR);
+    s(TDR);
+    s(silo);
+    s(shead);
+    s(scount);
+    s(rxscan);
+    s(msr);
+    for (uint32_t i = 0; i < DZ_LINES; i++) {
+      s(lines[i].lpr);
+    }
+  }
+
+};
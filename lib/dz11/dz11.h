@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+#include <pdp11.h>
+
+// DZ11 8 line asynchronous multiplexer at 760100
+#define DZ_LINES 8
+#define DZ_SILO  64   // receiver silo depth
+#define DZ_ALARM 16   // silo alarm level
+#define DZ_FIFO  256  // per line host fifo, must be a power of 2
+#define DZ_POLL  1024 // instructions between two host polls
+
+namespace dz11 {
+
+    enum {
+        PORT_NONE,
+        PORT_SERIAL, // teensy hardware serial port
+        PORT_USB,    // teensy additional usb serial channel
+        PORT_PTY,    // host pseudo terminal
+        PORT_TCP,    // host tcp listener
+    };
+
+    struct fifo {
+        uint8_t  buf[DZ_FIFO];
+        uint32_t head, tail;
+    };
+
+    struct line {
+        uint8_t  port = PORT_NONE;
+        uint32_t unit = 0;   // serial port number, usb channel or tcp port
+        int      fd = -1;    // host: pty master or connected socket
+        int      lfd = -1;   // host: listening socket
+        uint16_t lpr = 0;    // line parameters
+        bool     carrier = false;
+        struct fifo rx, tx;
+    };
+
+    extern MACHINE_STATE struct line lines[DZ_LINES];
+    extern MACHINE_STATE bool active; // at least one line attached
+
+    bool attach(uint32_t ln, const char *port, uint32_t arg);
+    void detach(uint32_t ln);
+    void describe(uint32_t ln, char *buf, uint32_t n);
+
+    void reset();
+    void poll();
+    uint16_t read16(uint32_t a);
+    void write16(uint32_t a, uint16_t v);
+    uint16_t read8(uint32_t a);
+    void write8(uint32_t a, uint16_t v);
+    // the input of a replay: a character for the silo, the carrier bits
+    void inject(uint32_t ln, uint8_t c);
+    void setmodem(uint8_t co);
+    void snapshot(snap::io &s);
+
+};
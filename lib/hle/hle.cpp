@@ -0,0 +1,242 @@
+#include <Arduino.h>
+#include <SdFat.h>
+#include <pdp11.h>
+#include "cpu.h"
+#include "mmu.h"
+#include "unibus.h"
+#include "sched.h"
+#include "aout.h"
+#include "hle.h"
+#include "snap.h"
+
+namespace hle {
+
+MACHINE_STATE bool enabled = false;
+MACHINE_STATE uint16_t addr[HLE_N];
+MACHINE_STATE uint32_t calls[HLE_N];
+MACHINE_STATE uint32_t missed[HLE_N];
+const char *const names[HLE_N] = { "copyin", "copyout", "copyseg", "clearseg" };
+
+// first word of each routine in m40.s, a wrong namelist must not hit
+// some other code: jsr pc,copsu / mov PS,-(sp), absolute or relative
+static bool entry(const uint32_t h, const uint32_t w) {
+  return h < HLE_COPYSEG ? w == 0004767 : (w == 0013746 || w == 0016746);
+}
+
+// instructions the routine executes for n words, for the instruction count
+static uint32_t cost(const uint32_t h, const uint32_t n) {
+  switch (h) {
+    case HLE_COPYIN:  return 16 + 3 * n;
+    case HLE_COPYOUT: return 15 + 3 * n;
+    case HLE_COPYSEG: return 21 + 3 * 32;
+    default:          return 12 + 3 * 32;
+  }
+}
+
+// a file with "name address" lines, octal, or an a.out namelist
+bool load(const char *path) {
+  for (uint32_t i = 0; i < HLE_N; i++) {
+    addr[i] = 0;
+  }
+  if (aout::load(path)) {
+    char name[10];
+    for (uint32_t i = 0; i < HLE_N; i++) {
+      snprintf(name, sizeof(name), "_%s", names[i]);
+      const aout::sym *s = aout::find(name);
+      if (s) {
+        addr[i] = s->value;
+      }
+    }
+    return true;
+  }
+  FsFile f;
+  if (!f.open(path, O_READ)) {
+    return false;
+  }
+  while (f.available()) {
+    String s = f.readStringUntil('\n');
+    char name[16];
+    unsigned int a;
+    if (sscanf(s.c_str(), "%15s %o", name, &a) != 2 || name[0] == '#') {
+      continue;
+    }
+    const char *n = name[0] == '_' ? name + 1 : name;
+    for (uint32_t i = 0; i < HLE_N; i++) {
+      if (!strcmp(n, names[i])) {
+        addr[i] = a;
+      }
+    }
+  }
+  f.close();
+  return true;
+}
+
+// kernel data word, or instruction word with i, false if it can not
+// be read without a fault
+static bool kread(const uint32_t a, uint32_t &v, const bool i = false) {
+  uint32_t pa;
+  if ((a & 1) || !mmu::probe(a, false, false, pa, i) || pa >= unibus::memsize) {
+    return false;
+  }
+  v = unibus::core16[pa >> 1];
+  return true;
+}
+
+// check n words at virtual a in the given space, piece by piece at the
+// 8k page boundaries. copy() then repeats the walk without the checks.
+static bool check(uint32_t a, uint32_t n, const bool w, const bool user) {
+  while (n) {
+    const uint32_t k = min(n, (020000 - (a & 017777)) / 2);
+    uint32_t pa, last;
+    if ((a & 1) || !mmu::probe(a, w, user, pa) ||
+        !mmu::probe(a + (k - 1) * 2, w, user, last) || last >= unibus::memsize) {
+      return false;
+    }
+    a += 2 * k;
+    n -= k;
+    if (n && (a & 0xFFFF) == 0) {
+      return false; // wraps around the address space
+    }
+  }
+  return true;
+}
+
+static void copy(uint32_t src, const bool suser, uint32_t dst, const bool duser, uint32_t n) {
+  while (n) {
+    const uint32_t k = min(n, min((020000 - (src & 017777)) / 2, (020000 - (dst & 017777)) / 2));
+    uint32_t ps;
+    mmu::probe(src, false, suser, ps);
+    const uint32_t pd = mmu::decode(dst, true, duser); // sets the W bit
+    unibus::copy16(pd, ps, k);
+    src += 2 * k;
+    dst += 2 * k;
+    n -= k;
+  }
+}
+
+// physical pieces of n checked words at virtual a, at most one per page
+struct piece {
+  uint32_t pa;
+  uint32_t len;
+};
+
+static uint32_t pieces(uint32_t a, uint32_t n, const bool user, piece *p) {
+  uint32_t i = 0;
+  while (n) {
+    const uint32_t k = min(n, (020000 - (a & 017777)) / 2);
+    mmu::probe(a, false, user, p[i].pa);
+    p[i++].len = 2 * k;
+    a += 2 * k;
+    n -= k;
+  }
+  return i;
+}
+
+// physical overlap of the two ranges would make the word by word copy
+// differ from a block copy, those run in the interpreter
+static bool disjoint(uint32_t src, const bool suser, uint32_t dst, const bool duser, uint32_t n) {
+  piece ps[9], pd[9];
+  const uint32_t ns = pieces(src, n, suser, ps);
+  const uint32_t nd = pieces(dst, n, duser, pd);
+  for (uint32_t i = 0; i < ns; i++) {
+    for (uint32_t j = 0; j < nd; j++) {
+      if (ps[i].pa < pd[j].pa + pd[j].len && pd[j].pa < ps[i].pa + ps[i].len) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// return to pc, the caller read it off the stack before changing any state
+static void ret(const uint32_t h, const uint32_t n, const uint32_t pc) {
+  cpu::R[6] = (cpu::R[6] + 2) & 0xFFFF;
+  cpu::R[7] = pc;
+  calls[h]++;
+  sched::icount += cost(h, n) - 1;
+}
+
+// copyin(from, to, n) / copyout(from, to, n), r0 = 0 on success
+static bool copyio(const uint32_t h) {
+  uint32_t pc, from, to, n;
+  if (!kread(cpu::R[6], pc) || !kread(cpu::R[6] + 2, from) ||
+      !kread(cpu::R[6] + 4, to) || !kread(cpu::R[6] + 6, n)) {
+    return false;
+  }
+  const int32_t words = ((int16_t)n) >> 1; // asr r2
+  if (words <= 0) {
+    return false;
+  }
+  const bool in = h == HLE_COPYIN;
+  const bool user = cpu::prevuser; // mfpi/mtpi use the previous mode
+  if (!check(from, words, false, in ? user : false) ||
+      !check(to, words, true, in ? false : user) ||
+      !disjoint(from, in ? user : false, to, in ? false : user, words)) {
+    return false;
+  }
+  // the kernel stack below sp takes the saved registers and the words
+  // in flight, that is left out
+  copy(from, in ? user : false, to, in ? false : user, words);
+  cpu::R[0] = 0;
+  cpu::R[1] = (to + 2 * words) & 0xFFFF;
+  cpu::PS.Word = (cpu::PS.Word & ~017) | 004; // clr r0
+  ret(h, words, pc);
+  return true;
+}
+
+// copyseg(from, to) / clearseg(to), physical 64 byte clicks
+static bool seg(const uint32_t h) {
+  uint32_t pc, a0, a1 = 0;
+  if (!(mmu::SR0 & 1) || !kread(cpu::R[6], pc) || !kread(cpu::R[6] + 2, a0) ||
+      (h == HLE_COPYSEG && !kread(cpu::R[6] + 4, a1))) {
+    return false;
+  }
+  const uint32_t src = (a0 & 07777) << 6;
+  const uint32_t dst = (a1 & 07777) << 6;
+  if (h == HLE_COPYSEG) {
+    if (src + 0100 > unibus::memsize || dst + 0100 > unibus::memsize) {
+      return false;
+    }
+    if (src != dst) {
+      unibus::copy16(dst, src, 040);
+    }
+    cpu::R[0] = 0100;
+    cpu::R[1] = 020100;
+  } else {
+    if (src + 0100 > unibus::memsize) {
+      return false;
+    }
+    unibus::fill16(src, 0, 040);
+    cpu::R[0] = 0100;
+    cpu::R[1] = 0;
+  }
+  ret(h, 040, pc);
+  return true;
+}
+
+// called before the fetch in kernel mode
+bool hook(const uint32_t pc) {
+  for (uint32_t h = 0; h < HLE_N; h++) {
+    if (pc != addr[h] || addr[h] == 0) {
+      continue;
+    }
+    uint32_t w;
+    if (!kread(pc, w, true) || !entry(h, w)) {
+      missed[h]++;
+      return false;
+    }
+    const bool done = h < HLE_COPYSEG ? copyio(h) : seg(h);
+    if (!done) {
+      missed[h]++;
+    }
+    return done;
+  }
+  return false;
+}
+
+void snapshot(snap::io &s) {
+  s(enabled);
+  s(addr);
+}
+
+};
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+#include <pdp11.h>
+
+// high level emulation of the V6 kernel copy routines. when the kernel
+// calls one of them and the whole transfer can run without a fault, it
+// is done with memcpy/memset on core and the routine returns at once.
+// anything else falls back to the interpreter.
+namespace hle {
+
+    enum {
+      HLE_COPYIN,
+      HLE_COPYOUT,
+      HLE_COPYSEG,
+      HLE_CLEARSEG,
+      HLE_N
+    };
+
+    extern MACHINE_STATE bool enabled;
+    extern MACHINE_STATE uint16_t addr[HLE_N];   // kernel symbol addresses, 0 if unknown
+    extern MACHINE_STATE uint32_t calls[HLE_N];  // handled natively
+    extern MACHINE_STATE uint32_t missed[HLE_N]; // fell back to the interpreter
+    extern const char *const names[HLE_N];
+
+    bool load(const char *path);
+    bool hook(uint32_t pc);
+    void snapshot(snap::io &s);
+
+};
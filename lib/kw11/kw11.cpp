@@ -0,0 +1,45 @@
+#include <Arduino.h>
+#include <pdp11.h>
+#include "cpu.h"
+#include "sched.h"
+#include "kw11.h"
+#include "snap.h"
+#include "prof.h"
+
+namespace kw11 {
+
+MACHINE_STATE bool vclock = false;
+MACHINE_STATE uint32_t period = KW11_PERIOD;
+
+// set the done bit, interrupt if enabled. called from the host timer
+// isr in real time mode and from the event queue in virtual mode.
+void tick() {
+  if (vclock) {
+    sched::after(sched::EV_CLOCK, period);
+  }
+  cpu::LKS |= (1 << 7);
+  if (cpu::LKS & (1 << 6)) {
+    cpu::interrupt(INTCLOCK, 6);
+  }
+  prof::tick(false);
+}
+
+void setmode(const bool virt, const uint32_t n) {
+  vclock = virt;
+  if (n) {
+    period = n;
+  }
+  if (vclock) {
+    sched::cancel(sched::EV_CLOCK);
+    sched::after(sched::EV_CLOCK, period);
+  } else {
+    sched::cancel(sched::EV_CLOCK);
+  }
+}
+
+void snapshot(snap::io &s) {
+  s(vclock);
+  s(period);
+}
+
+};
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdint.h>
+#include <pdp11.h>
+
+// KW11-L line clock, 60 Hz. by default driven by a host timer, in
+// virtual mode by the guest instruction count.
+#define KW11_PERIOD 16667 // instructions per tick in virtual mode, 1 MIPS
+
+namespace kw11 {
+
+    extern MACHINE_STATE bool vclock;
+    extern MACHINE_STATE uint32_t period;
+
+    void tick();
+    void setmode(bool virt, uint32_t n);
+    void snapshot(snap::io &s);
+
+};
@@ -0,0 +1,113 @@
+#include <Arduino.h>
+#include <pdp11.h>
+#include "cpu.h"
+#include "unibus.h"
+#include "dl11.h"
+#include "rk05.h"
+#include "tm11.h"
+#include "sched.h"
+#include "kd11.h"
+#include "istat.h"
+#include "bcache.h"
+#include "snap.h"
+#include "rr.h"
+#include "machine.h"
+
+MACHINE_STATE jmp_buf trapbuf;
+MACHINE_STATE int trace = 0;
+
+namespace machine {
+
+// power on a machine with the images of c attached and the boot rom
+// loaded, or warm from a snapshot. the calling thread owns it from now on
+bool start(const config &c) {
+  if (c.console) {
+    dl11::port = c.console;
+  }
+  unibus::reset();
+  sched::reset();
+  kd11::init();
+  istat::init();
+  if (c.snapshot) {
+    return snap::restore(c.snapshot);
+  }
+  for (uint32_t i = 0; i < RK_NUM_DRV; i++) {
+    if (c.rk[i]) {
+      if (!rk11::attach(i, c.rk[i], c.ram)) {
+        return false;
+      }
+    }
+  }
+  for (uint32_t i = 0; i < TM_NUM_DRV; i++) {
+    if (c.tm[i]) {
+      if (!tm11::tmdata[i].file.open(c.tm[i], O_RDWR)) {
+        Serial.printf("could not open %s\r\n", c.tm[i]);
+        return false;
+      }
+      tm11::tmdata[i].attached = true;
+    }
+  }
+  cpu::reset();
+  return true;
+}
+
+// run instructions up to the next device deadline, devices are serviced
+// between the slices only. inside a slice only the pending work word and
+// the interrupt level are looked at. returns true if an interrupt was
+// taken, handleinterrupt() reused trapbuf, so the caller has to set it
+// up again before the next slice.
+bool slice() {
+  while (sched::icount < sched::next) {
+    if (bcache::enabled) {
+      cpu::run();             // counts the instructions itself
+    } else {
+      cpu::step();
+      sched::icount++;
+    }
+    if (cpu::irqpending()) {
+      cpu::handleinterrupt();
+      return true;
+    }
+    if (sched::work) {
+      break;
+    }
+  }
+  sched::run();
+  if (sched::work & sched::WORK_WAIT) {
+    sched::idle();
+    if (cpu::irqpending()) {
+      cpu::handleinterrupt(); // take it at the WAIT
+      return true;
+    }
+  }
+  return false;
+}
+
+// run until the guest time reaches n instructions, for headless runs.
+// the host timers and the governor run between the slices.
+void run(const uint64_t n) {
+  while (sched::icount < n) {
+    const uint16_t vec = setjmp(trapbuf);
+    if (vec) {
+      cpu::trapat(vec);
+    }
+    while (sched::icount < n && !slice()) {
+      yield();
+      kd11::govern();
+    }
+  }
+}
+
+// power off, a ram disk is written back to its image and a log closed
+void stop() {
+  rr::stop();
+  for (uint32_t i = 0; i < RK_NUM_DRV; i++) {
+    rk11::detach(i);
+  }
+  for (uint32_t i = 0; i < TM_NUM_DRV; i++) {
+    tm11::tmdata[i].file.close();
+    tm11::tmdata[i].attached = false;
+  }
+}
+
+};
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <pdp11.h>
+#include "rk05.h"
+#include "tm11.h"
+
+// instructions left to print over the serial port, see the trace command
+extern MACHINE_STATE int trace;
+
+// one PDP-11/40. its state lives in the device namespaces, all of it
+// MACHINE_STATE, so a host process can run an independent machine on
+// every thread. the teensy runs its single machine from loop().
+namespace machine {
+
+    struct config {
+      const char *rk[RK_NUM_DRV]; // disk images, nullptr leaves the drive empty
+      const char *tm[TM_NUM_DRV]; // tape images
+      Stream *console;            // dl11 stream, nullptr keeps the usb serial port
+      const char *snapshot;       // start from this snapshot, it attaches its own images
+      bool ram;                   // disks as ram packs, written back by stop()
+    };
+
+    bool start(const config &c);
+    bool slice();
+    void run(uint64_t n);
+    void stop();
+
+};
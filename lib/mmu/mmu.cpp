@@ -1,117 +1,162 @@
 #include <Arduino.h>
 #include <pdp11.h>
 #include "cpu.h"
+#include "unibus.h"
 #include "mmu.h"
+#include "snap.h"
 
 #define DEBUG_MMU 0
 
 namespace mmu {
 
-struct page {
-    uint16_t par;
-    uint16_t pdr;
-};
+// indexed by mode << 4 | data space << 3 | page, mode 0 kernel,
+// 1 supervisor, 3 user
+MACHINE_STATE page pages[64];
+MACHINE_STATE uint16_t SR0, SR1, SR2, SR3;
+// derived from SR3: the data page offset per mode and the par mask
+static MACHINE_STATE uint8_t dspace[4];
+static MACHINE_STATE uint16_t parmask = 07777;
 
-page pages[16];
-uint16_t SR0, SR1, SR2;
+void setsr3(const uint16_t v) {
+  SR3 = v & (SR3_UD | SR3_SD | SR3_KD | SR3_22 | SR3_UBM);
+  dspace[0] = (SR3 & SR3_KD) ? 8 : 0;
+  dspace[1] = (SR3 & SR3_SD) ? 8 : 0;
+  dspace[3] = (SR3 & SR3_UD) ? 8 : 0;
+  parmask = (SR3 & SR3_22) ? 0177777 : 07777;
+}
 
 void reset() {
   SR0 = 0;  
-  for (uint8_t i = 0; i < 16; i++) {
+  for (uint8_t i = 0; i < 64; i++) {
     pages[i].par = 0;
     pages[i].pdr = 0;
   }  
+  setsr3(0);
+}
+
+static inline uint32_t index(const uint16_t a, const bool user, const bool i) {
+  return user ? (060 | (i ? 0 : dspace[3]) | (a >> 13)) : ((i ? 0 : dspace[0]) | (a >> 13));
+}
+
+// the page frame, 22 bits. in 18 bit mode the top 8k are the io page
+static inline uint32_t frame(const page &p, const uint16_t a) {
+  const uint32_t pa = ((((a >> 6) & 0177) + (p.par & parmask)) << 6) + (a & 077);
+  if (SR3 & SR3_22) {
+    return pa & 017777777;
+  }
+  return (pa & 0760000) == 0760000 ? (pa | IOPAGE) : (pa & 0777777);
 }
-// crashes fs a is changed to 32bit
-uint32_t decode(const uint16_t a, const bool w, const bool user) {
+
+// abort the access through page i, err is the SR0 abort bit
+static void fault(const uint32_t err, const uint32_t i) {
+  SR0 = err | 1;
+  SR0 |= (i & 017) << 1; // page and data space
+  if (i & 060) {
+    SR0 |= (1 << 5) | (1 << 6);
+  }
+  SR2 = cpu::PC;
+  longjmp(trapbuf, INTFAULT);
+}
+
+uint32_t decode(const uint16_t a, const bool w, const bool user, const bool i) {
   if (SR0 & 1) {
     // mmu enabled
-    const uint8_t i = user ? ((a >> 13) + 8) : (a >> 13);
-    if (w && !(pages[i].pdr & 6)) {
-      SR0 = (1 << 13) | 1;
-      SR0 |= (a >> 12) & ~1;
-      if (user) {
-        SR0 |= (1 << 5) | (1 << 6);
-      }
-      SR2 = cpu::PC;
+    const uint32_t n = index(a, user, i);
+    page &p = pages[n];
+    if (w && !(p.pdr & 6)) {
       Serial.print(F("mmu::decode write to read-only page ")); Serial.println(a, OCT);
-      longjmp(trapbuf, INTFAULT);
+      fault(1 << 13, n);
     }
-    if (!(pages[i].pdr & 2)) {
-      SR0 = (1 << 15) | 1;
-      SR0 |= (a >> 12) & ~1;
-      if (user) {
-        SR0 |= (1 << 5) | (1 << 6);
-      }
-      SR2 = cpu::PC;
+    if (!(p.pdr & 2)) {
       Serial.print(F("mmu::decode read from no-access page ")); Serial.println(a, OCT);
-      longjmp(trapbuf, INTFAULT);
+      fault(1 << 15, n);
     }
     const uint8_t block = (a >> 6) & 0177;
-    const uint8_t disp = a & 077;
     // if ((p.ed() && (block < p.len())) || (!p.ed() && (block > p.len()))) {
-    if ((pages[i].pdr & 8) ? (block < ((pages[i].pdr >> 8) & 0x7f)) : (block > ((pages[i].pdr >>8) & 0x7f))) {
-      SR0 = (1 << 14) | 1;
-      SR0 |= (a >> 12) & ~1;
-      if (user) {
-        SR0 |= (1 << 5) | (1 << 6);
-      }
-      SR2 = cpu::PC;
+    if ((p.pdr & 8) ? (block < ((p.pdr >> 8) & 0x7f)) : (block > ((p.pdr >>8) & 0x7f))) {
       //Serial.printf("page %d length exceeded, address %06o (block %03o) is beyond length %03o\r\n", 
       //i, a, block, ((pages[i].pdr >> 8) & 0x7f));
-      longjmp(trapbuf, INTFAULT);
+      fault(1 << 14, n);
     }
     if (w) {
-      pages[i].pdr |= 1 << 6;
+      p.pdr |= 1 << 6;
     }
-    uint32_t addr = ((block + (pages[i].par & 07777)) << 6) + disp;
+    const uint32_t addr = frame(p, a);
     if (DEBUG_MMU) {
       Serial.print("decode: slow "); Serial.print(a, OCT); Serial.print(" -> "); Serial.println(addr, OCT);
     }
     return addr;
   }
   // mmu disabled, fast path
-  return a > 0167777 ? ((uint32_t)a) + 0600000 : a;                                      
+  return a > 0167777 ? ((uint32_t)a) + (IOPAGE - 0160000) : a;                                      
 }
 
-uint16_t read16(const uint32_t a) {
-  uint8_t i = (a & 017) >> 1;
-  if ((a >= 0772300) && (a < 0772320)) {
-    return pages[i].pdr;
+// decode without side effects, false if the access would abort
+bool probe(const uint16_t a, const bool w, const bool user, uint32_t &pa, const bool i) {
+  if (!(SR0 & 1)) {
+    pa = a > 0167777 ? ((uint32_t)a) + (IOPAGE - 0160000) : a;
+    return true;
+  }
+  const page &p = pages[index(a, user, i)];
+  if ((w && !(p.pdr & 6)) || !(p.pdr & 2)) {
+    return false;
   }
-  if ((a >= 0772340) && (a < 0772360)) {
-    return pages[i].par;
+  const uint8_t block = (a >> 6) & 0177;
+  if ((p.pdr & 8) ? (block < ((p.pdr >> 8) & 0x7f)) : (block > ((p.pdr >> 8) & 0x7f))) {
+    return false;
   }
-  if ((a >= 0777600) && (a < 0777620)) {
-    return pages[i + 8].pdr;
+  pa = frame(p, a);
+  return true;
+}
+
+// 772200 supervisor, 772300 kernel, 777600 user. in each block of 64
+// bytes the pdrs come first, then the pars, each I then D
+static page *reg(const uint32_t a, bool &par) {
+  uint32_t mode;
+  switch (a & 0777700) {
+    case 0772200: mode = 1; break;
+    case 0772300: mode = 0; break;
+    case 0777600: mode = 3; break;
+    default: return nullptr;
   }
-  if ((a >= 0777640) && (a < 0777660)) {
-    return pages[i + 8].par;
+  par = (a & 040) != 0;
+  return &pages[(mode << 4) | ((a >> 1) & 017)];
+}
+
+uint16_t read16(const uint32_t a) {
+  bool par;
+  const page *p = reg(a, par);
+  if (p) {
+    return par ? p->par : p->pdr;
   }
   Serial.print(F("mmu::read16 invalid address: ")); Serial.println(a, OCT);
   longjmp(trapbuf, INTBUS);
 }
 
 void write16(const uint32_t a, const uint16_t v) {
-  uint8_t i = ((a & 017) >> 1);
-  if ((a >= 0772300) && (a < 0772320)) {
-    pages[i].pdr = v;
-    return;
-  }
-  if ((a >= 0772340) && (a < 0772360)) {
-    pages[i].par = v;
-    return;
-  }
-  if ((a >= 0777600) && (a < 0777620)) {
-    pages[i + 8].pdr = v;
-    return;
-  }
-  if ((a >= 0777640) && (a < 0777660)) {
-    pages[i + 8].par = v;
+  bool par;
+  page *p = reg(a, par);
+  if (p) {
+    if (par) {
+      p->par = v;
+    } else {
+      p->pdr = v;
+    }
     return;
   }
   Serial.print(F("mmu::write16 invalid address: ")); Serial.println(a, OCT);
   longjmp(trapbuf, INTBUS);
 }
 
+void snapshot(snap::io &s) {
+  s(pages);
+  s(SR0);
+  s(SR1);
+  s(SR2);
+  s(SR3);
+  if (s.load) {
+    setsr3(SR3);
+  }
+}
+
 };
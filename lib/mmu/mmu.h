@@ -1,13 +1,40 @@
+#pragma once
+
+#include <pdp11.h>
+
+// KT11-C style memory management, 11/45 and 11/70 class. kernel,
+// supervisor and user mode each have 8 instruction and 8 data pages,
+// the data pages are used when enabled in SR3. with the 22 bit mode
+// of SR3 the page address registers are 16 bits wide, else 12.
 namespace mmu {
-  
-    extern uint16_t SR0;
-    extern uint16_t SR1;
-    extern uint16_t SR2;
 
-    // crashes is a is changed to 32bit
-    uint32_t decode(uint16_t a, bool w, bool user);
+    enum {
+      SR3_UD   = 1 << 0, // user data space
+      SR3_SD   = 1 << 1, // supervisor data space
+      SR3_KD   = 1 << 2, // kernel data space
+      SR3_22   = 1 << 4, // 22 bit mapping
+      SR3_UBM  = 1 << 5, // unibus map
+    };
+
+    struct page {
+        uint16_t par;
+        uint16_t pdr;
+    };
+
+    // indexed by mode << 4 | data space << 3 | page
+    extern MACHINE_STATE page pages[64];
+    extern MACHINE_STATE uint16_t SR0;
+    extern MACHINE_STATE uint16_t SR1;
+    extern MACHINE_STATE uint16_t SR2;
+    extern MACHINE_STATE uint16_t SR3;
+
+    // virtual to 22 bit physical, i selects the instruction space
+    uint32_t decode(uint16_t a, bool w, bool user, bool i = false);
+    bool probe(uint16_t a, bool w, bool user, uint32_t &pa, bool i = false);
     uint16_t read16(uint32_t a);
     void write16(uint32_t a, uint16_t v);
+    void setsr3(uint16_t v);
     void reset();
+    void snapshot(snap::io &s);
 
 };
@@ -0,0 +1,182 @@
+#include <Arduino.h>
+#include <Wire.h>
+#include <Adafruit_GFX.h>
+#include <Adafruit_LEDBackpack.h>
+#include <pdp11.h>
+#include "cpu.h"
+#include "rk05.h"
+#include "panel.h"
+
+namespace panel {
+
+uint32_t hz = PANEL_HZ;
+uint16_t tcounter; // clock ticks, bumped by the host timer
+
+static Adafruit_8x16matrix m70 = Adafruit_8x16matrix();
+static Adafruit_8x16matrix m71 = Adafruit_8x16matrix();
+static Adafruit_AlphaNum4  m72 = Adafruit_AlphaNum4();
+static Adafruit_AlphaNum4  m73 = Adafruit_AlphaNum4();
+
+static Adafruit_LEDBackpack *const pack[4] = { &m70, &m71, &m72, &m73 };
+static const uint8_t addr[4] = { 0x70, 0x71, 0x72, 0x73 };
+
+// what the backpacks show, a row is a matrix column pair or a digit
+static uint16_t shown[4][8];
+
+// register snapshot, a row is only redrawn if its word changed
+enum { S_R0, S_R1, S_R2, S_R3, S_R4, S_R5, S_R6, S_R7, S_PS, S_TC, S_RK, S_N };
+static uint32_t snap[S_N];
+static bool valid;
+
+static uint32_t last;
+
+static void writeByte(Adafruit_8x16matrix *mx, uint8_t line, uint8_t val) {
+  mx->drawPixel(line, 0, val & (1 << 0));
+  mx->drawPixel(line, 1, val & (1 << 1));
+  mx->drawPixel(line, 2, val & (1 << 2));
+  mx->drawPixel(line, 3, val & (1 << 3));
+  mx->drawPixel(line, 4, val & (1 << 4));
+  mx->drawPixel(line, 5, val & (1 << 5));
+  mx->drawPixel(line, 6, val & (1 << 6));
+  mx->drawPixel(line, 7, val & (1 << 7));
+}
+
+static void writeWord(Adafruit_8x16matrix *mx, uint8_t line, uint16_t val) {
+  writeByte(mx, line, val & 0xFF);
+  writeByte(mx, line + 8, val >> 8);
+}
+
+// eight octal digits, the low four on m73
+static void writeOctal(uint32_t val) {
+  for (int i = 0; i < 4; i++) {
+    m73.writeDigitAscii(3 - i, (val & 7) + 0x30);
+    val = val >> 3;
+  }
+  for (int i = 0; i < 4; i++) {
+    m72.writeDigitAscii(3 - i, (val & 7) + 0x30);
+    val = val >> 3;
+  }
+}
+
+// send the rows which differ from what the backpack shows, runs of
+// changed rows in one transfer using the HT16K33 address auto increment
+static void flush(const uint32_t n) {
+  const uint16_t *buf = pack[n]->displaybuffer;
+  uint32_t i = 0;
+  while (i < 8) {
+    if (buf[i] == shown[n][i]) {
+      i++;
+      continue;
+    }
+    Wire.beginTransmission(addr[n]);
+    Wire.write((uint8_t)(i * 2));
+    while (i < 8 && buf[i] != shown[n][i]) {
+      Wire.write(buf[i] & 0xFF);
+      Wire.write(buf[i] >> 8);
+      shown[n][i] = buf[i];
+      i++;
+    }
+    Wire.endTransmission();
+  }
+}
+
+static void flushall() {
+  for (uint32_t n = 0; n < 4; n++) {
+    flush(n);
+  }
+}
+
+// lamp test and banner
+void begin() {
+  for (uint32_t n = 0; n < 4; n++) {
+    pack[n]->begin(addr[n]);
+  }
+  m70.setRotation(3);
+  m71.setRotation(3);
+  for (int i = 0; i < 8; i++) {
+    writeWord(&m70, i, 0xFFFF);
+    writeWord(&m71, i, 0xFFFF);
+    for (int d = 0; d < 4; d++) {
+      m72.writeDigitAscii(d, 0x30 + i);
+      m73.writeDigitAscii(d, 0x30 + i);
+    }
+    for (uint32_t n = 0; n < 4; n++) {
+      pack[n]->writeDisplay();
+    }
+    delay(100);
+  }
+  for (uint32_t n = 0; n < 4; n++) {
+    pack[n]->clear();
+    pack[n]->writeDisplay();
+  }
+  m72.writeDigitAscii(0, 'P');
+  m72.writeDigitAscii(1, 'D');
+  m72.writeDigitAscii(2, 'P');
+  m72.writeDigitAscii(3, '1');
+  m73.writeDigitAscii(0, '1');
+  m73.writeDigitAscii(1, '/');
+  m73.writeDigitAscii(2, '4');
+  m73.writeDigitAscii(3, '0');
+  m72.writeDisplay();
+  m73.writeDisplay();
+  for (uint32_t n = 0; n < 4; n++) {
+    memcpy(shown[n], pack[n]->displaybuffer, sizeof(shown[n]));
+  }
+  valid = false;
+}
+
+// redraw the changed registers and push the changed rows. force redraws
+// everything, used by panic with the interrupts off.
+void refresh(const bool force) {
+  uint32_t now[S_N];
+  for (int i = 0; i < 8; i++) {
+    now[S_R0 + i] = uint16_t(cpu::R[i]);
+  }
+  now[S_PS] = cpu::PS.Word;
+  now[S_TC] = tcounter;
+  now[S_RK] = (rk11::cylinder << 12) | (rk11::sector);
+  if (force) {
+    valid = false;
+  }
+  // matrix layout: m70 R0 R2 R4 R6 .. PS, m71 R1 R3 R5 R7 .. tick counter
+  for (int i = 0; i < 8; i++) {
+    if (!valid || now[S_R0 + i] != snap[S_R0 + i]) {
+      writeWord(i & 1 ? &m71 : &m70, i >> 1, now[S_R0 + i]);
+    }
+  }
+  if (!valid || now[S_PS] != snap[S_PS]) {
+    writeWord(&m70, 7, now[S_PS]);
+  }
+  if (!valid || now[S_TC] != snap[S_TC]) {
+    writeWord(&m71, 7, now[S_TC]);
+  }
+  if (!valid || now[S_RK] != snap[S_RK]) {
+    writeOctal(now[S_RK]);
+  }
+  memcpy(snap, now, sizeof(snap));
+  valid = true;
+  flushall();
+}
+
+// called between batches from the main loop
+void poll() {
+  if (hz == 0) {
+    return;
+  }
+  const uint32_t t = micros();
+  if (t - last < 1000000 / hz) {
+    return;
+  }
+  last = t;
+  refresh(false);
+}
+
+// display register 777570 written from the console
+void display(const uint32_t val) {
+  writeOctal(val);
+  flush(2);
+  flush(3);
+  valid = false;
+}
+
+};
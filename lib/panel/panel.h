@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+
+// front panel, two 8x16 led matrices with the registers and two 4 digit
+// alphanumeric displays, on HT16K33 backpacks at i2c 0x70-0x73.
+// refreshed from the main loop, only changed rows go over the bus.
+#define PANEL_HZ 30
+
+namespace panel {
+
+    extern uint32_t hz; // refresh rate, 0 turns the refresh off
+    extern uint16_t tcounter;
+
+    void begin();
+    void poll();
+    void refresh(bool force);
+    void display(uint32_t val);
+
+};
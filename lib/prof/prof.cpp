@@ -0,0 +1,174 @@
+#include <Arduino.h>
+#include <SdFat.h>
+#include <pdp11.h>
+#include "cpu.h"
+#include "mmu.h"
+#include "unibus.h"
+#include "aout.h"
+#include "prof.h"
+
+#define PROF_FUNCS 128 // distinct functions in the report
+
+namespace prof {
+
+MACHINE_STATE bool enabled = false;
+MACHINE_STATE uint32_t every = 0;
+MACHINE_STATE sample ring[PROF_SAMPLES];
+MACHINE_STATE uint32_t total;
+MACHINE_STATE uint32_t ubase = UINT32_MAX;
+static MACHINE_STATE uint32_t ms;
+
+// data word of the mode without a fault
+static bool peek(const uint16_t a, const bool user, uint16_t &v) {
+  uint32_t pa;
+  if ((a & 1) || !mmu::probe(a, false, user, pa) || pa >= unibus::memsize) {
+    return false;
+  }
+  v = unibus::core16[pa >> 1];
+  return true;
+}
+
+// V6 C frames: csv leaves r5 pointing at the saved r5 of the caller,
+// the return address above it. the chain ends when r5 stops going up.
+static void take() {
+  sample &s = ring[total % PROF_SAMPLES];
+  const bool user = cpu::curuser;
+  s.pc = cpu::R[7];
+  s.user = user;
+  if (!mmu::probe(0, false, user, s.base, true)) {
+    s.base = 0;
+  }
+  uint16_t fp = cpu::R[5], next, ret;
+  s.depth = 0;
+  while (s.depth < PROF_DEPTH && peek(fp, user, next) && peek(fp + 2, user, ret)) {
+    s.stack[s.depth++] = ret;
+    if (next <= fp) {
+      break;
+    }
+    fp = next;
+  }
+  total++;
+}
+
+// called from kw11::tick() and from the 1 kHz host poll
+void tick(const bool host) {
+  if (!enabled || host != (every != 0)) {
+    return;
+  }
+  if (host && ++ms < every) {
+    return;
+  }
+  ms = 0;
+  take();
+}
+
+void reset() {
+  total = 0;
+  ms = 0;
+}
+
+// the symbol of a in the kernel or in the user program of ubase, a
+// user program is known by its base only
+static const aout::sym *lookup(const uint16_t a, const bool user, const uint32_t base) {
+  if (!user) {
+    return aout::lookup(a, aout::kernel);
+  }
+  return base == ubase ? aout::lookup(a, aout::user) : nullptr;
+}
+
+// symbol name without the C underscore, else the octal address
+static const char *fname(const uint16_t a, const bool user, const uint32_t base, char *buf, const uint32_t n) {
+  const aout::sym *s = lookup(a, user, base);
+  if (s) {
+    return s->name[0] == '_' ? s->name + 1 : s->name;
+  }
+  snprintf(buf, n, "%06o", a);
+  return buf;
+}
+
+// the n functions with the most samples, from the samples in the ring
+void report(Stream *dev, const uint32_t n) {
+  struct func {
+    const aout::sym *s;
+    uint16_t pc;  // the first sample, names an unresolved function
+    uint8_t user;
+    uint32_t base;
+    uint32_t count;
+  };
+  func *f = new func[PROF_FUNCS];
+  uint32_t nf = 0, other = 0;
+  const uint32_t ns = min(total, (uint32_t) PROF_SAMPLES);
+  for (uint32_t i = 0; i < ns; i++) {
+    const sample &s = ring[i];
+    const aout::sym *sym = lookup(s.pc, s.user, s.base);
+    // an unresolved user pc is one entry per process and address
+    const bool addr = !sym && s.user;
+    uint32_t j = 0;
+    while (j < nf && (f[j].s != sym || f[j].user != s.user ||
+                      (addr && (f[j].base != s.base || f[j].pc != s.pc)))) {
+      j++;
+    }
+    if (j == nf) {
+      if (nf == PROF_FUNCS) {
+        other++;
+        continue;
+      }
+      f[nf++] = { sym, s.pc, s.user, s.base, 0 };
+    }
+    f[j].count++;
+  }
+  dev->printf("%u samples, %u in the ring\r\n", total, ns);
+  for (uint32_t i = 0; i < n && i < nf; i++) {
+    uint32_t best = i;
+    for (uint32_t j = i + 1; j < nf; j++) {
+      if (f[j].count > f[best].count) {
+        best = j;
+      }
+    }
+    const func t = f[i];
+    f[i] = f[best];
+    f[best] = t;
+    char buf[24];
+    const char *name = fname(f[i].pc, f[i].user, f[i].base, buf, sizeof(buf));
+    if (!f[i].s && f[i].user) {
+      snprintf(buf, sizeof(buf), "user@%o:%06o", (unsigned int) f[i].base, f[i].pc);
+      name = buf;
+    }
+    const uint32_t pm = f[i].count * 1000 / ns;
+    dev->printf("%8u %3u.%u%% %s %s\r\n", f[i].count, pm / 10, pm % 10,
+      f[i].user ? "user  " : "kernel", name);
+  }
+  if (other) {
+    dev->printf("%8u in more than %d functions\r\n", other, PROF_FUNCS);
+  }
+  delete[] f;
+}
+
+// one line per sample for flamegraph.pl: unix or user@base, the callers
+// outermost first, the function of the pc, and a count of 1. the frames
+// of a process other than the one of the user namelist are addresses.
+bool fold(const char *path) {
+  FsFile f;
+  if (!f.open(path, O_CREAT|O_TRUNC|O_WRITE)) {
+    return false;
+  }
+  const uint32_t ns = min(total, (uint32_t) PROF_SAMPLES);
+  char line[16 * (PROF_DEPTH + 2)];
+  char buf[8];
+  bool ok = true;
+  for (uint32_t i = 0; i < ns && ok; i++) {
+    const sample &s = ring[i];
+    int len = s.user ? snprintf(line, sizeof(line), "user@%o", (unsigned int) s.base)
+                     : snprintf(line, sizeof(line), "unix");
+    for (uint32_t d = s.depth; d > 0; d--) {
+      len += snprintf(line + len, sizeof(line) - len, ";%s", fname(s.stack[d - 1], s.user, s.base, buf, sizeof(buf)));
+    }
+    len += snprintf(line + len, sizeof(line) - len, ";%s 1\n", fname(s.pc, s.user, s.base, buf, sizeof(buf)));
+    ok = f.write(line, len) == (size_t) len;
+  }
+  f.sync();
+  f.close();
+  return ok;
+}
+
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+#include <pdp11.h>
+
+// sampling profiler. on each KW11-L tick, or at up to 1 kHz of host
+// time, the guest pc, the mode, the physical address of the mode's
+// virtual 0 and the r5 frame chain go into a ring. the samples are
+// resolved against the kernel and a user namelist, see aout.h. the user
+// namelist belongs to the process with the base it was bound to, the
+// samples of the other processes stay addresses.
+#if defined(TEENSYDUINO)
+#define PROF_SAMPLES 2048
+#else
+#define PROF_SAMPLES 65536
+#endif
+#define PROF_DEPTH 8
+
+namespace prof {
+
+    struct sample {
+      uint16_t pc;
+      uint8_t user;
+      uint8_t depth;
+      uint32_t base;               // tells the user processes apart
+      uint16_t stack[PROF_DEPTH];  // return addresses, innermost first
+    };
+
+    extern MACHINE_STATE bool enabled;
+    extern MACHINE_STATE uint32_t every; // host ms between samples, 0 on the line clock
+    extern MACHINE_STATE sample ring[PROF_SAMPLES];
+    extern MACHINE_STATE uint32_t total; // samples taken since the reset
+    extern MACHINE_STATE uint32_t ubase; // base of the process of aout::user
+
+    void tick(bool host);
+    void reset();
+    void report(Stream *dev, uint32_t n);
+    bool fold(const char *path);
+
+};
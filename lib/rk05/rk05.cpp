@@ -5,20 +5,23 @@
 #include <pdp11.h>
 #include "unibus.h"
 #include "rk05.h"
+#include "snap.h"
 #include "cpu.h"
+#include "rr.h"
 
 #define DEBUG_RK05 0
 
 extern RTC_DS3231 rtc;
 
-bool patch_super = false;
+MACHINE_STATE bool patch_super = false;
 
 namespace rk11 {
 
-uint32_t RKBA, RKDS, RKER, RKCS, RKWC;
-uint32_t drive, sector, surface, cylinder;
+MACHINE_STATE uint32_t RKBA, RKDS, RKER, RKCS, RKWC;
+MACHINE_STATE uint32_t drive, sector, surface, cylinder;
 
-struct disk rkdata[RK_NUM_DRV];
+MACHINE_STATE struct disk rkdata[RK_NUM_DRV];
+MACHINE_STATE uint32_t ops;
 
 uint16_t read16(const uint32_t a) {
   if (DEBUG_RK05) {
@@ -82,6 +85,160 @@ void rkerror(const uint32_t e) {
   longjmp(trapbuf, INTBUS);
 }
 
+#if defined(TEENSYDUINO)
+extern "C" uint8_t external_psram_size;
+
+// the ram disks take fixed slots from the top of the psram down, the
+// core allocated below them shrinks to make room. owner is drive + 1.
+static uint8_t owner[RK_NUM_DRV];
+
+static uint32_t slotbase(const uint32_t k) {
+  return ((uint32_t) external_psram_size << 20) - (k + 1) * RK_SIZE;
+}
+
+static void setmax() {
+  unibus::memmax = min((uint32_t) external_psram_size << 20, (uint32_t) IOPAGE);
+  for (uint32_t k = 0; k < RK_NUM_DRV; k++) {
+    if (owner[k]) {
+      unibus::memmax = min(unibus::memmax, slotbase(k) & ~017777);
+    }
+  }
+}
+
+static uint8_t *ramalloc(const uint32_t n) {
+  for (uint32_t k = 0; k < RK_NUM_DRV; k++) {
+    if (owner[k]) {
+      continue;
+    }
+    if (((uint32_t) external_psram_size << 20) < (k + 1) * RK_SIZE || slotbase(k) < unibus::memsize) {
+      break;
+    }
+    owner[k] = n + 1;
+    setmax();
+    return (uint8_t *) 0x70000000 + slotbase(k);
+  }
+  return nullptr;
+}
+
+static void ramfree(const uint32_t n) {
+  for (uint32_t k = 0; k < RK_NUM_DRV; k++) {
+    if (owner[k] == n + 1) {
+      owner[k] = 0;
+    }
+  }
+  setmax();
+}
+#else
+static uint8_t *ramalloc(const uint32_t n) {
+  return (uint8_t *) malloc(RK_SIZE);
+}
+
+static void ramfree(const uint32_t n) {
+  free(rkdata[n].ram);
+}
+#endif
+
+// attach an image on drive n, ram loads it into memory, the pack is
+// written back on detach. a ram drive without a file is a blank
+// scratch pack.
+bool attach(const uint32_t n, const char *path, const bool ram) {
+  detach(n);
+  if (path && !rkdata[n].file.open(path, O_RDWR)) {
+    Serial.printf("could not open %s\r\n", path);
+    return false;
+  }
+  if (ram) {
+    rkdata[n].ram = ramalloc(n);
+    if (!rkdata[n].ram) {
+      Serial.printf("rk11: no memory for a ram disk on rk%d\r\n", n);
+      rkdata[n].file.close();
+      return false;
+    }
+    int r = 0;
+    if (path) {
+      r = rkdata[n].file.read(rkdata[n].ram, RK_SIZE);
+      if (r < 0) {
+        r = 0;
+      }
+    }
+    memset(rkdata[n].ram + r, 0, RK_SIZE - r);
+    rkdata[n].dirty = false;
+    memset(rkdata[n].changed, 0xFF, sizeof(rkdata[n].changed));
+  }
+  rkdata[n].attached = true;
+  return true;
+}
+
+void detach(const uint32_t n) {
+  if (rkdata[n].ram) {
+    if (rkdata[n].dirty && rkdata[n].file.isOpen()) {
+      Serial.printf("rk11: saving rk%d\r\n", n);
+      rkdata[n].file.seekSet(0);
+      if (rkdata[n].file.write(rkdata[n].ram, RK_SIZE) != RK_SIZE) {
+        Serial.printf("rk11: write failed on rk%d\r\n", n);
+      }
+      rkdata[n].file.sync();
+    }
+    ramfree(n);
+    rkdata[n].ram = nullptr;
+    rkdata[n].dirty = false;
+  }
+  rkdata[n].file.close();
+  rkdata[n].attached = false;
+}
+
+// read block blk of the pack on drive n, for the host side tools
+bool block(const uint32_t n, const uint32_t blk, uint8_t *buf) {
+  if (!rkdata[n].attached || (blk + 1) * 512 > RK_SIZE) {
+    return false;
+  }
+  if (rkdata[n].ram) {
+    memcpy(buf, rkdata[n].ram + blk * 512, 512);
+    return true;
+  }
+  return rkdata[n].file.seekSet(blk * 512) && rkdata[n].file.read(buf, 512) == 512;
+}
+
+// dma between a ram disk and core with memcpy, a run of words up to the
+// end of the sector, the transfer or the 8k unibus page at a time. runs
+// that leave the core go word by word and fault like the file path.
+static void ramxfer(const bool w, const uint32_t pos, const uint32_t patch_time) {
+  uint8_t *p = rkdata[drive].ram + pos;
+  const uint32_t ba = RKBA;
+  uint32_t i = 0;
+  while (i < 256 && RKWC != 0) {
+    const uint32_t pa = unibus::map(RKBA);
+    uint32_t n = min((uint32_t) 256 - i, (uint32_t) 0x10000 - RKWC);
+    n = min(n, (uint32_t) (020000 - (RKBA & 017777)) >> 1);
+    if (pa + n * 2 > unibus::memsize) {
+      n = 1;
+      if (w) {
+        const uint16_t v = unibus::read16(pa);
+        p[0] = v & 0xFF;
+        p[1] = v >> 8;
+      } else {
+        unibus::write16(pa, p[0] | (p[1] << 8));
+      }
+    } else if (w) {
+      memcpy(p, &unibus::core16[pa >> 1], n * 2);
+    } else {
+      unibus::load16(pa, p, n);
+    }
+    p += n * 2;
+    i += n;
+    RKBA += n * 2;
+    RKWC = (RKWC + n) & 0xFFFF;
+  }
+  if (w) {
+    rkdata[drive].dirty = true;
+    rkdata[drive].changed[pos >> 12] |= 1 << ((pos >> 9) & 7);
+  }
+  if (patch_time && i > 207) {
+    unibus::write16(unibus::map(ba + 412), patch_time >> 16);
+    unibus::write16(unibus::map(ba + 414), patch_time & 0xFFFF);
+  }
+}
+
 static void step() {
   again:
   yield();
@@ -149,41 +306,46 @@ static void step() {
   }
 
   const uint32_t pos = (cylinder * 24 + surface * 12 + sector) * 512;
-  if (!rkdata[drive].file.seekSet(pos)) {
-    Serial.printf("rk11: failed to seek: drive: %d, pos: %d, cyl: %d, sur: %d, sec: %d\r\n",
-      drive, pos, cylinder, surface, sector);
-    panic();
+  uint32_t patch_time = 0;
+  ops++;
+  if (!w && patch_super && drive == 0 && pos == 512) { // superblock
+    patch_time = rr::clock(rtc.now().unixtime());
   }
-  __disable_irq();
-  if (w) { // write
-    for (int i = 0; i < 256 && RKWC != 0; i++) {
-      const uint16_t val = unibus::read16(RKBA);
-      rkdata[drive].file.write(val & 0xFF);
-      rkdata[drive].file.write((val >> 8) & 0xFF);
-      RKBA += 2;
-      RKWC = (RKWC + 1) & 0xFFFF;
-    }
+  if (rkdata[drive].ram) {
+    __disable_irq();
+    ramxfer(w, pos, patch_time);
   } else {
-    uint32_t patch_time = 0;
-    if (patch_super && drive == 0 && pos == 512) { // superblock
-      patch_time = rtc.now().unixtime();
+    if (!rkdata[drive].file.seekSet(pos)) {
+      Serial.printf("rk11: failed to seek: drive: %d, pos: %d, cyl: %d, sur: %d, sec: %d\r\n",
+        drive, pos, cylinder, surface, sector);
+      panic();
     }
-    for (int i = 0; i < 256 && RKWC != 0; i++) {
-        uint16_t dv = rkdata[drive].file.read() | (rkdata[drive].file.read() << 8);
-        if (patch_time) {
-          if (i == 206) {
-            dv = patch_time >> 16;
-          }
-          if (i == 207) {
-            dv = patch_time & 0xFFFF;
-          }
-        }
-        //Serial.printf("rkdata: %06o: %04x\r\n", RKBA, dv);
-        unibus::write16(RKBA, dv);        
+    __disable_irq();
+    if (w) { // write
+      for (int i = 0; i < 256 && RKWC != 0; i++) {
+        const uint16_t val = unibus::read16(unibus::map(RKBA));
+        rkdata[drive].file.write(val & 0xFF);
+        rkdata[drive].file.write((val >> 8) & 0xFF);
         RKBA += 2;
         RKWC = (RKWC + 1) & 0xFFFF;
+      }
+    } else {
+      for (int i = 0; i < 256 && RKWC != 0; i++) {
+          uint16_t dv = rkdata[drive].file.read() | (rkdata[drive].file.read() << 8);
+          if (patch_time) {
+            if (i == 206) {
+              dv = patch_time >> 16;
+            }
+            if (i == 207) {
+              dv = patch_time & 0xFFFF;
+            }
+          }
+          //Serial.printf("rkdata: %06o: %04x\r\n", RKBA, dv);
+          unibus::write16(unibus::map(RKBA), dv);        
+          RKBA += 2;
+          RKWC = (RKWC + 1) & 0xFFFF;
+      }
     }
-    patch_time = 0;
   }
   __enable_irq();
   yield();
@@ -274,4 +436,77 @@ void reset() {
   RKBA = 0;
 }
 
+// the registers and the image name of each drive, a ram pack goes in
+// whole, in a delta the sectors written since the last checkpoint as
+// sector number and contents up to RK_SECTORS. a restore keeps a drive
+// which has the named image attached already and attaches it otherwise.
+void snapshot(snap::io &s) {
+  s(RKBA);
+  s(RKDS);
+  s(RKER);
+  s(RKCS);
+  s(RKWC);
+  s(drive);
+  s(sector);
+  s(surface);
+  s(cylinder);
+  s(patch_super);
+  for (uint32_t n = 0; n < RK_NUM_DRV; n++) {
+    struct disk &d = rkdata[n];
+    char name[64] = {}, cur[64] = {};
+    if (d.attached && d.file.isOpen()) {
+      d.file.getName(cur, sizeof(cur));
+    }
+    strcpy(name, cur);
+    bool attached = d.attached;
+    bool ram = d.ram != nullptr;
+    bool lock = d.write_lock;
+    s(attached);
+    s(ram);
+    s(lock);
+    s.bytes(name, sizeof(name));
+    if (!s.ok) {
+      return;
+    }
+    if (s.load) {
+      if (!attached) {
+        detach(n);
+      } else if (!d.attached || (d.ram != nullptr) != ram || strcmp(cur, name)) {
+        if (!attach(n, name[0] ? name : nullptr, ram)) {
+          s.fail();
+          return;
+        }
+      }
+      d.write_lock = lock;
+    }
+    if (attached && ram) {
+      if (!s.delta) {
+        s.bytes(d.ram, RK_SIZE);
+      } else if (s.load) {
+        for (;;) {
+          uint32_t k = RK_SECTORS;
+          s(k);
+          if (!s.ok || k >= RK_SECTORS) {
+            break;
+          }
+          s.bytes(d.ram + k * 512, 512);
+        }
+      } else {
+        for (uint32_t k = 0; k < RK_SECTORS; k++) {
+          if (d.changed[k >> 3] & (1 << (k & 7))) {
+            s(k);
+            s.bytes(d.ram + k * 512, 512);
+          }
+        }
+        uint32_t last = RK_SECTORS;
+        s(last);
+      }
+      d.dirty |= s.load; // the image on the card is older
+      if (s.clean) {
+        memset(d.changed, 0, sizeof(d.changed));
+      }
+    }
+  }
+}
+
 };
@@ -1,9 +1,15 @@
+#pragma once
+
+#include <pdp11.h>
 #include "SdFat.h"
 
 #define RK_NUM_DRV 8
+// bytes per pack, 203 cylinders of 2 surfaces of 12 sectors
+#define RK_SIZE (203 * 2 * 12 * 512)
+#define RK_SECTORS (RK_SIZE / 512)
 
 // enable rtc time superblock patch (v6 only?)
-extern bool patch_super;
+extern MACHINE_STATE bool patch_super;
 
 namespace rk11 {
 
@@ -11,6 +17,9 @@ namespace rk11 {
     FsFile file;
     bool attached = false;
     bool write_lock = false;
+    uint8_t *ram = nullptr; // whole pack in memory, the file is the backing image
+    bool dirty = false;     // ram written since the attach
+    uint8_t changed[(RK_SECTORS + 7) / 8]; // ram sectors written since the last checkpoint
   };
 
   // V6 struct filsys
@@ -29,16 +38,21 @@ namespace rk11 {
         uint16_t pad[50];        
   };  
 
-  extern struct disk rkdata[RK_NUM_DRV];
+  extern MACHINE_STATE struct disk rkdata[RK_NUM_DRV];
+  extern MACHINE_STATE uint32_t ops; // sectors transferred, for bench
   
+  bool attach(uint32_t n, const char *path, bool ram);
+  void detach(uint32_t n);
+  bool block(uint32_t n, uint32_t blk, uint8_t *buf);
   void reset();
   void write16(uint32_t a, uint16_t v);
   uint16_t read16(uint32_t a);
+  void snapshot(snap::io &s);
 
-  extern uint32_t drive;
-  extern uint32_t sector;
-  extern uint32_t surface; 
-  extern uint32_t cylinder;
+  extern MACHINE_STATE uint32_t drive;
+  extern MACHINE_STATE uint32_t sector;
+  extern MACHINE_STATE uint32_t surface; 
+  extern MACHINE_STATE uint32_t cylinder;
 };
 
 enum {
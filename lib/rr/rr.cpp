@@ -0,0 +1,199 @@
+#include <Arduino.h>
+#include <SdFat.h>
+#include <pdp11.h>
+#include "sched.h"
+#include "dl11.h"
+#include "dz11.h"
+#include "kw11.h"
+#include "rr.h"
+
+namespace rr {
+
+MACHINE_STATE uint32_t mode = RR_OFF;
+MACHINE_STATE uint32_t records;
+MACHINE_STATE uint64_t start;
+
+static MACHINE_STATE FsFile file;
+static MACHINE_STATE entry buf[RR_BUF];
+static MACHINE_STATE uint32_t nbuf, ibuf;
+static MACHINE_STATE entry next; // replay: the next record
+
+// "RRLG", the version and the guest time the log starts at, then the
+// records in the order they took effect
+struct header {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t start;
+};
+
+static void flush() {
+  if (nbuf) {
+    file.write(buf, nbuf * sizeof(entry));
+    nbuf = 0;
+  }
+}
+
+static void put(const uint32_t type, const uint32_t value) {
+  buf[nbuf++] = entry{ sched::icount, value, type };
+  records++;
+  if (nbuf == RR_BUF) {
+    flush();
+  }
+}
+
+static void diverged() {
+  Serial.printf("rr: replay diverged at %u M instructions, record %u\r\n",
+    (uint32_t)(sched::icount / 1000000), records);
+  stop();
+}
+
+// the next record of the replay, the pulled rtc values are not scheduled
+static void advance() {
+  if (ibuf == nbuf) {
+    const int n = file.read(buf, sizeof(buf));
+    nbuf = n > 0 ? n / sizeof(entry) : 0;
+    ibuf = 0;
+  }
+  if (ibuf == nbuf) {
+    Serial.printf("rr: replay done, %u records\r\n", records);
+    stop();
+    return;
+  }
+  next = buf[ibuf++];
+  if (next.type != RR_RTC) {
+    sched::at(sched::EV_RR, next.when);
+  }
+}
+
+bool record(const char *path) {
+  stop();
+  if (!file.open(path, O_CREAT|O_TRUNC|O_WRITE)) {
+    return false;
+  }
+  start = sched::icount;
+  const header h = { 0x474c5252, 1, start };
+  if (file.write(&h, sizeof(h)) != sizeof(h)) {
+    file.close();
+    return false;
+  }
+  records = 0;
+  nbuf = 0;
+  mode = RR_RECORD;
+  return true;
+}
+
+// the machine has to be in the state the log was started in, at power
+// on or restored from a snapshot taken then
+bool replay(const char *path) {
+  stop();
+  header h;
+  if (!file.open(path, O_READ)) {
+    return false;
+  }
+  if (file.read(&h, sizeof(h)) != sizeof(h) || h.magic != 0x474c5252 || h.version != 1) {
+    file.close();
+    return false;
+  }
+  if (h.start != sched::icount) {
+    Serial.printf("rr: the log starts at instruction %u, the machine is at %u\r\n",
+      (uint32_t) h.start, (uint32_t) sched::icount);
+    file.close();
+    return false;
+  }
+  start = h.start;
+  records = 0;
+  nbuf = ibuf = 0;
+  mode = RR_REPLAY;
+  advance();
+  return true;
+}
+
+void stop() {
+  if (mode == RR_RECORD) {
+    flush();
+    file.sync();
+  }
+  if (mode != RR_OFF) {
+    file.close();
+  }
+  sched::cancel(sched::EV_RR);
+  mode = RR_OFF;
+}
+
+// a line clock tick of the host timer, from interrupt context. it takes
+// effect at the next instruction boundary the main loop sees.
+void tick() {
+  if (mode == RR_RECORD) {
+    sched::work |= sched::WORK_TICK;
+  }
+}
+
+// a character handed to the console receiver
+void input(const uint8_t c) {
+  if (mode == RR_RECORD) {
+    put(RR_CHAR, c);
+  }
+}
+
+// a character the DZ11 moved from line ln into its silo
+void line(const uint32_t ln, const uint8_t c) {
+  if (mode == RR_RECORD) {
+    put(RR_DZ, ln << 8 | c);
+  }
+}
+
+// the carrier of the DZ11 lines changed
+void modem(const uint32_t co) {
+  if (mode == RR_RECORD) {
+    put(RR_MODEM, co);
+  }
+}
+
+// the rtc time, logged or fed back
+uint32_t clock(const uint32_t host) {
+  if (mode == RR_RECORD) {
+    put(RR_RTC, host);
+  } else if (mode == RR_REPLAY) {
+    if (next.type != RR_RTC || next.when != sched::icount) {
+      diverged();
+      return host;
+    }
+    records++;
+    const uint32_t v = next.value;
+    advance();
+    return v;
+  }
+  return host;
+}
+
+// called first thing when the main loop services the devices
+void run() {
+  if (mode == RR_RECORD && (sched::work & sched::WORK_TICK)) {
+    sched::clear(sched::WORK_TICK);
+    put(RR_TICK, 0);
+    kw11::tick();
+  }
+  while (mode == RR_REPLAY && next.type != RR_RTC && next.when <= sched::icount) {
+    if (next.when < sched::icount) {
+      diverged();
+      return;
+    }
+    records++;
+    switch (next.type) {
+      case RR_CHAR:
+        dl11::inject(next.value);
+        break;
+      case RR_DZ:
+        dz11::inject(next.value >> 8, next.value & 0xFF);
+        break;
+      case RR_MODEM:
+        dz11::setmodem(next.value);
+        break;
+      default:
+        kw11::tick();
+    }
+    advance();
+  }
+}
+
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <pdp11.h>
+
+// record and replay of the inputs that depend on the host: characters
+// handed to the console receiver, characters the DZ11 puts in its silo
+// and the carrier of its lines, line clock ticks of the host timer and
+// the rtc time of the superblock patch. each is logged with the guest
+// instruction count it took effect at, a replay feeds them back at the
+// same count, so a run from the same state is repeated exactly.
+#define RR_BUF 32 // records between two sd writes
+
+namespace rr {
+
+    enum {
+      RR_OFF,
+      RR_RECORD,
+      RR_REPLAY,
+    };
+
+    enum {
+      RR_CHAR,  // value is the character
+      RR_TICK,
+      RR_RTC,   // value is the unix time
+      RR_DZ,    // value is the line << 8 | the character
+      RR_MODEM, // value is the carrier bits of the DZ11 lines
+    };
+
+    struct entry {
+      uint64_t when;  // sched::icount
+      uint32_t value;
+      uint32_t type;
+    };
+
+    extern MACHINE_STATE uint32_t mode;
+    extern MACHINE_STATE uint32_t records; // logged or fed back
+    extern MACHINE_STATE uint64_t start;   // guest time the log starts at
+
+    bool record(const char *path);
+    bool replay(const char *path);
+    void stop();
+    void tick();
+    void input(uint8_t c);
+    void line(uint32_t ln, uint8_t c);
+    void modem(uint32_t co);
+    uint32_t clock(uint32_t host);
+    void run();
+
+};
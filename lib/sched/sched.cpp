@@ -0,0 +1,244 @@
+#include <Arduino.h>
+#include "sched.h"
+#include "snap.h"
+#include "dl11.h"
+#include "dz11.h"
+#include "kw11.h"
+#include "tm11.h"
+#include "cpu.h"
+#include "rr.h"
+
+#if !defined(TEENSYDUINO)
+#include <unistd.h>
+#endif
+
+namespace sched {
+
+MACHINE_STATE uint64_t icount;
+MACHINE_STATE uint64_t next;
+MACHINE_STATE volatile uint32_t work;
+MACHINE_STATE uint32_t batch = SCHED_MAXBATCH;
+MACHINE_STATE uint64_t idle_icount;
+MACHINE_STATE uint64_t idle_us;
+
+static void (*const handler[EV_N])() = {
+  dl11::poll,
+  dz11::poll,
+  kw11::tick,
+  tm11::rewound,
+  rr::run,
+};
+
+// host events poll host ports, they do not advance the guest while idle
+static const bool hostev[EV_N] = {
+  false,
+  true,
+  false,
+  false,
+  false,
+};
+
+struct event {
+  uint64_t when;
+  uint32_t ev;
+};
+
+// binary min heap on the event time, pos[] is the heap index of each
+// event or -1 if it is not queued
+static MACHINE_STATE struct event heap[EV_N];
+static MACHINE_STATE int32_t pos[EV_N];
+static MACHINE_STATE uint32_t count;
+
+static void place(const uint32_t i, const struct event &e) {
+  heap[i] = e;
+  pos[e.ev] = i;
+}
+
+static void sift_up(uint32_t i) {
+  const struct event e = heap[i];
+  while (i > 0) {
+    const uint32_t parent = (i - 1) / 2;
+    if (heap[parent].when <= e.when) {
+      break;
+    }
+    place(i, heap[parent]);
+    i = parent;
+  }
+  place(i, e);
+}
+
+static void sift_down(uint32_t i) {
+  const struct event e = heap[i];
+  for (;;) {
+    uint32_t child = 2 * i + 1;
+    if (child >= count) {
+      break;
+    }
+    if (child + 1 < count && heap[child + 1].when < heap[child].when) {
+      child++;
+    }
+    if (e.when <= heap[child].when) {
+      break;
+    }
+    place(i, heap[child]);
+    i = child;
+  }
+  place(i, e);
+}
+
+static void dequeue(const uint32_t i) {
+  pos[heap[i].ev] = -1;
+  if (--count == i) {
+    return;
+  }
+  const uint32_t ev = heap[count].ev;
+  place(i, heap[count]);
+  sift_down(i);
+  sift_up(pos[ev]);
+}
+
+static void update() {
+  next = icount + batch;
+  if (count && heap[0].when < next) {
+    next = heap[0].when;
+  }
+}
+
+// queue an event at the given guest time. if it is already queued the
+// earlier time is kept.
+void at(const uint32_t ev, const uint64_t when) {
+  if (pos[ev] >= 0) {
+    if (when >= heap[pos[ev]].when) {
+      return;
+    }
+    heap[pos[ev]].when = when;
+    sift_up(pos[ev]);
+  } else {
+    place(count, event{when, ev});
+    sift_up(count++);
+  }
+  if (when < next) {
+    next = when;
+  }
+}
+
+void after(const uint32_t ev, const uint32_t n) {
+  at(ev, icount + n);
+}
+
+void cancel(const uint32_t ev) {
+  if (pos[ev] >= 0) {
+    dequeue(pos[ev]);
+  }
+}
+
+bool pending(const uint32_t ev) {
+  return pos[ev] >= 0;
+}
+
+// set and clear work bits from the main loop, the host input poll
+// sets its bit from interrupt context
+void post(const uint32_t w) {
+  __disable_irq();
+  work |= w;
+  __enable_irq();
+}
+
+void clear(const uint32_t w) {
+  __disable_irq();
+  work &= ~w;
+  __enable_irq();
+}
+
+// drain all events which are due, called by the main loop between
+// two batches of instructions
+void run() {
+  if (rr::mode) {
+    rr::run();
+  }
+  if (snap::every) {
+    snap::tick();
+  }
+  if ((work & WORK_INPUT) || batch == 1) {
+    clear(WORK_INPUT);
+    at(EV_DL11, icount);
+  }
+  while (count && heap[0].when <= icount) {
+    const uint32_t ev = heap[0].ev;
+    dequeue(0);
+    handler[ev]();
+  }
+  update();
+}
+
+// earliest queued guest event, UINT64_MAX if there is none
+static uint64_t nextguest() {
+  uint64_t when = UINT64_MAX;
+  for (uint32_t i = 0; i < count; i++) {
+    if (!hostev[heap[i].ev] && heap[i].when < when) {
+      when = heap[i].when;
+    }
+  }
+  return when;
+}
+
+// sleep until the next host interrupt, the 1 kHz host input poll or
+// the line clock wake us up at the latest
+static void sleep() {
+  const uint32_t start = micros();
+#if defined(TEENSYDUINO)
+  asm volatile("wfi");
+#else
+  usleep(1000);
+  yield(); // the host timers run from yield
+#endif
+  idle_us += micros() - start;
+}
+
+// the cpu executes a WAIT. nothing happens in the guest until an
+// interrupt, so fast forward the guest time to the next device event,
+// or sleep the host if no event is queued.
+void idle() {
+  while ((work & WORK_WAIT) && !cpu::irqpending()) {
+    const uint64_t when = nextguest();
+    if (when != UINT64_MAX) {
+      if (when > icount) {
+        idle_icount += when - icount;
+        icount = when;
+      }
+    } else {
+      sleep();
+      for (uint32_t i = 0; i < EV_N; i++) {
+        if (hostev[i] && pos[i] >= 0) {
+          at(i, icount);
+        }
+      }
+    }
+    run();
+  }
+}
+
+void reset() {
+  count = 0;
+  for (uint32_t i = 0; i < EV_N; i++) {
+    pos[i] = -1;
+  }
+  update();
+}
+
+// the guest time and the queued events, a pending WAIT is kept as well
+void snapshot(snap::io &s) {
+  s(icount);
+  s(idle_icount);
+  s(heap);
+  s(pos);
+  s(count);
+  uint32_t w = work & WORK_WAIT;
+  s(w);
+  if (s.load) {
+    work = w;
+    update();
+  }
+}
+
+};
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <pdp11.h>
+
+// upper bound of instructions run between two queue drains
+#define SCHED_MAXBATCH 1024
+
+namespace sched {
+
+    // events, at most one of each kind is queued
+    enum {
+        EV_DL11,  // console receive feed and transmit completion
+        EV_DZ11,  // dz11 host port poll
+        EV_CLOCK, // kw11-l line clock tick in virtual time
+        EV_TM11,  // tm11 rewind completion
+        EV_RR,    // next record of a replay
+        EV_N
+    };
+
+    // guest time, executed instructions since power on
+    extern MACHINE_STATE uint64_t icount;
+    // time of the earliest queued event, the main loop runs up to here
+    extern MACHINE_STATE uint64_t next;
+    // pending work for the main loop, one bit per reason. the loop tests
+    // the whole word after every instruction and looks at the bits only
+    // once it has left the slice.
+    enum {
+        WORK_INPUT = 1, // the host has input for the console, set from interrupt context
+        WORK_WAIT = 2,  // the cpu executed a WAIT, idle until the next interrupt
+        WORK_TICK = 4,  // a line clock tick to be recorded, set from interrupt context
+    };
+    extern MACHINE_STATE volatile uint32_t work;
+    // instructions per batch (slice), 1 services the devices after every instruction
+    extern MACHINE_STATE uint32_t batch;
+    // idle accounting: guest instructions skipped and host micros slept in WAIT
+    extern MACHINE_STATE uint64_t idle_icount;
+    extern MACHINE_STATE uint64_t idle_us;
+
+    void at(uint32_t ev, uint64_t when);
+    void after(uint32_t ev, uint32_t n);
+    void cancel(uint32_t ev);
+    bool pending(uint32_t ev);
+    void post(uint32_t w);
+    void clear(uint32_t w);
+    void run();
+    void idle();
+    void reset();
+    void snapshot(snap::io &s);
+
+};
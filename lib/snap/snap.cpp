@@ -0,0 +1,301 @@
+#include <Arduino.h>
+#include <SdFat.h>
+#include <pdp11.h>
+#include "cpu.h"
+#include "fp11.h"
+#include "kd11.h"
+#include "mmu.h"
+#include "unibus.h"
+#include "sched.h"
+#include "kw11.h"
+#include "dl11.h"
+#include "dz11.h"
+#include "rk05.h"
+#include "tm11.h"
+#include "hle.h"
+#include "bcache.h"
+#include "rr.h"
+#include "snap.h"
+
+namespace snap {
+
+MACHINE_STATE bool restored = false;
+MACHINE_STATE uint32_t every = 0;
+static MACHINE_STATE uint64_t due; // guest time of the next periodic checkpoint
+
+// the chain checkpoints go to: its name, the file of the current chain,
+// the records in it and the sequence number of the next record. links
+// 0 starts a new base.
+static MACHINE_STATE char chain[64];
+static MACHINE_STATE uint32_t cur, links, seq;
+
+struct header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t sections;
+  uint32_t seq;
+  uint32_t flags;
+  uint32_t size; // bytes after the header, 0 until the record is complete
+};
+
+struct section {
+  char tag[8];
+  uint32_t size;
+};
+
+static const uint32_t MAGIC = 0x53504450; // "PDPS"
+
+static const struct {
+  const char *tag;
+  void (*fn)(io &s);
+} modules[] = {
+  { "cpu",    cpu::snapshot },
+  { "fp11",   fp11::snapshot },
+  { "kd11",   kd11::snapshot },
+  { "mmu",    mmu::snapshot },
+  { "unibus", unibus::snapshot },
+  { "sched",  sched::snapshot },
+  { "kw11",   kw11::snapshot },
+  { "dl11",   dl11::snapshot },
+  { "dz11",   dz11::snapshot },
+  { "rk11",   rk11::snapshot },
+  { "tm11",   tm11::snapshot },
+  { "hle",    hle::snapshot },
+};
+static const uint32_t NMOD = sizeof(modules) / sizeof(modules[0]);
+
+// append a record at the current position of f. the sizes of the
+// sections and of the record are patched in once their state is written.
+static bool put(FsFile &f, const bool delta, const bool clean) {
+  io s = { &f, false, true, delta, clean };
+  const uint64_t start = f.curPosition();
+  header h = { MAGIC, SNAP_VERSION, NMOD, seq, delta ? (uint32_t) SNAP_DELTA : 0, 0 };
+  s(h);
+  for (uint32_t i = 0; i < NMOD && s.ok; i++) {
+    section sec = {};
+    memcpy(sec.tag, modules[i].tag, strlen(modules[i].tag));
+    const uint64_t at = f.curPosition();
+    s(sec);
+    modules[i].fn(s);
+    const uint64_t end = f.curPosition();
+    sec.size = end - at - sizeof(sec);
+    f.seekSet(at);
+    s(sec);
+    f.seekSet(end);
+  }
+  const uint64_t end = f.curPosition();
+  h.size = end - start - sizeof(h);
+  f.seekSet(start);
+  s(h);
+  f.seekSet(end);
+  return s.ok && f.sync();
+}
+
+// the complete records at the start of f, a record cut short by a crash
+// ends the list. last is set to the sequence number of the last one.
+static uint32_t scan(FsFile &f, uint32_t &last) {
+  const uint64_t size = f.fileSize();
+  io s = { &f, true, true, false, false };
+  uint32_t n = 0;
+  f.seekSet(0);
+  for (;;) {
+    header h;
+    s(h);
+    if (!s.ok || h.magic != MAGIC || h.version != SNAP_VERSION || h.size == 0 ||
+        f.curPosition() + h.size > size || (n == 0 && (h.flags & SNAP_DELTA))) {
+      break;
+    }
+    f.seekSet(f.curPosition() + h.size);
+    last = h.seq;
+    n++;
+  }
+  f.seekSet(0);
+  return n;
+}
+
+// load the next record of f. sections are found by their tag, unknown
+// ones are skipped. each has to consume exactly its size, else the
+// layout changed without a new version.
+static bool get(FsFile &f) {
+  io s = { &f, true, true, false, false };
+  header h;
+  s(h);
+  s.delta = h.flags & SNAP_DELTA;
+  uint32_t found = 0;
+  for (uint32_t n = 0; n < h.sections && s.ok; n++) {
+    section sec;
+    s(sec);
+    if (!s.ok) {
+      break;
+    }
+    const uint64_t at = f.curPosition();
+    uint32_t i = 0;
+    while (i < NMOD && strncmp(sec.tag, modules[i].tag, sizeof(sec.tag))) {
+      i++;
+    }
+    if (i < NMOD) {
+      modules[i].fn(s);
+      found++;
+      if (s.ok && f.curPosition() - at != sec.size) {
+        Serial.printf("snap: section %.8s has the wrong size\r\n", sec.tag);
+        s.fail();
+      }
+    }
+    f.seekSet(at + sec.size);
+  }
+  if (s.ok && found != NMOD) {
+    Serial.printf("snap: %u of %u sections\r\n", found, NMOD);
+    s.fail();
+  }
+  return s.ok;
+}
+
+// the file of name.0 and name.1 whose chain ends with the later record,
+// -1 if there is none
+static int latest(const char *name, uint32_t &last) {
+  int best = -1;
+  for (uint32_t k = 0; k < 2; k++) {
+    char path[72];
+    snprintf(path, sizeof(path), "%s.%u", name, k);
+    FsFile f;
+    uint32_t l = 0;
+    if (f.open(path, O_READ) && scan(f, l) && (best < 0 || l > last)) {
+      best = k;
+      last = l;
+    }
+    f.close();
+  }
+  return best;
+}
+
+bool save(const char *path) {
+  FsFile f;
+  if (!f.open(path, O_CREAT|O_TRUNC|O_RDWR)) {
+    Serial.printf("could not open %s\r\n", path);
+    return false;
+  }
+  const bool ok = put(f, false, false);
+  f.close();
+  if (!ok) {
+    Serial.printf("snap: write failed on %s\r\n", path);
+  }
+  return ok;
+}
+
+// a snapshot, or the base and deltas of a checkpoint chain. without a
+// file of that name the later chain of path.0 and path.1 is taken.
+bool restore(const char *path) {
+  char name[72];
+  FsFile f;
+  if (!f.open(path, O_READ)) {
+    uint32_t last;
+    const int k = latest(path, last);
+    if (k < 0) {
+      Serial.printf("could not open %s\r\n", path);
+      return false;
+    }
+    snprintf(name, sizeof(name), "%s.%d", path, k);
+    if (!f.open(name, O_READ)) {
+      Serial.printf("could not open %s\r\n", name);
+      return false;
+    }
+    path = name;
+  }
+  uint32_t last;
+  const uint32_t n = scan(f, last);
+  if (n == 0) {
+    Serial.printf("snap: %s is not a version %d snapshot\r\n", path, SNAP_VERSION);
+    f.close();
+    return false;
+  }
+  rr::stop();
+  bool ok = true;
+  for (uint32_t i = 0; i < n && ok; i++) {
+    ok = get(f);
+  }
+  f.close();
+  if (!ok) {
+    Serial.printf("snap: restore of %s failed, reset the machine\r\n", path);
+    return false;
+  }
+  sched::cancel(sched::EV_RR); // a replay does not carry over
+  due = sched::icount + every;
+  bcache::flush();
+  restored = true;
+  links = 0; // the chain no longer leads up to this state
+  return true;
+}
+
+// continue the numbering of an existing chain, its newer file is kept
+static void begin(const char *name) {
+  if (!strcmp(name, chain)) {
+    return;
+  }
+  strncpy(chain, name, sizeof(chain) - 1);
+  uint32_t last = 0;
+  const int k = latest(chain, last);
+  cur = k < 0 ? 1 : k;
+  seq = k < 0 ? 0 : last + 1;
+  links = 0;
+}
+
+// a full base into the other file, or a delta appended to the current
+// chain. a failed checkpoint starts a new base the next time.
+bool checkpoint(const char *name) {
+  begin(name);
+  const bool base = links == 0 || links >= SNAP_CHAIN;
+  if (base) {
+    cur ^= 1;
+  }
+  char path[72];
+  snprintf(path, sizeof(path), "%s.%u", chain, cur);
+  FsFile f;
+  if (!f.open(path, base ? O_CREAT|O_TRUNC|O_RDWR : O_RDWR)) {
+    Serial.printf("could not open %s\r\n", path);
+    links = 0;
+    return false;
+  }
+  f.seekSet(f.fileSize());
+  const bool ok = put(f, !base, true);
+  f.close();
+  if (!ok) {
+    Serial.printf("snap: write failed on %s\r\n", path);
+    links = 0;
+    return false;
+  }
+  seq++;
+  links++;
+  return true;
+}
+
+// a checkpoint every n guest instructions, 0 stops them
+void periodic(const char *name, const uint32_t n) {
+  every = n;
+  due = sched::icount + every;
+  if (every) {
+    begin(name);
+  }
+}
+
+void status(Stream *dev) {
+  if (!chain[0]) {
+    dev->println("snap: no checkpoints");
+    return;
+  }
+  dev->printf("snap: %s.%u, %u of %u records, next %u", chain, cur, links, SNAP_CHAIN, seq);
+  if (every) {
+    dev->printf(", every %u instructions", every);
+  }
+  dev->println();
+}
+
+// looked at between two slices, the guest time may have jumped ahead
+// over a WAIT
+void tick() {
+  if (sched::icount >= due) {
+    checkpoint(chain);
+    due = sched::icount + every;
+  }
+}
+
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdint.h>
+#include <pdp11.h>
+#include <SdFat.h>
+
+// machine snapshots. a snapshot file holds records, each is "PDPS", the
+// version, the number of sections, a sequence number, flags and the
+// byte size, then one section per module: an 8 byte tag, the byte size
+// and the state the module writes with its snapshot(). a restore puts
+// back the whole machine, core included, and the images attached by
+// name. file backed disk and tape images are not part of it, they must
+// be unchanged since the save, ram disks are.
+//
+// save writes a single full record. checkpoints append delta records,
+// which carry only the core chunks and ram disk sectors written since
+// the previous checkpoint, to a chain that starts with a full base.
+// after SNAP_CHAIN records the next base starts the other one of the
+// two files NAME.0 and NAME.1, the older chain stays intact until the
+// new base is complete.
+#define SNAP_VERSION 3
+#define SNAP_CHAIN 16
+
+namespace snap {
+
+    enum {
+      SNAP_DELTA = 1, // only the changes since the previous record
+    };
+
+    // one direction of the transfer, the modules describe their state
+    // once and the same code saves and loads it
+    struct io {
+      FsFile *f;
+      bool load;
+      bool ok;
+      bool delta; // core and ram disks as changes since the last checkpoint
+      bool clean; // a checkpoint, clear the dirty tracking once written
+
+      void bytes(void *p, const uint32_t n) {
+        if (ok) {
+          ok = load ? f->read(p, n) == (int) n : f->write(p, n) == n;
+        }
+      }
+
+      template <typename T> void operator()(T &v) {
+        bytes(&v, sizeof(v));
+      }
+
+      // volatile state goes through a copy
+      template <typename T> void operator()(volatile T &v) {
+        T t = v;
+        bytes(&t, sizeof(t));
+        v = t;
+      }
+
+      void fail() {
+        ok = false;
+      }
+    };
+
+    // the machine was loaded from a snapshot, power on must not reset it
+    extern MACHINE_STATE bool restored;
+    // guest instructions between two periodic checkpoints, 0 if off
+    extern MACHINE_STATE uint32_t every;
+
+    bool save(const char *path);
+    bool restore(const char *path);
+    bool checkpoint(const char *name);
+    void periodic(const char *name, uint32_t n);
+    void status(Stream *dev);
+    void tick();
+
+};
@@ -1,9 +1,11 @@
 #include <Arduino.h>
 
 #include <pdp11.h>
-#include <unibus.h>
+#include "unibus.h"
 #include "tm11.h"
+#include "snap.h"
 #include "cpu.h"
+#include "sched.h"
 
 #include "SdFat.h"
 
@@ -23,6 +25,7 @@
 #define TM_CE    0100000
 
 #define TM_TUR   01
+#define TM_RWS   02
 #define TM_WRL   04
 #define TM_BOT   040
 #define TM_SELR  0100
@@ -33,23 +36,24 @@
 
 #define TAPE_LEN 6195200
 
+#define TAPE_REWIND 1000 // instructions until a rewind is done
+
 #define TAPE_EOF 0x00000000
 #define TAPE_EOT 0xFFFFFFFF
 
 namespace tm11 {
 
-    uint16_t MTS;   // 772520 Status Register	
-    uint16_t MTC;   // 772522 Command Register		
-    uint16_t MTBRC; // 772524 Byte Record Counter
-    uint16_t MTCMA; // 772526 Current Memory Address Register
-    uint16_t MTD;   // 772530 Data Buffer
-    uint16_t MTRD;  // 772532 TU10 Read Lines
-
-    uint16_t rewind;
+    MACHINE_STATE uint16_t MTS;   // 772520 Status Register	
+    MACHINE_STATE uint16_t MTC;   // 772522 Command Register		
+    MACHINE_STATE uint16_t MTBRC; // 772524 Byte Record Counter
+    MACHINE_STATE uint16_t MTCMA; // 772526 Current Memory Address Register
+    MACHINE_STATE uint16_t MTD;   // 772530 Data Buffer
+    MACHINE_STATE uint16_t MTRD;  // 772532 TU10 Read Lines
 
-    uint16_t sector, address, count;
+    MACHINE_STATE uint16_t sector, address, count;
+    MACHINE_STATE uint32_t ops;
 
-    struct tape tmdata[TM_NUM_DRV];
+    MACHINE_STATE struct tape tmdata[TM_NUM_DRV];
 
     void reset() {
         MTS = TM_TUR;
@@ -121,17 +125,15 @@ namespace tm11 {
         }
     }
 
-    uint16_t cmd_end() {
-        if (rewind) {
-           rewind--;
-           if (!rewind) {                
-                MTS &= ~2;   // clear rewind
-                MTS |= 0x21; // set bot and tur
-                MTC |= 0x80; // set cur
-                Serial.printf("tm11: rewind done, MTS: %06o, MTC: %06o\r\n", MTS, MTC);
-           }
-        }
+    // event queue callback, the tape is at bot again
+    void rewound() {
+        MTS &= ~TM_RWS;
+        MTS |= TM_BOT|TM_TUR;
+        MTC |= TM_CRDY;
+        Serial.printf("tm11: rewind done, MTS: %06o, MTC: %06o\r\n", MTS, MTC);
+    }
 
+    uint16_t cmd_end() {
         MTS |= 1;
         MTC |= 0x80;
         return MTC & 0x40;
@@ -161,8 +163,14 @@ namespace tm11 {
             return;
         }
 
+        if (sched::pending(sched::EV_TM11)) { // finish the rewind first
+            sched::cancel(sched::EV_TM11);
+            rewound();
+        }
+
         MTC &= ~TM_CE;
         MTS &= ~(TM_ILC|TM_NXM);
+        ops++;
         
         uint8_t cmd = (MTC >> 1) & 7;
         if (DEBUG_TM11) {
@@ -198,7 +206,7 @@ namespace tm11 {
                         yield();
                     }
                     
-                    unibus::write16(addr, dv);
+                    unibus::write16(unibus::map(addr), dv);
                     addr+=2;
                     MTCMA = addr & 0xFFFF;
                     MTC  |= ((addr & 0x300000000) >> 12);
@@ -230,7 +238,7 @@ namespace tm11 {
                         Serial.printf("tm11: read %08o\r\n", addr);
                         yield();
                     }
-                    uint16_t dv = unibus::read16(addr);
+                    uint16_t dv = unibus::read16(unibus::map(addr));
                     tmdata[drive].file.write(dv & 0xFF);
                     MTBRC++;
                     tmdata[drive].file.write((dv >> 8) & 0xFF);
@@ -241,7 +249,7 @@ namespace tm11 {
                     tmdata[drive].pos += 2;
                 }
                 MTC |= TM_EOF;
-                __enable_irq()
+                __enable_irq();
                 yield();
                 break;
             }
@@ -272,7 +280,8 @@ namespace tm11 {
                 }                
                 tmdata[drive].file.flush();
                 tmdata[drive].pos = 0;
-                rewind = 1;                
+                MTS |= TM_RWS;
+                sched::after(sched::EV_TM11, TAPE_REWIND);
                 break;
             }
             default: {
@@ -285,4 +294,47 @@ namespace tm11 {
         }
         finish();
     }        
+
+    // the registers, the image name and position of each drive
+    void snapshot(snap::io &s) {
+        s(MTS);
+        s(MTC);
+        s(MTBRC);
+        s(MTCMA);
+        s(MTD);
+        s(MTRD);
+        s(sector);
+        s(address);
+        s(count);
+        for (uint32_t n = 0; n < TM_NUM_DRV; n++) {
+            struct tape &t = tmdata[n];
+            char name[64] = {}, cur[64] = {};
+            if (t.attached) {
+                t.file.getName(cur, sizeof(cur));
+            }
+            strcpy(name, cur);
+            bool attached = t.attached;
+            int64_t pos = t.pos;
+            s(attached);
+            s(pos);
+            s.bytes(name, sizeof(name));
+            if (!s.ok || !s.load) {
+                continue;
+            }
+            if (attached && (!t.attached || strcmp(cur, name))) {
+                t.file.close();
+                if (!t.file.open(name, O_RDWR)) {
+                    Serial.printf("could not open %s\r\n", name);
+                    t.attached = false;
+                    s.fail();
+                    return;
+                }
+            } else if (!attached) {
+                t.file.close();
+            }
+            t.attached = attached;
+            t.pos = pos;
+        }
+    }
+
 };
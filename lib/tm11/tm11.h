@@ -1,3 +1,6 @@
+#pragma once
+
+#include <pdp11.h>
 #include "SdFat.h"
 
 #define TM_NUM_DRV 8
@@ -11,13 +14,16 @@ namespace tm11 {
         bool attached = false;
     };
 
-    extern struct tape tmdata[TM_NUM_DRV];
-    extern uint16_t MTBRC; // 772524 Byte Record Counter
-    extern uint16_t MTCMA; 
+    extern MACHINE_STATE struct tape tmdata[TM_NUM_DRV];
+    extern MACHINE_STATE uint16_t MTBRC; // 772524 Byte Record Counter
+    extern MACHINE_STATE uint16_t MTCMA; 
+    extern MACHINE_STATE uint32_t ops;   // commands started, for bench
 
     void reset();
     void go();
+    void rewound();
     uint16_t read16(uint32_t a);
     void write16(uint32_t a, uint16_t v);
+    void snapshot(snap::io &s);
  
 };
\ No newline at end of file
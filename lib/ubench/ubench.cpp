@@ -0,0 +1,264 @@
+#include <Arduino.h>
+#include <pdp11.h>
+#include "cpu.h"
+#include "mmu.h"
+#include "unibus.h"
+#include "fp11.h"
+#include "ubench.h"
+
+#if !defined(TEENSYDUINO)
+#include <chrono>
+#endif
+
+namespace ubench {
+
+#if defined(TEENSYDUINO)
+// the dwt cycle counter, started by the teensy core
+typedef uint32_t stamp;
+
+static inline stamp now() {
+  return ARM_DWT_CYCCNT;
+}
+
+static inline double ns(const stamp t) {
+  return t * (1e9 / F_CPU_ACTUAL);
+}
+#else
+typedef uint64_t stamp;
+
+static inline stamp now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static inline double ns(const stamp t) {
+  return t;
+}
+#endif
+
+// the operands and the code the benchmarks work on
+enum {
+  DATA  = 01000, // R1 points here
+  DEFER = 03000, // the deferred pointers point here
+  CODE  = 02000, // R7, index words and immediates
+  STACK = 01000, // R6 grows down from here
+  VEC   = 04000, // the handler of the interrupt and trap vectors
+  FDATA = 01400, // R1 of the FP11 loads and stores, 1.5 in F and D
+};
+
+struct item {
+  const char *group;
+  const char *name;
+  void (*fn)(uint32_t n, uint32_t arg, uint32_t ps);
+  uint32_t arg;
+  uint32_t ps;
+};
+
+static volatile uint32_t sink;
+
+static void aget(const uint32_t n, const uint32_t mode, const uint32_t) {
+  for (uint32_t i = 0; i < n; i++) {
+    cpu::R[1] = DATA;
+    cpu::R[7] = CODE;
+    sink = cpu::operand(mode, 2);
+  }
+}
+
+// an instruction with R1 = 3, R2:R3 = 01234 and the condition codes of ps
+static void exec(const uint32_t n, const uint32_t instr, const uint32_t ps) {
+  for (uint32_t i = 0; i < n; i++) {
+    cpu::R[1] = 3;
+    cpu::R[2] = 0;
+    cpu::R[3] = 01234;
+    cpu::R[7] = CODE;
+    cpu::PS.Word = ps;
+    cpu::execute(instr);
+  }
+}
+
+static void step(const uint32_t n, const uint32_t, const uint32_t) {
+  for (uint32_t i = 0; i < n; i++) {
+    cpu::R[7] = CODE + 2;
+    cpu::step();
+  }
+}
+
+static void decode(const uint32_t n, const uint32_t on, const uint32_t) {
+  mmu::SR0 = on;
+  for (uint32_t i = 0; i < n; i++) {
+    sink = mmu::decode(DATA + (i & 0770), false, false);
+  }
+  mmu::SR0 = 0;
+}
+
+static void read16(const uint32_t n, const uint32_t a, const uint32_t) {
+  for (uint32_t i = 0; i < n; i++) {
+    sink = unibus::read16(a);
+  }
+}
+
+// an FP11 instruction with AC0 = 1.5, AC1 = 3 and the precision of fps
+static void fp(const uint32_t n, const uint32_t instr, const uint32_t fps) {
+  for (uint32_t i = 0; i < n; i++) {
+    cpu::R[1] = FDATA;
+    cpu::R[7] = CODE;
+    fp11::FPS = fps;
+    fp11::AC[0] = 1.5;
+    fp11::AC[1] = 3;
+    fp11::step(instr);
+  }
+}
+
+static void irq(const uint32_t n, const uint32_t, const uint32_t) {
+  for (uint32_t i = 0; i < n; i++) {
+    cpu::R[6] = STACK;
+    cpu::R[7] = CODE;
+    cpu::PS.Word = 0;
+    cpu::interrupt(INTCLOCK, 6);
+    cpu::handleinterrupt();
+  }
+}
+
+static void trap(const uint32_t n, const uint32_t, const uint32_t) {
+  for (uint32_t i = 0; i < n; i++) {
+    cpu::R[6] = STACK;
+    cpu::R[7] = CODE;
+    cpu::PS.Word = 0;
+    cpu::trapat(INTIOT);
+  }
+}
+
+static const item items[] = {
+  { "aget", "R1",       aget, 001 },
+  { "aget", "(R1)",     aget, 011 },
+  { "aget", "(R1)+",    aget, 021 },
+  { "aget", "@(R1)+",   aget, 031 },
+  { "aget", "-(R1)",    aget, 041 },
+  { "aget", "@-(R1)",   aget, 051 },
+  { "aget", "X(R1)",    aget, 061 },
+  { "aget", "@X(R1)",   aget, 071 },
+  { "aget", "#n",       aget, 027 },
+  { "aget", "@#a",      aget, 037 },
+  { "alu",  "MOV",      exec, 010102 },
+  { "alu",  "MOVB",     exec, 0110102 },
+  { "alu",  "CMP",      exec, 020102 },
+  { "alu",  "BIT",      exec, 030102 },
+  { "alu",  "BIC",      exec, 040102 },
+  { "alu",  "BIS",      exec, 050102 },
+  { "alu",  "ADD",      exec, 060102 },
+  { "alu",  "SUB",      exec, 0160102 },
+  { "alu",  "MUL",      exec, 070201 },
+  { "alu",  "DIV",      exec, 071201 },
+  { "alu",  "ASH",      exec, 072201 },
+  { "alu",  "ASHC",     exec, 073201 },
+  { "alu",  "XOR",      exec, 074102 },
+  { "alu",  "CLR",      exec, 005002 },
+  { "alu",  "COM",      exec, 005102 },
+  { "alu",  "INC",      exec, 005202 },
+  { "alu",  "DEC",      exec, 005302 },
+  { "alu",  "NEG",      exec, 005402 },
+  { "alu",  "ADC",      exec, 005502 },
+  { "alu",  "SBC",      exec, 005602 },
+  { "alu",  "TST",      exec, 005702 },
+  { "alu",  "ROR",      exec, 006002 },
+  { "alu",  "ROL",      exec, 006102 },
+  { "alu",  "ASR",      exec, 006202 },
+  { "alu",  "ASL",      exec, 006302 },
+  { "alu",  "SWAB",     exec, 000302 },
+  { "alu",  "SXT",      exec, 006702 },
+  { "branch", "BNE taken",     exec, 001000, 0 },
+  { "branch", "BNE not taken", exec, 001000, 4 },
+  { "step", "NOP",      step },
+  { "mmu",  "off",      decode, 0 },
+  { "mmu",  "on",       decode, 1 },
+  { "unibus", "ram",    read16, DATA },
+  { "unibus", "io LKS", read16, IOPAGE | 017546 },
+  { "unibus", "io RKCS", read16, IOPAGE | 017404 },
+  { "irq",  "interrupt", irq },
+  { "trap", "trapat",   trap },
+  { "fp",   "LDF (R1)", fp, 0172411 },
+  { "fp",   "LDD (R1)", fp, 0172411, fp11::FPS_D },
+  { "fp",   "STF (R1)", fp, 0174011 },
+  { "fp",   "STD (R1)", fp, 0174011, fp11::FPS_D },
+  { "fp",   "ADDF",     fp, 0172001 },
+  { "fp",   "MULF",     fp, 0171001 },
+  { "fp",   "DIVF",     fp, 0174401 },
+  { "fp",   "DIVD",     fp, 0174401, fp11::FPS_D },
+};
+
+// the core the benchmarks read, an identity map in the kernel pages
+static void setup() {
+  for (uint32_t a = 0; a < 010000; a += 2) {
+    unibus::write16(a, 0);
+  }
+  unibus::write16(DATA, DEFER);
+  unibus::write16(DATA - 2, DEFER);
+  unibus::write16(DATA + 4, DEFER);
+  unibus::write16(CODE, 4);
+  unibus::write16(CODE + 2, 0240); // NOP for step
+  unibus::write16(FDATA, 040300);
+  unibus::write16(INTCLOCK, VEC);
+  unibus::write16(INTCLOCK + 2, 0340);
+  unibus::write16(INTIOT, VEC);
+  unibus::write16(INTIOT + 2, 0340);
+  for (uint32_t i = 0; i < 8; i++) {
+    mmu::write16(0772300 + i * 2, 077406); // full length, read and write
+    mmu::write16(0772340 + i * 2, i * 0200);
+  }
+  cpu::PS.Word = 0;
+}
+
+static stamp timed(const item &t, const uint32_t n) {
+  const stamp t0 = now();
+  t.fn(n, t.arg, t.ps);
+  return now() - t0;
+}
+
+// double n until a run lasts UBENCH_NS, then the best of three
+static double measure(const item &t) {
+  uint32_t n = 256;
+  stamp d;
+  while (ns(d = timed(t, n)) < UBENCH_NS && n < (1u << 28)) {
+    n *= 2;
+  }
+  double best = ns(d) / n;
+  for (uint32_t k = 0; k < 2; k++) {
+    best = min(best, ns(timed(t, n)) / n);
+  }
+  return best;
+}
+
+void run(Stream *dev, const char *group) {
+  static const uint32_t N = sizeof(items) / sizeof(items[0]);
+  volatile uint32_t i; // kept across a longjmp
+  volatile uint32_t ran = 0;
+  jmp_buf saved; // the caller's, this frame is gone after the return
+  memcpy(saved, trapbuf, sizeof(jmp_buf));
+  setup();
+  for (i = 0; i < N; i++) {
+    const item &t = items[i];
+    if (group && strcmp(group, t.group)) {
+      continue;
+    }
+    ran++;
+    if (setjmp(trapbuf)) {
+      dev->printf("%-7s %-14s trapped\r\n", t.group, t.name);
+      setup();
+      continue;
+    }
+    dev->printf("%-7s %-14s %8.2f ns\r\n", t.group, t.name, measure(t));
+  }
+  if (!group || !strcmp(group, "fp")) {
+    ran++;
+    const uint32_t failed = fp11::check(dev);
+    dev->printf("%-7s %-14s %s\r\n", "fp", "F/D round trip", failed ? "FAILED" : "ok");
+  }
+  if (!ran) {
+    dev->printf("ubench: no group %s\r\n", group);
+  }
+  mmu::reset();
+  cpu::reset();
+  memcpy(trapbuf, saved, sizeof(jmp_buf));
+}
+
+};
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <pdp11.h>
+
+// microbenchmarks of the inner paths: the operand modes through aget,
+// the alu and branch handlers, mmu::decode, unibus::read16, the
+// interrupt and trap entry and the FP11 loads, stores and arithmetic.
+// each runs in a loop long enough for the cycle counter of the teensy
+// or the steady clock of the host, the best of three runs is reported
+// in ns per operation. the loops set up the registers they use on every
+// pass, that is part of the time. it works in the core below 4k and
+// resets the cpu when done. the fp group also checks the F and D
+// conversions, see fp11::check().
+#define UBENCH_NS 20000000 // ns a timed run lasts at least
+
+namespace ubench {
+
+    // the benchmarks of group, all of them for nullptr
+    void run(Stream *dev, const char *group);
+
+};
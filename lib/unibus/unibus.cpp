@@ -3,12 +3,15 @@
 #include "cpu.h"
 #include "dl11.h"
 #include "mmu.h"
+#include "bcache.h"
 #include "unibus.h"
+#include "snap.h"
 #include "rk05.h"
 #include "tm11.h"
+#include "dz11.h"
+#include "panel.h"
 #include "console.h"
 
-extern void displayWordExternal(uint32_t val);
 
 namespace unibus {
 
@@ -20,20 +23,23 @@ namespace unibus {
 // http://gunkies.org/wiki/KT11-B_Paging_Option
 // 0760000 // 248
 
-uint16_t SWR;
-uint16_t SLR;
-uint16_t PIRQ;
+MACHINE_STATE uint16_t SWR;
+MACHINE_STATE uint16_t SLR;
+MACHINE_STATE uint16_t PIRQ;
 
 extern "C" uint8_t external_psram_size;
 
-// start of io space
-#define MEM 0760000
-
 //uint16_t core16[MEM >> 1];
 //uint16_t *core16 = (uint16_t *) (0x70000000);
 //uint16_t *core16 = (uint16_t *) (0x20200000+0x10000); 512k RAM2 + 64k because of heap
-uint16_t *core16;
-uint8_t  *core8 = (uint8_t *) core16; 
+MACHINE_STATE uint16_t *core16;
+MACHINE_STATE uint8_t  *core8;
+MACHINE_STATE uint32_t memsize = MEMSIZE;
+MACHINE_STATE uint32_t memmax;
+// unibus map, 22 bit base of each 8k unibus page. the last page is
+// always the io page.
+MACHINE_STATE uint32_t ubmap[31];
+MACHINE_STATE uint32_t dirty[CORE_CHUNKS / 32];
 
 bool dump(void) {
   FsFile core;
@@ -56,7 +62,12 @@ bool dump(void) {
 void reset() {
   if (IGNORE_EXTMEM || external_psram_size == 0) {
     Serial.println("EXTMEM not available/enabled, using OCRAM.");
-    core16 = (uint16_t *) malloc(MEM);
+#if defined(TEENSYDUINO)
+    memmax = MEMSIZE;
+#else
+    memmax = IOPAGE;
+#endif
+    core16 = (uint16_t *) malloc(memmax);
     if (core16 == NULL) {
       Serial.println("Malloc failed.");
       panic();
@@ -67,13 +78,49 @@ void reset() {
     Serial.printf("%dMb EXTMEM installed, using as core.\r\n", external_psram_size);
     core16 = (uint16_t *) (0x70000000);
     core8 = (uint8_t *) core16;
+    memmax = min((uint32_t) external_psram_size << 20, (uint32_t) IOPAGE);
     Serial.printf("Core is at EXTMEM: 0x%08x\r\n", core16);    
   }
-  memset(&core16[0], 0, MEM);
+  memset(&core16[0], 0, memmax);
+  memset(dirty, 0xFF, sizeof(dirty));
+  setmem(memsize);
   SLR = 0;
+  for (uint32_t i = 0; i < 31; i++) {
+    ubmap[i] = 0;
+  }
+}
+
+// set the core size in bytes, rounded down to 8k and limited by the
+// memory allocated at reset
+bool setmem(const uint32_t n) {
+  if (n < 020000 || n > memmax) {
+    return false;
+  }
+  memsize = n & ~017777;
+  return true;
 }
 
-uint16_t read16(const uint32_t a) {
+// unibus address to physical, for the dma of the disk and tape
+// controllers. without the unibus map the low 248k are mapped 1:1.
+uint32_t map(const uint32_t a) {
+  const uint32_t p = (a >> 13) & 037;
+  if (p == 037) {
+    return IOPAGE | (a & 017777);
+  }
+  if (mmu::SR3 & mmu::SR3_UBM) {
+    return (ubmap[p] + (a & 017776)) & 017777777;
+  }
+  return a & 0777777;
+}
+
+// the PS and the mmu registers, the lockstep verify of the block cache
+// saves them with the cpu and can run an access twice
+static inline bool cpureg(const uint32_t a) {
+  return a == 0777776 || (a >= 0777572 && a <= 0777576) || a == 0772516 ||
+         (a & 0777600) == 0772200 || (a & 0777700) == 0777600;
+}
+
+uint16_t read16(uint32_t a) {
   /*
   if (a == 0777775) { // SLR special
     return SLR & 0177400;
@@ -84,9 +131,16 @@ uint16_t read16(const uint32_t a) {
     longjmp(trapbuf, INTBUS);
     return 0xFFFF; // -1
   }
-  if (a < 0760000 ) {
+  if (a < memsize) {
     return core16[a >> 1];
   }
+  if (a < IOPAGE) { // non existent memory
+    longjmp(trapbuf, INTBUS);
+  }
+  a &= 0777777;
+  if (!cpureg(a)) {
+    bcache::io();
+  }
 
   if (a == 0777774) {
     return SLR;
@@ -111,8 +165,16 @@ uint16_t read16(const uint32_t a) {
     return mmu::SR2;
   }
 
-  if (a == 0777516) { // SSR3
-    return 0; // mmu::SSR3;
+  if (a == 0772516) { // SSR3
+    return mmu::SR3;
+  }
+
+  if ((a & 0777600) == 0770200) { // unibus map
+    const uint32_t i = (a >> 2) & 037;
+    if (i == 037) {
+      return 0;
+    }
+    return (a & 2) ? (ubmap[i] >> 16) & 077 : ubmap[i] & 0177776;
   }
 
   if (a == 0777746) { // CCR
@@ -138,6 +200,9 @@ uint16_t read16(const uint32_t a) {
   if ((a & 0777720) == 0772520) {
     return tm11::read16(a);
   }
+  if ((a & 0777770) == 0760100) {
+    return dz11::read16(a);
+  }
   if (a == 0760000) { // fuibyte, gword
     longjmp(trapbuf, INTBUS);
     return 0xFFFF;
@@ -148,15 +213,63 @@ uint16_t read16(const uint32_t a) {
 }
 
 
-void write16(const uint32_t a, const uint16_t v) {
+// block moves in core for the fused copy and clear loops, n words,
+// the caller checked the addresses
+static void written(const uint32_t dst, const uint32_t n) {
+  for (uint32_t a = dst & ~077; a < dst + n * 2; a += 0100) {
+    bcache::written(a);
+    touched(a);
+  }
+}
+
+// the words a block in lockstep overwrites, see bcache.h
+static void journal(const uint32_t dst, const uint32_t n) {
+  if (bcache::logging) {
+    for (uint32_t i = 0; i < n; i++) {
+      bcache::note(dst + i * 2);
+    }
+  }
+}
+
+void copy16(const uint32_t dst, const uint32_t src, const uint32_t n) {
+  journal(dst, n);
+  memcpy(&core16[dst >> 1], &core16[src >> 1], n * 2);
+  written(dst, n);
+}
+
+void fill16(const uint32_t dst, const uint16_t v, const uint32_t n) {
+  journal(dst, n);
+  for (uint32_t i = 0; i < n; i++) {
+    core16[(dst >> 1) + i] = v;
+  }
+  written(dst, n);
+}
+
+// copy n words from host memory into core, the dma of the ram disks
+void load16(const uint32_t dst, const void *src, const uint32_t n) {
+  memcpy(&core16[dst >> 1], src, n * 2);
+  written(dst, n);
+}
+
+void write16(uint32_t a, const uint16_t v) {
   if (a & 1) {
     Serial.printf("unibus: write16 to odd address: %06o\r\n", a);
     longjmp(trapbuf, INTBUS);
   }
-  if (a < 0760000) {
+  if (a < memsize) {
+    bcache::before(a);
     core16[a >> 1] = v;
+    bcache::written(a);
+    touched(a);
     return;
   }
+  if (a < IOPAGE) { // non existent memory
+    longjmp(trapbuf, INTBUS);
+  }
+  a &= 0777777;
+  if (!cpureg(a)) {
+    bcache::io();
+  }
   switch (a) {
     case 0777776:
       switch (v >> 14) {
@@ -182,6 +295,7 @@ void write16(const uint32_t a, const uint16_t v) {
           panic();
       }
       cpu::PS.Word = v;
+      bcache::remap();
       return;
     /*  
     case 0777774:
@@ -193,6 +307,7 @@ void write16(const uint32_t a, const uint16_t v) {
       return;
     case 0777572:
       mmu::SR0 = v;
+      bcache::remap();
       return;
     case 0777574:
       mmu::SR1 = v;
@@ -200,16 +315,29 @@ void write16(const uint32_t a, const uint16_t v) {
     case 0777576:
       mmu::SR2 = v;
       return;
-    case 0777516:
-      //mmu::SR3 = v;
+    case 0772516:
+      mmu::setsr3(v);
+      bcache::remap();
       return;
     case 0777570: // switch register
     if (console::active) {
-      displayWordExternal(v);
+      panel::display(v);
     }
       SWR = v;
       return;
   }
+  if ((a & 0777600) == 0770200) {
+    const uint32_t i = (a >> 2) & 037;
+    if (i == 037) {
+      return;
+    }
+    if (a & 2) {
+      ubmap[i] = (ubmap[i] & 0177776) | ((uint32_t)(v & 077) << 16);
+    } else {
+      ubmap[i] = (ubmap[i] & 017600000) | (v & 0177776);
+    }
+    return;
+  }
   if ((a & 0777770) == 0777560) {
     dl11::write16(a, v);
     return;
@@ -220,12 +348,17 @@ void write16(const uint32_t a, const uint16_t v) {
   }
   if (((a & 0777600) == 0772200) || ((a & 0777600) == 0777600)) {
     mmu::write16(a, v);
+    bcache::remap();
     return;
   }
   if ((a & 0777720) == 0772520) {
     tm11::write16(a, v);
     return;
   }
+  if ((a & 0777770) == 0760100) {
+    dz11::write16(a, v);
+    return;
+  }
   Serial.printf("unibus: write16 invalid address: %06o\r\n", a);
   longjmp(trapbuf, INTBUS);
   return;
@@ -238,6 +371,10 @@ uint16_t read8(const uint32_t a) {
     Serial.printf("%06o: read8 from %06o\r\n", cpu::PC, a);
   }
   */
+  if ((a & 0777770) == 0760100) {
+    bcache::io();
+    return dz11::read8(a & 0777777);
+  }
   if (a & 1) {
     return read16(a & ~1) >> 8;
   }
@@ -251,15 +388,76 @@ void write8(const uint32_t a, const uint16_t v) {
     Serial.printf("%06o: write8 %06o to %06o\r\n", cpu::PC, v, a);
   }
   */
-  if (a < 0760000) {
+  if (a < memsize) {
+    bcache::before(a);
     core8[a] = v & 0xFF; // bootloader does things
+    bcache::written(a);
+    touched(a);
+    return;
+  }
+  if ((a & 0777770) == 0760100) {
+    bcache::io();
+    dz11::write8(a & 0777777, v);
     return;
   }
   if (a & 1) {
-    write16(a&~1, (read16(a) & 0xFF) | (v & 0xFF) << 8);
+    write16(a&~1, (read16(a&~1) & 0xFF) | (v & 0xFF) << 8);
     return;
   } 
   write16(a&~1, (read16(a) & 0xFF00) | (v & 0xFF));
 }
 
-};
\ No newline at end of file
+// core up to memsize in one transfer, or in a delta the runs of chunks
+// written since the last checkpoint: first chunk, number of chunks and
+// their contents, a run of 0 ends the list. a snapshot with more core
+// than this machine can allocate is refused.
+void snapshot(snap::io &s) {
+  s(SWR);
+  s(SLR);
+  s(PIRQ);
+  s(ubmap);
+  uint32_t n = memsize;
+  s(n);
+  if (s.load && s.ok && n > memmax) {
+    Serial.printf("unibus: the snapshot has %uk of core, at most %uk here\r\n", n >> 10, memmax >> 10);
+    s.fail();
+    return;
+  }
+  memsize = n;
+  if (!s.delta) {
+    s.bytes(core16, memsize);
+  } else if (s.load) {
+    uint32_t run[2] = { 0, 1 };
+    while (s.ok && run[1]) {
+      s(run);
+      if (((run[0] + run[1]) << 6) > memsize) {
+        s.fail();
+        return;
+      }
+      s.bytes(&core16[run[0] << 5], run[1] << 6);
+    }
+  } else {
+    const uint32_t end = memsize >> 6;
+    uint32_t c = 0;
+    while (c < end) {
+      if (!(dirty[c >> 5] & (1 << (c & 31)))) {
+        c = dirty[c >> 5] ? c + 1 : (c | 31) + 1; // skip clean words whole
+        continue;
+      }
+      uint32_t run[2] = { c, 0 };
+      while (c < end && (dirty[c >> 5] & (1 << (c & 31)))) {
+        c++;
+      }
+      run[1] = c - run[0];
+      s(run);
+      s.bytes(&core16[run[0] << 5], run[1] << 6);
+    }
+    uint32_t last[2] = { 0, 0 };
+    s(last);
+  }
+  if (s.clean) {
+    memset(dirty, 0, sizeof(dirty));
+  }
+}
+
+};
@@ -1,4 +1,17 @@
+#pragma once
+
+#include <pdp11.h>
 #include <SdFat.h>
+
+// physical addresses are 22 bits, the top 8k are the io page. the
+// devices decode the low 18 bits, so their registers keep the unibus
+// addresses 760000-777777.
+#define IOPAGE 017760000
+// default core size, the 248k of an 18 bit machine
+#define MEMSIZE 0760000
+// 64 byte chunks of core, the unit of the dirty tracking
+#define CORE_CHUNKS (IOPAGE >> 6)
+
 namespace unibus {
   
     // operations on uint32_t types are insanely expensive
@@ -7,16 +20,34 @@ namespace unibus {
      uint32_t value;
     };
 
-    extern uint16_t SWR;
-    extern uint16_t SLR;
-    extern uint16_t PIRQ;
+    extern MACHINE_STATE uint16_t SWR;
+    extern MACHINE_STATE uint16_t SLR;
+    extern MACHINE_STATE uint16_t PIRQ;
+    extern MACHINE_STATE uint16_t *core16;
+    extern MACHINE_STATE uint32_t memsize; // bytes of core, addresses above are non existent
+    extern MACHINE_STATE uint32_t memmax;  // bytes of core allocated
+    extern MACHINE_STATE uint32_t ubmap[31];
+    // chunks written since the last checkpoint, see snap::checkpoint
+    extern MACHINE_STATE uint32_t dirty[CORE_CHUNKS / 32];
+
+    static inline void touched(const uint32_t a) {
+      dirty[a >> 11] |= 1 << ((a >> 6) & 31);
+    }
 
     uint16_t read8(uint32_t addr);
     uint16_t read16(uint32_t addr);
     void write8(uint32_t a, uint16_t v);
     void write16(uint32_t a, uint16_t v);
 
+    uint32_t map(uint32_t a);
+    bool setmem(uint32_t n);
+
+    void copy16(uint32_t dst, uint32_t src, uint32_t n);
+    void fill16(uint32_t dst, uint16_t v, uint32_t n);
+    void load16(uint32_t dst, const void *src, uint32_t n);
+
     void reset(void);
     bool dump(void);
+    void snapshot(snap::io &s);
 };
 
@@ -3,8 +3,6 @@
 #include <SPI.h>
 #include <Wire.h>
 #include <RTClib.h>
-#include <Adafruit_GFX.h>
-#include <Adafruit_LEDBackpack.h>
 //#include <Adafruit_SSD1306.h>
 
 #if defined(ARDUINO_TEENSY40)
@@ -42,9 +40,21 @@ SdFat sd;
 #include "rk05.h"
 #include "tm11.h"
 #include "dl11.h"
+#include "dz11.h"
+#include "sched.h"
+#include "kw11.h"
+#include "panel.h"
 #include "unibus.h"
 #include "cpu.h"
+#include "kd11.h"
+#include "istat.h"
 #include "console.h"
+#include "machine.h"
+#include "prof.h"
+#include "tbuf.h"
+#include "rr.h"
+#include "snap.h"
+#include "bench.h"
 
 using namespace TeensyTimerTool;
 
@@ -65,31 +75,33 @@ extern "C"
     };
 }
 
-Adafruit_8x16matrix m70 = Adafruit_8x16matrix();
-Adafruit_8x16matrix m71 = Adafruit_8x16matrix();
-Adafruit_AlphaNum4  m72 = Adafruit_AlphaNum4();
-Adafruit_AlphaNum4  m73 = Adafruit_AlphaNum4();
-
 //Adafruit_SSD1306 display = Adafruit_SSD1306(128, 32, &Wire);
 
 //Timer lks;
 PeriodicTimer lks;
+PeriodicTimer hostpoll;
 RTC_DS3231 rtc;
 
 bool boot = false;
-int  trace = 0;
 
-uint16_t tcounter = 0;
 uint16_t hz = 60;
-uint32_t scounter = 0;
-uint32_t ips = 0;
+uint32_t scounter = 0; // instruction count at the last second
+uint32_t ips = 0;      // executed instructions per second
+uint32_t iskip = 0;    // instructions skipped in WAIT per second
+uint32_t idlepct = 0;    // host time slept in WAIT, percent
+uint32_t gspeed = 0;     // guest time per host second, percent of a real 11/40
+static uint32_t sskip, sidle;
+static uint64_t scycles;
 
 static void loop0();
-  
-jmp_buf trapbuf;
 
+// ^T starts and stops the binary trace, see the tb command
 void toggle_trace() {
-  trace = 1000;
+  if (tbuf::on) {
+    tbuf::stop();
+  } else {
+    tbuf::start();
+  }
 }
 
 /*
@@ -161,106 +173,45 @@ void flexRamInfo(void) {
                 FLASH_SIZE * 1024 - ((unsigned)&_flashimagelen), "FLASHMEM, PROGMEM");
 }
 
-void displayWord(Adafruit_AlphaNum4 *hi, Adafruit_AlphaNum4 *lo, uint32_t val) {
-  //hi->clear();
-  //lo->clear();
-  for (int i = 0; i < 8; i++) {
-    char digit = val & 7;
-    switch (i) {
-      case 0:
-        lo->writeDigitAscii(3, digit + 0x30);
-        break;
-      case 1:
-        lo->writeDigitAscii(2, digit + 0x30);
-        break;
-      case 2:
-        lo->writeDigitAscii(1, digit + 0x30);
-        break;
-      case 3:
-        lo->writeDigitAscii(0, digit + 0x30);
-        break;
-      case 4:
-        hi->writeDigitAscii(3, digit + 0x30);
-        break;
-      case 5:
-        hi->writeDigitAscii(2, digit + 0x30);
-        break;
-      case 6:
-        hi->writeDigitAscii(1, digit + 0x30);
-        break;
-      case 7:
-        hi->writeDigitAscii(0, digit + 0x30);
-        break;
-    }
-    val = val >> 3;    
-  }
-  hi->writeDisplay();
-  lo->writeDisplay();
-}
-
-void displayWordExternal(uint32_t val) {
-  displayWord(&m72, &m73, val);
-}
-
-void writeByte(Adafruit_8x16matrix *mx, uint8_t line, uint8_t val) {
-  mx->drawPixel(line, 0, val & (1 << 0));
-  mx->drawPixel(line, 1, val & (1 << 1));
-  mx->drawPixel(line, 2, val & (1 << 2));
-  mx->drawPixel(line, 3, val & (1 << 3));
-  mx->drawPixel(line, 4, val & (1 << 4));
-  mx->drawPixel(line, 5, val & (1 << 5));
-  mx->drawPixel(line, 6, val & (1 << 6));
-  mx->drawPixel(line, 7, val & (1 << 7));
-}
-
-void writeWord(Adafruit_8x16matrix *mx, uint8_t line, uint16_t val) {
-  writeByte(mx, line, val & 0xFF);
-  writeByte(mx, line + 8, val >> 8);
-}
-
-void displayRegisters() {
-  writeWord(&m70, 0, cpu::R[0]);
-  writeWord(&m70, 1, cpu::R[2]);
-  writeWord(&m70, 2, cpu::R[4]);
-  writeWord(&m70, 3, cpu::R[6]);
-  writeWord(&m70, 7, cpu::PS.Word);
-
-  writeWord(&m71, 0, cpu::R[1]);
-  writeWord(&m71, 1, cpu::R[3]);
-  writeWord(&m71, 2, cpu::R[5]);
-  writeWord(&m71, 3, cpu::R[7]);
-  writeWord(&m71, 7, tcounter);
-  //writeWord(&m71, 7, (rk11::cylinder << 8) | (rk11::sector << 4) | (1 << rk11::drive));
-  displayWord(&m72, &m73, (rk11::cylinder << 12) | (rk11::sector));
-  m70.writeDisplay();
-  m71.writeDisplay();
-  yield();
-}
-
-
 void lks_tick() {
   //yield();
-  tcounter++;
+  panel::tcounter++;
   if (0 == --hz) {
     hz = 60;
-    ips = scounter;
-    scounter = 0;
+    iskip = (uint32_t) sched::idle_icount - sskip;
+    ips = (uint32_t) sched::icount - scounter - iskip;
+    idlepct = ((uint32_t) sched::idle_us - sidle) / 10000;
+    scounter = (uint32_t) sched::icount;
+    sskip = (uint32_t) sched::idle_icount;
+    sidle = (uint32_t) sched::idle_us;
+    gspeed = (uint32_t)((kd11::cycles - scycles) / 10000000);
+    scycles = kd11::cycles;
   }
-  if (!console::active) {
-    displayRegisters();
-    //uint16_t csw = unibus::SWR;
-    //displayWord(&m72, &m73, csw);
-    cpu::LKS |= (1 << 7);
-    if (cpu::LKS & (1 << 6)) {
-      cpu::interrupt(INTCLOCK, 6);
+  if (!console::active && !kw11::vclock) {
+    if (rr::mode) {
+      rr::tick(); // logged, or taken from the log
+    } else {
+      kw11::tick();
     }
   }
 }
 
+// the usb serial has no user interrupt, look for console input at 1 kHz
+// so the main loop can run uninterrupted batches of instructions. the
+// port is a bench script while one runs.
+void host_tick() {
+  if (dl11::port->available()) {
+    sched::work |= sched::WORK_INPUT;
+  }
+  if (!console::active) {
+    prof::tick(true);
+  }
+}
+
 void panic() {
   __disable_irq();
   print_state();
-  displayRegisters();
+  panel::refresh(true);
   __enable_irq();
   console::loop(true);
   //abort();
@@ -319,61 +270,21 @@ void setup() {
   }
   */
 
-  m70.begin(0x70);  // pass in the address
-  m71.begin(0x71);
-  m72.begin(0x72);
-  m73.begin(0x73);
-  m70.setRotation(3);
-  m71.setRotation(3);
-  for (int i = 0; i < 8; i++) {  
-    writeWord(&m70, i, 0xFFFF);
-    writeWord(&m71, i, 0xFFFF);
-    m72.writeDigitAscii(0, 0x30 + i);
-    m72.writeDigitAscii(1, 0x30 + i);
-    m72.writeDigitAscii(2, 0x30 + i);
-    m72.writeDigitAscii(3, 0x30 + i);
-    m73.writeDigitAscii(0, 0x30 + i);
-    m73.writeDigitAscii(1, 0x30 + i);
-    m73.writeDigitAscii(2, 0x30 + i);
-    m73.writeDigitAscii(3, 0x30 + i);
-    m70.writeDisplay();
-    m71.writeDisplay();
-    m72.writeDisplay();
-    m73.writeDisplay();
-    delay(100);
-  }
-  m70.clear();
-  m71.clear();
-  m72.clear();
-  m73.clear();
-  m70.writeDisplay();
-  m71.writeDisplay();
-  m72.writeDisplay();
-  m73.writeDisplay();
-  /*
-  if (haveSSD1306) {
-    display.clearDisplay();
-    display.display();
-  }
-  */
-  m72.writeDigitAscii(0, 'P');
-  m72.writeDigitAscii(1, 'D');
-  m72.writeDigitAscii(2, 'P');
-  m72.writeDigitAscii(3, '1');
-  m73.writeDigitAscii(0, '1');
-  m73.writeDigitAscii(1, '/');
-  m73.writeDigitAscii(2, '4');
-  m73.writeDigitAscii(3, '0');
-  m72.writeDisplay();
-  m73.writeDisplay();
+  panel::begin();
 
   flexRamInfo();
   // must be before cpu::reset and console::loop to prevent clearing of the boot rom or deposit code
   unibus::reset(); 
+  sched::reset();
+  kd11::init();
+  istat::init();
   console::loop(false);
-  cpu::reset();
+  if (!snap::restored) {
+    cpu::reset();
+  }
   //lks.beginPeriodic(lks_tick, 16667);
   lks.begin(lks_tick, 16667);
+  hostpoll.begin(host_tick, 1000);
 }
 
 void loop() {  
@@ -385,25 +296,15 @@ void loop() {
   loop0();  
 }
 
+// run the machine a slice at a time, yield() with the usb poll, the
+// panel and the governor run between the slices
 static void loop0() {
-  for (;;) {  
-    cpu::step();
-    scounter++;
-    yield();    // without yield, strange things happen
-    /* XXX STKL
-    if (cpu::TRAP_REQ) {
-      longjmp(trapbuf, cpu::TRAP_REQ);
-    }
-    */        
-    __disable_irq();
-    //the itab check is very cheap
-    if ((itab[0].vec) && (itab[0].pri >= ((cpu::PS.Word >> 5) & 7))) {
-      __enable_irq();
-      cpu::handleinterrupt();
+  for (;;) {
+    if (machine::slice()) {
       return; // exit from loop to reset trapbuf
-    }    
-    __enable_irq();
-    // costs 3 usec
-    dl11::poll();
+    }
+    yield();    // without yield, strange things happen
+    panel::poll();
+    kd11::govern();
   }
 }